@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT += core gui widgets network xml
+QT += core gui widgets network xml concurrent
 
 TARGET = WeatherTool
 TEMPLATE = app
@@ -22,14 +22,51 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 CONFIG += c++11
 
+# zlib for the feed files (see feed.h): the system one, or the copy that comes with Qt on Windows.
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
 SOURCES += \
     src\main.cpp \
-    src\data.cpp
+    src\batch.cpp \
+    src\cache.cpp \
+    src\data.cpp \
+    src\dataserver.cpp \
+    src\decoder.cpp \
+    src\feed.cpp \
+    src\filter.cpp \
+    src\history.cpp \
+    src\loader.cpp \
+    src\replay.cpp \
+    src\requests.cpp \
+    src\scheduler.cpp \
+    src\search.cpp \
+    src\snapshot.cpp \
+    src\spatial.cpp \
+    src\standin.cpp \
+    src\trace.cpp \
+    src\watchlist.cpp
 
 HEADERS += \
     src\main.h \
+    src\batch.h \
+    src\cache.h \
     src\data.h \
-    src\util.h
+    src\dataserver.h \
+    src\decoder.h \
+    src\feed.h \
+    src\filter.h \
+    src\history.h \
+    src\loader.h \
+    src\replay.h \
+    src\requests.h \
+    src\scheduler.h \
+    src\search.h \
+    src\spatial.h \
+    src\standin.h \
+    src\trace.h \
+    src\util.h \
+    src\watchlist.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,559 @@
+// Benchmarks for the parsing, model and search code, run against the recorded responses in fixtures/.
+// Larger inputs are made by repeating the recorded records, so every size has the same mix of fields.
+// lookupPipeline runs whole lookups against generated responses replayed over a simulated network.
+// feedIngest gzips a scaled-up response to stand in for the dataserver's all-stations cache file.
+// metarFilter and metarSort go through MetarSortFilterModel, the way the tables do when they're filtered and sorted.
+// weatherCache isn't a benchmark: it checks WeatherCache's hits, misses, expiry and eviction against the stand-in.
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QEventLoop>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QtMath>
+#include <QtCore/QTemporaryDir>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include "cache.h"
+#include "data.h"
+#include "dataserver.h"
+#include "decoder.h"
+#include "feed.h"
+#include "filter.h"
+#include "replay.h"
+#include "requests.h"
+#include "spatial.h"
+#include "standin.h"
+#include <zlib.h>
+
+static QByteArray readFixture (const QString& name) {
+    QFile file (QString(FIXTURES_DIR) + "/" + name);
+    if (!file.open(QIODevice::ReadOnly)) qFatal("can't open fixture %s", qPrintable(name));
+    return file.readAll();
+}
+
+// Repeats the CSV records `copies` times.
+static QByteArray scaleCSV (const QByteArray& csv, int copies) {
+    QByteArray scaled;
+    scaled.reserve(csv.size() * copies);
+    for (int i = 0; i < copies; i++) scaled += csv;
+    return scaled;
+}
+
+// Repeats the <element> records inside the response's <data> element until there are at least `count` of them.
+static QByteArray scaleXML (const QByteArray& xml, const QByteArray& element, int count) {
+    QByteArray open = "<" + element + ">", close = "</" + element + ">";
+    int begin = xml.indexOf(open);
+    int end = xml.lastIndexOf(close) + close.size();
+    QByteArray records = xml.mid(begin, end - begin);
+    int perCopy = records.count(open);
+
+    QByteArray scaled = xml.left(begin);
+    for (int n = 0; n < count; n += perCopy) scaled += records;
+    scaled += xml.mid(end);
+    return scaled;
+}
+
+// Compresses data the way the dataserver's cache files are.
+static QByteArray gzip (const QByteArray& data) {
+    z_stream stream {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    QByteArray compressed (int(deflateBound(&stream, uLong(data.size()))), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = uInt(compressed.size());
+    deflate(&stream, Z_FINISH);
+    compressed.resize(int(stream.total_out));
+    deflateEnd(&stream);
+    return compressed;
+}
+
+// The AirportNameModel::readData implementation from before the single-pass scanner, for comparison.
+static QString legacyProcessCSVField (QByteArray bytes) {
+    QByteArray processed;
+    for (auto b: bytes) {
+        if (b != '"') processed += b;
+    }
+    if (processed == QByteArray("\\N")) {
+        return QString();
+    }
+    return QString::fromUtf8(processed);
+}
+
+struct LegacyAirportEntry {
+    QString icao;
+    QString full;
+};
+
+static QList<LegacyAirportEntry> legacyReadAirports (QByteArray csvFile) {
+    QList<LegacyAirportEntry> entries;
+    for (QByteArray line: csvFile.split('\n')) {
+        if (line.isEmpty()) continue;
+        QList<QByteArray> fields = line.split(',');
+        auto name    = legacyProcessCSVField(fields[1]);
+        auto city    = legacyProcessCSVField(fields[2]);
+        auto country = legacyProcessCSVField(fields[3]);
+        auto iata    = legacyProcessCSVField(fields[4]);
+        auto icao    = legacyProcessCSVField(fields[5]);
+        LegacyAirportEntry entry;
+        entry.icao = icao;
+        if (city.isEmpty() && iata.isEmpty()) {
+            entry.full = QString("%1: %2, %3").arg(icao, name, country);
+        } else if (city.isEmpty()) {
+            entry.full = QString("%1/%2: %3, %4").arg(icao, iata, name, country);
+        } else if (iata.isEmpty()) {
+            entry.full = QString("%1: %2, %3, %4").arg(icao, name, city, country);
+        } else {
+            entry.full = QString("%1/%2: %3, %4, %5").arg(icao, iata, name, city, country);
+        }
+        entries.append(entry);
+    }
+    return entries;
+}
+
+// Calls data() for every cell, like a ResizeToContents header does when measuring the columns.
+static int sweep (const QAbstractItemModel& model) {
+    int length = 0;
+    for (int row = 0; row < model.rowCount(); row++) {
+        for (int column = 0; column < model.columnCount(); column++) {
+            length += model.data(model.index(row, column)).toString().size();
+        }
+    }
+    return length;
+}
+
+class WeatherToolBench : public QObject {
+    Q_OBJECT
+    private:
+        QByteArray airports, metars, tafs;
+
+        // Airports: the fixture has 20 rows, so 400 copies is about the size of the full OpenFlights file.
+        void airportSizes () {
+            QTest::addColumn<int>("copies");
+            QTest::newRow("20 rows")     << 1;
+            QTest::newRow("8000 rows")   << 400;
+            QTest::newRow("100000 rows") << 5000;
+        }
+
+        // METARs: 48 is a single station's 48 hour window.
+        void metarSizes () {
+            QTest::addColumn<int>("count");
+            QTest::newRow("48 reports")    << 48;
+            QTest::newRow("1000 reports")  << 1000;
+            QTest::newRow("20000 reports") << 20000;
+        }
+
+        // TAFs: the fixture has 5 forecast periods per TAF.
+        void tafSizes () {
+            QTest::addColumn<int>("count");
+            QTest::newRow("1 TAF")    << 1;
+            QTest::newRow("50 TAFs")  << 50;
+            QTest::newRow("500 TAFs") << 500;
+        }
+    private slots:
+        void initTestCase () {
+            airports = readFixture("airports.dat");
+            metars = readFixture("metars.xml");
+            tafs = readFixture("tafs.xml");
+        }
+
+        void airportReadData_data () { airportSizes(); }
+        void airportReadData () {
+            QFETCH(int, copies);
+            QByteArray csv = scaleCSV(airports, copies);
+            QBENCHMARK {
+                AirportNameModel model;
+                model.readData(csv);
+            }
+        }
+
+        void airportLegacyReadData_data () { airportSizes(); }
+        void airportLegacyReadData () {
+            QFETCH(int, copies);
+            QByteArray csv = scaleCSV(airports, copies);
+            QBENCHMARK {
+                legacyReadAirports(csv);
+            }
+        }
+
+        void airportReadSnapshot_data () { airportSizes(); }
+        void airportReadSnapshot () {
+            QFETCH(int, copies);
+            QTemporaryDir dir;
+            QString path = dir.filePath("airports.snapshot");
+            AirportNameModel model;
+            model.readData(scaleCSV(airports, copies));
+            QVERIFY(model.airports().writeSnapshot(path));
+            QBENCHMARK {
+                AirportData data;
+                QVERIFY(data.readSnapshot(path));
+            }
+        }
+
+        void airportSearch_data () {
+            QTest::addColumn<int>("copies");
+            QTest::addColumn<QString>("query");
+            for (int copies: { 400, 5000 }) {
+                for (QString query: { "l", "lr", "lis", "bucharest", "LROP", "international airport", "xyzzy",
+                    "bucharset", "internatonal" }) {
+                    QTest::newRow(qPrintable(QString("%1 rows, \"%2\"").arg(copies * 20).arg(query)))
+                        << copies << query;
+                }
+            }
+        }
+        void airportSearch () {
+            QFETCH(int, copies);
+            QFETCH(QString, query);
+            AirportNameModel model;
+            model.readData(scaleCSV(airports, copies));
+            QBENCHMARK {
+                model.search(query, 50);
+            }
+        }
+
+        // Airports spread evenly over the globe, since the fixture's coordinates repeat when it's scaled up. The
+        // linear rows check every airport's haversine distance instead of using the spatial index.
+        void airportNearby_data () {
+            QTest::addColumn<int>("airports");
+            QTest::addColumn<int>("count");
+            QTest::addColumn<double>("radiusNm");
+            QTest::addColumn<bool>("linear");
+            for (int airports: { 8000, 100000 }) {
+                for (bool linear: { false, true }) {
+                    QString method = linear ? "linear" : "k-d tree";
+                    QTest::newRow(qPrintable(QString("%1 airports, 25 nearest, %2").arg(airports).arg(method)))
+                        << airports << 25 << -1.0 << linear;
+                    for (double radius: { 50.0, 250.0 }) {
+                        QTest::newRow(qPrintable(QString("%1 airports, within %2 nm, %3")
+                            .arg(airports).arg(radius).arg(method))) << airports << airports << radius << linear;
+                    }
+                }
+            }
+        }
+        void airportNearby () {
+            QFETCH(int, airports);
+            QFETCH(int, count);
+            QFETCH(double, radiusNm);
+            QFETCH(bool, linear);
+            QRandomGenerator random (1);
+            AirportEntries entries;
+            for (int i = 0; i < airports; i++) {
+                float latitude = float(qRadiansToDegrees(qAsin(random.generateDouble() * 2 - 1)));
+                float longitude = float(random.generateDouble() * 360 - 180);
+                entries.append(QString("X%1").arg(i, 3, 36, QChar('0')).toUpper(), QString(), "Airport", QString(),
+                    "Country", latitude, longitude);
+            }
+            AirportSpatialIndex index;
+            index.build(entries);
+            // Frankfurt:
+            const double latitude = 50.036, longitude = 8.559;
+            QBENCHMARK {
+                if (linear) {
+                    QVector<QPair<double, int>> found;
+                    for (int row = 0; row < entries.size(); row++) {
+                        double distance = AirportSpatialIndex::distanceNm(latitude, longitude,
+                            entries.latitude(row), entries.longitude(row));
+                        if (radiusNm < 0 || distance <= radiusNm) found.append({ distance, row });
+                    }
+                    std::sort(found.begin(), found.end());
+                    found.resize(qMin(found.size(), count));
+                } else {
+                    index.nearest(latitude, longitude, count, radiusNm);
+                }
+            }
+        }
+
+        // A feed file of `count` METARs, decompressed and parsed 64 KB at a time as if it were downloading.
+        void feedIngest_data () {
+            QTest::addColumn<int>("count");
+            QTest::newRow("1000 reports") << 1000;
+            QTest::newRow("6000 reports") << 6000;
+        }
+        void feedIngest () {
+            QFETCH(int, count);
+            QByteArray compressed = gzip(scaleXML(metars, "METAR", count));
+            QBENCHMARK {
+                FeedIngest ingest (false);
+                for (int i = 0; i < compressed.size(); i += 64 * 1024) {
+                    ingest.append(compressed.mid(i, 64 * 1024));
+                }
+                QVERIFY(ingest.finish());
+                FeedData data;
+                ingest.mergeInto(data);
+                data.metars.derive();
+                data.index();
+            }
+        }
+
+        void metarReadData_data () { metarSizes(); }
+        void metarReadData () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(metars, "METAR", count);
+            QBENCHMARK {
+                QBuffer buffer (&xml);
+                buffer.open(QIODevice::ReadOnly);
+                MetarModel model;
+                model.readData(&buffer);
+            }
+        }
+
+        void metarSweep_data () { metarSizes(); }
+        void metarSweep () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(metars, "METAR", count);
+            QBuffer buffer (&xml);
+            buffer.open(QIODevice::ReadOnly);
+            MetarModel model;
+            model.readData(&buffer);
+            QBENCHMARK {
+                sweep(model);
+            }
+        }
+
+        void metarFilter_data () { metarSizes(); }
+        void metarFilter () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(metars, "METAR", count);
+            QBuffer buffer (&xml);
+            buffer.open(QIODevice::ReadOnly);
+            MetarModel model;
+            model.readData(&buffer);
+            MetarSortFilterModel sorted;
+            sorted.setMetarModel(&model, &model);
+            MetarFilter filter, windy;
+            QVERIFY(MetarFilter::parse("wind > 25 kt and vis < 3 mi", windy));
+            QBENCHMARK {
+                sorted.setFilter(windy);
+                sorted.setFilter(filter);
+            }
+        }
+
+        void metarSort_data () { metarSizes(); }
+        void metarSort () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(metars, "METAR", count);
+            QBuffer buffer (&xml);
+            buffer.open(QIODevice::ReadOnly);
+            MetarModel model;
+            model.readData(&buffer);
+            MetarSortFilterModel sorted;
+            sorted.setMetarModel(&model, &model);
+            QBENCHMARK {
+                sorted.sort(MetarWindSpeed, Qt::DescendingOrder);
+                sorted.sort(MetarVisibility);
+            }
+        }
+
+        void forecastReadData_data () { tafSizes(); }
+        void forecastReadData () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(tafs, "TAF", count);
+            QBENCHMARK {
+                QBuffer buffer (&xml);
+                buffer.open(QIODevice::ReadOnly);
+                ForecastModel model;
+                model.readData(&buffer);
+            }
+        }
+
+        void forecastSweep_data () { tafSizes(); }
+        void forecastSweep () {
+            QFETCH(int, count);
+            QByteArray xml = scaleXML(tafs, "TAF", count);
+            QBuffer buffer (&xml);
+            buffer.open(QIODevice::ReadOnly);
+            ForecastModel model;
+            model.readData(&buffer);
+            QBENCHMARK {
+                sweep(model);
+            }
+        }
+
+        void weatherCache () {
+            DataserverStandIn server;
+            server.setNow(QDateTime::fromString("2018-09-07T12:10:00Z", Qt::ISODate));
+            QVERIFY(server.listen(QHostAddress::LocalHost));
+            QUrl realBaseUrl = DataserverBaseUrl();
+            SetDataserverBaseUrl(QUrl(QString("http://127.0.0.1:%1/httpparam").arg(server.serverPort())));
+
+            QTemporaryDir dir;
+            QNetworkAccessManager network;
+            WeatherCache* cache = new WeatherCache();
+            cache->setCacheDirectory(dir.path());
+            cache->setTimeToLive("metars", 1);
+            cache->setTimeToLive("tafs", 3600);
+            network.setCache(cache); // takes ownership
+            auto fetch = [&network] (const QUrl& url) {
+                QNetworkReply* reply = network.get(QNetworkRequest(url));
+                QEventLoop loop;
+                connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+                loop.exec();
+                bool ok = reply->error() == QNetworkReply::NoError;
+                delete reply;
+                return ok;
+            };
+            auto storedSize = [&dir] () {
+                qint64 size = 0;
+                QDirIterator it (dir.path(), QDir::Files, QDirIterator::Subdirectories);
+                while (it.hasNext()) {
+                    if (it.next().endsWith(".d")) size += it.fileInfo().size();
+                }
+                return size;
+            };
+
+            // Hits, misses and expiry, going by the time-to-live of the data source:
+            QUrl metarUrl = DataserverMETARUrl("KAAA"), tafUrl = DataserverTAFUrl("KAAA");
+            QByteArray body;
+            QCOMPARE(cache->lookup(metarUrl, &body), WeatherCache::Lookup::Miss);
+            QVERIFY(fetch(metarUrl));
+            QVERIFY(fetch(tafUrl));
+            QCOMPARE(cache->lookup(metarUrl, &body), WeatherCache::Lookup::Fresh);
+            QVERIFY(body.contains("<METAR>"));
+            QTest::qWait(2100);
+            QCOMPARE(cache->lookup(metarUrl, &body), WeatherCache::Lookup::Stale);
+            QCOMPARE(cache->lookup(tafUrl, &body), WeatherCache::Lookup::Fresh);
+            QCOMPARE(cache->stats().misses, 1);
+            QCOMPARE(cache->stats().fresh, 2);
+            QCOMPARE(cache->stats().stale, 1);
+
+            // Eviction is least-recently-used. QNetworkDiskCache expires before storing the new entry, so the cache
+            // goes over its limit with the third one and is trimmed when the fourth comes in. By then, the second is
+            // the one that was used longest ago:
+            QVector<QUrl> urls;
+            for (QString station: { "KAAB", "KAAC", "KAAD", "KAAE" }) {
+                urls.append(DataserverMETARUrl(station));
+            }
+            cache->clear();
+            QVERIFY(fetch(urls[0]));
+            QTest::qWait(10);
+            QVERIFY(fetch(urls[1]));
+            cache->setMaximumCacheSize(storedSize() * 5 / 4); // two and a half entries
+            QTest::qWait(10);
+            QVERIFY(fetch(urls[2]));
+            QTest::qWait(10);
+            QVERIFY(cache->lookup(urls[0], &body) != WeatherCache::Lookup::Miss);
+            QTest::qWait(10);
+            QVERIFY(fetch(urls[3]));
+            QVERIFY(cache->lookup(urls[0], &body) != WeatherCache::Lookup::Miss);
+            QCOMPARE(cache->lookup(urls[1], &body), WeatherCache::Lookup::Miss);
+            QVERIFY(cache->lookup(urls[2], &body) != WeatherCache::Lookup::Miss);
+
+            SetDataserverBaseUrl(realBaseUrl);
+        }
+
+        // Searches for `stations` stations at once, a TAF and a METAR request each, decoded into the models as
+        // they arrive, either on the GUI thread or on the pool (see decoder.h). Latency is per request, bandwidth
+        // per connection (48000 is about a 3G link).
+        void lookupPipeline_data () {
+            QTest::addColumn<int>("stations");
+            QTest::addColumn<int>("latency");
+            QTest::addColumn<int>("bandwidth");
+            QTest::addColumn<bool>("pooled");
+            QTest::newRow("1 station, local")          << 1   << 0   << 0     << false;
+            QTest::newRow("1 station, 3G")             << 1   << 150 << 48000 << false;
+            QTest::newRow("100 stations, local")       << 100 << 0   << 0     << false;
+            QTest::newRow("100 stations, 3G")          << 100 << 150 << 48000 << false;
+            QTest::newRow("500 stations, local")       << 500 << 0   << 0     << false;
+            QTest::newRow("100 stations, local, pool") << 100 << 0   << 0     << true;
+            QTest::newRow("500 stations, local, pool") << 500 << 0   << 0     << true;
+        }
+        void lookupPipeline () {
+            QFETCH(int, stations);
+            QFETCH(int, latency);
+            QFETCH(int, bandwidth);
+            QFETCH(bool, pooled);
+
+            QTemporaryDir dir;
+            ReplayStore store (dir.path());
+            QDateTime now = QDateTime::fromString("2018-09-07T12:10:00Z", Qt::ISODate);
+            QList<QUrl> urls;
+            for (int i = 0; i < stations; i++) {
+                QString station = QString("K%1").arg(i, 3, 10, QChar('0'));
+                for (QUrl url: { DataserverTAFUrl(station), DataserverMETARUrl(station) }) {
+                    RecordedResponse response;
+                    response.url = url;
+                    response.headers.append({ "Content-Type", "text/xml" });
+                    response.body = StandInResponse(QUrlQuery(url), now);
+                    QVERIFY(store.save(response));
+                    urls.append(url);
+                }
+            }
+
+            ReplayNetworkAccessManager network;
+            NetworkConditions conditions;
+            conditions.latency = latency;
+            conditions.bandwidth = bandwidth;
+            network.setConditions(conditions);
+            network.setMode(ReplayNetworkAccessManager::Mode::Replay, dir.path());
+            RequestCoordinator coordinator (&network);
+
+            QBENCHMARK {
+                QVector<QSharedPointer<ForecastModel>> forecasts;
+                QVector<QSharedPointer<MetarModel>> metars;
+                for (int i = 0; i < stations; i++) {
+                    forecasts.append(QSharedPointer<ForecastModel>::create());
+                    metars.append(QSharedPointer<MetarModel>::create());
+                }
+                int failed = 0;
+                QEventLoop loop;
+
+                // With the decoder, the models are only handed the decoded batches:
+                WeatherDecoder decoder;
+                QVector<int> streams;
+                int streamsLeft = urls.size();
+                for (int i = 0; pooled && i < stations; i++) {
+                    forecasts[i]->beginData();
+                    metars[i]->beginData();
+                    ForecastModel* forecast = forecasts[i].data();
+                    MetarModel* metar = metars[i].data();
+                    streams.append(decoder.decodeTafs(CancellationToken(),
+                        [forecast] (int, QSharedPointer<const TafRecords> batch) { forecast->appendTafs(*batch); }));
+                    streams.append(decoder.decodeMetars(CancellationToken(),
+                        [metar] (int, QSharedPointer<const MetarColumns> batch) { metar->appendMetars(*batch); }));
+                }
+
+                coordinator.getAll(urls, CancellationToken(), [&] (const QVector<RequestResult>& results) {
+                    for (const RequestResult& result: results) {
+                        if (result.error != QNetworkReply::NoError) failed++;
+                    }
+                    if (pooled) {
+                        for (int i = 0; i < results.size(); i++) {
+                            decoder.finish(streams[i], results[i].body, [&, i] (bool complete) {
+                                if (i % 2 == 0) forecasts[i / 2]->endData(complete);
+                                else metars[i / 2]->endData(complete);
+                                if (--streamsLeft == 0) loop.quit();
+                            });
+                        }
+                        return;
+                    }
+                    for (int i = 0; i < stations; i++) {
+                        forecasts[i]->endData();
+                        metars[i]->endData();
+                    }
+                    loop.quit();
+                }, [&] (int index, const QByteArray& data) {
+                    if (pooled) {
+                        decoder.append(streams[index], data);
+                        return;
+                    }
+                    // urls alternates between TAF and METAR requests:
+                    if (index % 2 == 0) {
+                        ForecastModel* model = forecasts[index / 2].data();
+                        if (!model->isReading()) model->beginData();
+                        model->appendData(data);
+                    } else {
+                        MetarModel* model = metars[index / 2].data();
+                        if (!model->isReading()) model->beginData();
+                        model->appendData(data);
+                    }
+                });
+                loop.exec();
+                QCOMPARE(failed, 0);
+                QVERIFY(metars.last()->rowCount() > 0);
+            }
+        }
+};
+
+QTEST_GUILESS_MAIN(WeatherToolBench)
+#include "bench.moc"
@@ -0,0 +1,52 @@
+#-------------------------------------------------
+#
+# Benchmarks for the parsing, model and search code, and for whole lookups over a simulated network.
+# Run with e.g. "WeatherToolBench -o results.csv,csv" (or xml) for machine-readable output.
+#
+#-------------------------------------------------
+
+QT += core gui network xml concurrent testlib
+
+TARGET = WeatherToolBench
+TEMPLATE = app
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += FIXTURES_DIR=\\\"$$PWD/fixtures\\\"
+
+INCLUDEPATH += ..\src
+
+# zlib for the feed files (see feed.h): the system one, or the copy that comes with Qt on Windows.
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
+SOURCES += \
+    bench.cpp \
+    ..\src\cache.cpp \
+    ..\src\data.cpp \
+    ..\src\dataserver.cpp \
+    ..\src\decoder.cpp \
+    ..\src\feed.cpp \
+    ..\src\filter.cpp \
+    ..\src\replay.cpp \
+    ..\src\requests.cpp \
+    ..\src\search.cpp \
+    ..\src\snapshot.cpp \
+    ..\src\spatial.cpp \
+    ..\src\standin.cpp \
+    ..\src\trace.cpp
+
+HEADERS += \
+    ..\src\cache.h \
+    ..\src\data.h \
+    ..\src\dataserver.h \
+    ..\src\decoder.h \
+    ..\src\feed.h \
+    ..\src\filter.h \
+    ..\src\replay.h \
+    ..\src\requests.h \
+    ..\src\search.h \
+    ..\src\spatial.h \
+    ..\src\standin.h \
+    ..\src\trace.h
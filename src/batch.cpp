@@ -0,0 +1,263 @@
+#include "batch.h"
+#include "dataserver.h"
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QRegExp>
+#include <QtCore/QtNumeric>
+#include <iostream>
+using namespace std;
+
+
+
+// BatchWriter
+
+static QString csvField (const QString& text) {
+    if (!text.contains(',') && !text.contains('"') && !text.contains('\n')) return text;
+    QString quoted = text;
+    quoted.replace('"', "\"\"");
+    return '"' + quoted + '"';
+}
+
+static QString csvNumber (float value) {
+    return qIsNaN(value) ? QString() : QString::number(value);
+}
+
+static QJsonValue jsonNumber (float value) {
+    return qIsNaN(value) ? QJsonValue() : QJsonValue(double(value));
+}
+
+static QString isoTime (qint64 secsSinceEpoch) {
+    return QDateTime::fromSecsSinceEpoch(secsSinceEpoch, Qt::UTC).toString(Qt::ISODate);
+}
+
+BatchWriter::BatchWriter (QTextStream& out, BatchFormat format, bool tafs) : out(out), format(format), tafs(tafs) {}
+
+void BatchWriter::writeHeader () {
+    if (wroteHeader || format != BatchFormat::CSV) return;
+    wroteHeader = true;
+    if (tafs) {
+        out << "station_id,issue_time,fcst_time_from,fcst_time_to,change_indicator,probability,wx_string,"
+            "sky_condition,raw_text\n";
+    } else {
+        out << "station_id,observation_time,temp_c,dewpoint_c,wind_dir_degrees,wind_speed_kt,"
+            "visibility_statute_mi,sky_condition,raw_text\n";
+    }
+}
+
+void BatchWriter::write (const MetarColumns& c) {
+    writeHeader();
+    for (int row = 0; row < c.count(); row++) {
+        const QString& station = c.stations.value(c.station[row]);
+        if (format == BatchFormat::CSV) {
+            out << csvField(station) << ',' << isoTime(c.observationTime[row]) << ','
+                << csvNumber(c.tempC[row]) << ',' << csvNumber(c.dewpointC[row]) << ','
+                << csvNumber(c.windDirDeg[row]) << ',' << csvNumber(c.windSpeedKt[row]) << ','
+                << csvNumber(c.visibilityMi[row]) << ',' << csvField(c.sky(row)) << ','
+                << csvField(c.raw(row)) << '\n';
+        } else {
+            QJsonObject o;
+            o.insert("station_id", station);
+            o.insert("observation_time", isoTime(c.observationTime[row]));
+            o.insert("temp_c", jsonNumber(c.tempC[row]));
+            o.insert("dewpoint_c", jsonNumber(c.dewpointC[row]));
+            o.insert("wind_dir_degrees", jsonNumber(c.windDirDeg[row]));
+            o.insert("wind_speed_kt", jsonNumber(c.windSpeedKt[row]));
+            o.insert("visibility_statute_mi", jsonNumber(c.visibilityMi[row]));
+            o.insert("sky_condition", c.sky(row));
+            o.insert("raw_text", c.raw(row));
+            out << QJsonDocument(o).toJson(QJsonDocument::Compact) << '\n';
+        }
+    }
+    out.flush();
+}
+
+void BatchWriter::write (const TafRecords& records) {
+    writeHeader();
+    for (const TafForecast& f: records.forecasts) {
+        const TafReport& r = records.reports[f.report];
+        QString change = FormatChangeIndicator(f.changeIndicator, f.probability);
+        QString sky = FormatSkyLayers(f.skyLayers);
+        QString wx = f.wxStrings.join(' ');
+        if (format == BatchFormat::CSV) {
+            out << csvField(r.stationId) << ',' << r.issueTime.toString(Qt::ISODate) << ','
+                << f.from.toString(Qt::ISODate) << ',' << f.to.toString(Qt::ISODate) << ','
+                << change << ',' << (f.probability > 0 ? QString::number(f.probability) : QString()) << ','
+                << csvField(wx) << ',' << csvField(sky) << ',' << csvField(r.rawText) << '\n';
+        } else {
+            QJsonObject o;
+            o.insert("station_id", r.stationId);
+            o.insert("issue_time", r.issueTime.toString(Qt::ISODate));
+            o.insert("fcst_time_from", f.from.toString(Qt::ISODate));
+            o.insert("fcst_time_to", f.to.toString(Qt::ISODate));
+            o.insert("change_indicator", change);
+            o.insert("probability", f.probability > 0 ? QJsonValue(f.probability) : QJsonValue());
+            o.insert("wx_string", wx);
+            o.insert("sky_condition", sky);
+            o.insert("raw_text", r.rawText);
+            out << QJsonDocument(o).toJson(QJsonDocument::Compact) << '\n';
+        }
+    }
+    out.flush();
+}
+
+
+
+// BatchRunner
+
+BatchRunner::BatchRunner (BatchWriter& writer, bool tafs, int parallel, QObject* parent)
+    : QObject(parent), writer(writer), tafs(tafs), parallel(qMax(1, parallel)) {}
+
+void BatchRunner::start (const QList<QUrl>& urls) {
+    for (const QUrl& url: urls) queue.enqueue(url);
+    if (queue.isEmpty()) {
+        emit finished(0);
+        return;
+    }
+    while (running < parallel && !queue.isEmpty()) startNext();
+}
+
+void BatchRunner::startNext () {
+    QNetworkReply* reply = networkAccessManager.get(QNetworkRequest(queue.dequeue()));
+    connect(reply, &QNetworkReply::finished, this, &BatchRunner::requestFinished);
+    running++;
+}
+
+void BatchRunner::requestFinished () {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    running--;
+    if (reply->error() != QNetworkReply::NoError) {
+        failed = true;
+        cerr << "batch: " << reply->url().toString().toStdString() << " failed: "
+             << reply->errorString().toStdString() << endl;
+    } else {
+        QXmlStreamReader xml (reply);
+        if (tafs) {
+            TafRecords records;
+            ReadTafXml(xml, records);
+            writer.write(records);
+        } else {
+            MetarColumns columns;
+            ReadMetarXml(xml, columns);
+            writer.write(columns);
+        }
+        if (xml.hasError()) {
+            failed = true;
+            cerr << "batch: " << reply->url().toString().toStdString() << ": " << xml.errorString().toStdString()
+                 << endl;
+        }
+    }
+    reply->deleteLater();
+
+    if (!queue.isEmpty()) startNext();
+    if (running == 0) emit finished(failed ? 1 : 0);
+}
+
+
+
+// RunBatch
+
+int RunBatch (int argc, char* argv[]) {
+    QCoreApplication app (argc, argv);
+    QCoreApplication::setOrganizationName("xndc");
+    QCoreApplication::setOrganizationDomain("io.github.xndc");
+    QCoreApplication::setApplicationName("WeatherTool");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Fetches and decodes METARs or TAFs without opening a window.");
+    parser.addHelpOption();
+    parser.addOption({ "batch", "Run in headless batch mode." });
+    parser.addOption({ "data", "What to fetch: metars (default) or tafs.", "source", "metars" });
+    parser.addOption({ "format", "Output format: csv (default) or ndjson.", "format", "csv" });
+    parser.addOption({ "parallel", "Maximum number of concurrent requests (default 4).", "n", "4" });
+    parser.addOption({ "batch-size", "Stations per request (default 25).", "n", "25" });
+    parser.addOption({ "hours", "How many hours of history to fetch (default 2).", "hours", "2" });
+    parser.addOption({ "input", "Decode a saved dataserver response instead of fetching. Can be repeated.",
+        "file.xml" });
+    parser.addOption({ "dataserver", "Dataserver URL to use instead of aviationweather.gov.", "url" });
+    parser.addOption({ "record", "Save every response in this directory.", "dir" });
+    parser.addOption({ "replay", "Serve responses saved with --record instead of using the network.", "dir" });
+    parser.addOption({ "latency", "With --replay: msecs until each response starts (default 0).", "msecs", "0" });
+    parser.addOption({ "jitter", "With --replay: up to this many msecs of random extra latency.", "msecs", "0" });
+    parser.addOption({ "bandwidth", "With --replay: bytes per second for each response (default unlimited).",
+        "bytes", "0" });
+    parser.addOption({ "error-rate", "With --replay: fraction of requests that fail (default 0).", "rate", "0" });
+    parser.addPositionalArgument("stations", "ICAO codes. Read from stdin if none are given.", "[ICAO...]");
+    parser.process(app);
+
+    bool tafs = parser.value("data") == "tafs";
+    BatchFormat format = parser.value("format") == "ndjson" ? BatchFormat::NDJSON : BatchFormat::CSV;
+    QTextStream out (stdout);
+    out.setCodec("UTF-8");
+    BatchWriter writer (out, format, tafs);
+
+    // Offline mode, no network needed:
+    if (parser.isSet("input")) {
+        int exitCode = 0;
+        for (const QString& path: parser.values("input")) {
+            QFile file (path);
+            if (!file.open(QIODevice::ReadOnly)) {
+                cerr << "batch: can't open " << path.toStdString() << endl;
+                exitCode = 1;
+                continue;
+            }
+            QXmlStreamReader xml (&file);
+            if (tafs) {
+                TafRecords records;
+                ReadTafXml(xml, records);
+                writer.write(records);
+            } else {
+                MetarColumns columns;
+                ReadMetarXml(xml, columns);
+                writer.write(columns);
+            }
+            if (xml.hasError()) {
+                cerr << "batch: " << path.toStdString() << ": " << xml.errorString().toStdString() << endl;
+                exitCode = 1;
+            }
+        }
+        return exitCode;
+    }
+
+    // Stations from the arguments, or one or more per line on stdin:
+    QStringList stations = parser.positionalArguments();
+    if (stations.isEmpty()) {
+        QTextStream in (stdin);
+        while (!in.atEnd()) {
+            stations += in.readLine().split(QRegExp("[\\s,]+"), QString::SkipEmptyParts);
+        }
+    }
+    for (QString& station: stations) station = station.toUpper();
+    stations.removeDuplicates();
+
+    if (parser.isSet("dataserver")) SetDataserverBaseUrl(QUrl::fromUserInput(parser.value("dataserver")));
+    int batchSize = qMax(1, parser.value("batch-size").toInt());
+    QString hours = QString::number(qMax(1, parser.value("hours").toInt()));
+    QList<QUrl> urls;
+    for (int i = 0; i < stations.size(); i += batchSize) {
+        if (tafs) {
+            urls.append(DataserverUrl("tafs", stations.mid(i, batchSize),
+                { { "hoursBeforeNow", hours }, { "mostRecentForEachStation", "constraint" } }));
+        } else {
+            urls.append(DataserverUrl("metars", stations.mid(i, batchSize), { { "hoursBeforeNow", hours } }));
+        }
+    }
+
+    BatchRunner runner (writer, tafs, parser.value("parallel").toInt());
+    if (parser.isSet("record")) {
+        runner.network().setMode(ReplayNetworkAccessManager::Mode::Record, parser.value("record"));
+    } else if (parser.isSet("replay")) {
+        NetworkConditions conditions;
+        conditions.latency = parser.value("latency").toInt();
+        conditions.jitter = parser.value("jitter").toInt();
+        conditions.bandwidth = parser.value("bandwidth").toLongLong();
+        conditions.errorRate = parser.value("error-rate").toDouble();
+        runner.network().setConditions(conditions);
+        runner.network().setMode(ReplayNetworkAccessManager::Mode::Replay, parser.value("replay"));
+    }
+    QObject::connect(&runner, &BatchRunner::finished, &app, &QCoreApplication::exit, Qt::QueuedConnection);
+    runner.start(urls);
+    return app.exec();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include "data.h"
+#include "replay.h"
+
+// Headless mode (--batch): runs on QCoreApplication without any widgets, fetches METARs or TAFs for a list of
+// stations (arguments or stdin) or decodes saved responses (--input), and streams the decoded records to stdout as
+// CSV or NDJSON. Returns the process exit code.
+int RunBatch (int argc, char* argv[]);
+
+enum class BatchFormat { CSV, NDJSON };
+
+// Writes decoded records in the chosen format. The CSV header is written before the first record.
+class BatchWriter {
+    public:
+        BatchWriter (QTextStream& out, BatchFormat format, bool tafs);
+        void write (const MetarColumns& metars);
+        void write (const TafRecords& tafs);
+    private:
+        void writeHeader ();
+        QTextStream& out;
+        BatchFormat format;
+        bool tafs;
+        bool wroteHeader = false;
+};
+
+// Sends the batched dataserver requests, at most `parallel` at a time, and writes each response as soon as it's
+// decoded, so output order follows completion order.
+class BatchRunner : public QObject {
+    Q_OBJECT
+    public:
+        BatchRunner (BatchWriter& writer, bool tafs, int parallel, QObject* parent = nullptr);
+        void start (const QList<QUrl>& urls);
+        ReplayNetworkAccessManager& network () { return networkAccessManager; }
+    signals:
+        void finished (int exitCode);
+    private slots:
+        void requestFinished ();
+    private:
+        void startNext ();
+        BatchWriter& writer;
+        bool tafs;
+        int parallel;
+        int running = 0;
+        bool failed = false;
+        QQueue<QUrl> queue;
+        ReplayNetworkAccessManager networkAccessManager;
+};
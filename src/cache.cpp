@@ -0,0 +1,107 @@
+#include "cache.h"
+#include <QtCore/QDateTime>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFileInfo>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QVector>
+#include <algorithm>
+
+WeatherCache::WeatherCache(QObject* parent) : QNetworkDiskCache(parent) {
+    setTimeToLive("metars", 10 * 60);
+    setTimeToLive("tafs", 30 * 60);
+}
+
+void WeatherCache::setTimeToLive(const QString& dataSource, int seconds) {
+    timesToLive.insert(dataSource, seconds);
+}
+
+int WeatherCache::timeToLive(const QUrl& url) const {
+    return timesToLive.value(QUrlQuery(url).queryItemValue("dataSource"), 0);
+}
+
+QNetworkCacheMetaData WeatherCache::withTimeToLive(QNetworkCacheMetaData metaData) const {
+    // The dataserver's own caching headers don't allow reuse, so they're replaced by our time-to-live. Validators
+    // (ETag, Last-Modified) are kept for revalidation.
+    int ttl = timeToLive(metaData.url());
+    if (ttl <= 0) return metaData;
+    QNetworkCacheMetaData::RawHeaderList headers;
+    for (const auto& header: metaData.rawHeaders()) {
+        QByteArray name = header.first.toLower();
+        if (name == "cache-control" || name == "expires" || name == "pragma") continue;
+        headers.append(header);
+    }
+    metaData.setRawHeaders(headers);
+    metaData.setExpirationDate(QDateTime::currentDateTimeUtc().addSecs(ttl));
+    metaData.setSaveToDisk(true);
+    return metaData;
+}
+
+QIODevice* WeatherCache::prepare(const QNetworkCacheMetaData& metaData) {
+    lastUsed.insert(metaData.url(), QDateTime::currentMSecsSinceEpoch());
+    return QNetworkDiskCache::prepare(withTimeToLive(metaData));
+}
+
+void WeatherCache::updateMetaData(const QNetworkCacheMetaData& metaData) {
+    // Called after a 304 Not Modified, which makes the entry fresh again.
+    counters.revalidated++;
+    lastUsed.insert(metaData.url(), QDateTime::currentMSecsSinceEpoch());
+    QNetworkDiskCache::updateMetaData(withTimeToLive(metaData));
+}
+
+QIODevice* WeatherCache::data(const QUrl& url) {
+    lastUsed.insert(url, QDateTime::currentMSecsSinceEpoch());
+    return QNetworkDiskCache::data(url);
+}
+
+WeatherCache::Lookup WeatherCache::lookup(const QUrl& url, QByteArray* body) {
+    QNetworkCacheMetaData meta = metaData(url);
+    QIODevice* device = meta.isValid() ? data(url) : nullptr;
+    if (device == nullptr) {
+        counters.misses++;
+        return Lookup::Miss;
+    }
+    *body = device->readAll();
+    delete device;
+
+    if (meta.expirationDate().isValid() && meta.expirationDate() > QDateTime::currentDateTimeUtc()) {
+        counters.fresh++;
+        return Lookup::Fresh;
+    }
+    counters.stale++;
+    return Lookup::Stale;
+}
+
+qint64 WeatherCache::expire() {
+    // QNetworkDiskCache evicts the oldest entries first, regardless of whether they're still being used; evict the
+    // least recently used ones instead. Entries from earlier sessions fall back to their file modification time,
+    // which is when they were last stored or revalidated.
+    struct Item {
+        qint64 used;
+        qint64 size;
+        QString path;
+    };
+    QVector<Item> items;
+    qint64 total = 0;
+    QDirIterator it (cacheDirectory(), QDir::Files | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString path = it.next();
+        QFileInfo info = it.fileInfo();
+        if (!path.endsWith(".d")) continue; // QNetworkDiskCache's data files
+        items.append(Item { info.lastModified().toMSecsSinceEpoch(), info.size(), path });
+        total += info.size();
+    }
+    if (total < maximumCacheSize()) return total;
+
+    for (Item& item: items) {
+        item.used = lastUsed.value(fileMetaData(item.path).url(), item.used);
+    }
+    std::sort(items.begin(), items.end(), [] (const Item& a, const Item& b) { return a.used < b.used; });
+
+    // Like QNetworkDiskCache, trim to 90% so we don't have to do this again on the next insert:
+    qint64 target = maximumCacheSize() * 9 / 10;
+    for (const Item& item: items) {
+        if (total <= target) break;
+        if (QFile::remove(item.path)) total -= item.size;
+    }
+    return total;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkDiskCache>
+
+// Disk cache for dataserver responses. Since the dataserver URLs carry the data source, station and query
+// parameters, the URL is the cache key. Stored responses get a fixed time-to-live depending on their data source
+// (METARs change more often than TAFs) instead of whatever the server's headers say. QNetworkAccessManager serves
+// fresh entries without touching the network and revalidates stale ones with If-None-Match/If-Modified-Since.
+// Eviction is least-recently-used, within maximumCacheSize().
+class WeatherCache : public QNetworkDiskCache {
+    Q_OBJECT
+    public:
+        enum class Lookup { Miss, Stale, Fresh };
+        struct Stats {
+            int fresh = 0;       // served from the cache without a request
+            int stale = 0;       // shown from the cache while being revalidated
+            int misses = 0;
+            int revalidated = 0; // 304 Not Modified responses
+        };
+
+        WeatherCache(QObject* parent = nullptr);
+        void setTimeToLive(const QString& dataSource, int seconds);
+        int timeToLive(const QUrl& url) const;
+
+        // Checks the cache for url without going to the network, filling body if there's an entry.
+        Lookup lookup(const QUrl& url, QByteArray* body);
+        const Stats& stats() const { return counters; }
+
+        QIODevice* data(const QUrl& url) override;
+        QIODevice* prepare(const QNetworkCacheMetaData& metaData) override;
+        void updateMetaData(const QNetworkCacheMetaData& metaData) override;
+    protected:
+        qint64 expire() override;
+    private:
+        QNetworkCacheMetaData withTimeToLive(QNetworkCacheMetaData metaData) const;
+        QHash<QString, int> timesToLive; // dataSource -> seconds
+        QHash<QUrl, qint64> lastUsed;    // msecs since epoch, for entries used during this session
+        Stats counters;
+};
@@ -1,51 +1,232 @@
 #include "data.h"
+#include "trace.h"
+#include <QtCore/QtMath>
+#include <QtCore/QtNumeric>
+#include <QtGui/QColor>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 using namespace std;
 
-static QString processCSVField (QByteArray bytes) {
-    QByteArray processed;
-    for (auto b: bytes) {
-        if (b != '"') processed += b;
-    }
-    if (processed == QByteArray("\\N")) {
+// A field of a CSV record, pointing into the original buffer. For quoted fields this is the text between the
+// quotes; doubled quotes inside them are only collapsed when the field is converted to a string.
+struct CSVField {
+    const char* data = nullptr;
+    int size = 0;
+    bool hasEscapedQuotes = false;
+};
+
+static QString processCSVField (const CSVField& field) {
+    if (field.size == 2 && field.data[0] == '\\' && field.data[1] == 'N') {
         return QString();
     }
+    if (!field.hasEscapedQuotes) {
+        return QString::fromUtf8(field.data, field.size);
+    }
+    QByteArray processed;
+    processed.reserve(field.size);
+    for (int i = 0; i < field.size; i++) {
+        processed += field.data[i];
+        if (field.data[i] == '"') i++; // skip the second quote of the pair
+    }
     return QString::fromUtf8(processed);
 }
 
+// Latitude or longitude in degrees, NaN if the field is empty or isn't a number.
+static float processCSVCoordinate (const CSVField& field) {
+    bool ok = false;
+    double value = QByteArray::fromRawData(field.data, field.size).toDouble(&ok);
+    return ok ? float(value) : qQNaN();
+}
+
+// Scans one RFC 4180 record starting at p, storing the first fieldCount fields and skipping the rest without
+// looking at them twice. Quoted fields may contain commas, doubled quotes and line breaks. Returns the number of
+// fields in the record and moves p past the record's line ending.
+static int scanCSVRecord (const char*& p, const char* end, CSVField* fields, int fieldCount) {
+    int column = 0;
+    while (p < end) {
+        CSVField field;
+        if (*p == '"') {
+            field.data = ++p;
+            while (p < end) {
+                p = static_cast<const char*>(memchr(p, '"', size_t(end - p)));
+                if (p == nullptr) { p = end; break; }
+                if (p + 1 < end && p[1] == '"') { field.hasEscapedQuotes = true; p += 2; continue; }
+                break;
+            }
+            field.size = int(p - field.data);
+            if (p < end) p++; // closing quote
+            while (p < end && *p != ',' && *p != '\n') p++; // stray characters after the closing quote
+        } else {
+            field.data = p;
+            while (p < end && *p != ',' && *p != '\n') p++;
+            field.size = int(p - field.data);
+            if (field.size > 0 && field.data[field.size - 1] == '\r') field.size--;
+        }
+
+        if (column < fieldCount) fields[column] = field;
+        column++;
+
+        if (p >= end) break;
+        if (*p++ == '\n') break;
+    }
+    return column;
+}
+
+
+
+// AirportEntries
+
+void AirportEntries::reserve (int count) {
+    recordBytes.reserve(count * int(sizeof(Record)));
+}
+
+quint32 AirportEntries::addString (const QString& text, bool intern) {
+    if (pool.isEmpty()) pool.append(QChar(0)); // the empty string, which every empty field points at
+    if (text.isEmpty()) return 0;
+    if (intern) {
+        auto it = interned.constFind(text);
+        if (it != interned.constEnd()) return it.value();
+    }
+    quint32 offset = quint32(pool.size());
+    int length = qMin(text.size(), 0xffff);
+    pool.append(QChar(ushort(length)));
+    pool.append(text.constData(), length);
+    if (intern) interned.insert(text, offset);
+    return offset;
+}
+
+void AirportEntries::append (const QString& icao, const QString& iata, const QString& name, const QString& city,
+    const QString& country, float latitude, float longitude)
+{
+    Record record;
+    record.icao = addString(icao, false);
+    record.iata = addString(iata, false);
+    record.name = addString(name, false);
+    record.city = addString(city, true);
+    record.country = addString(country, true);
+    record.latitude = latitude;
+    record.longitude = longitude;
+    recordBytes.append(reinterpret_cast<const char*>(&record), int(sizeof(record)));
+}
+
+void AirportEntries::append (const AirportEntries& other) {
+    for (int row = 0; row < other.size(); row++) {
+        append(other.icao(row).toString(), other.iata(row).toString(), other.name(row).toString(),
+            other.city(row).toString(), other.country(row).toString(), other.latitude(row), other.longitude(row));
+    }
+}
+
+void AirportEntries::squeeze () {
+    interned = QHash<QString, quint32>();
+    recordBytes.squeeze();
+    pool.squeeze();
+}
+
+void AirportEntries::displayText (int row, QString& text) const {
+    // Same as QString("%1/%2: %3, %4, %5").arg(icao, iata, name, city, country), leaving out the IATA code and the
+    // city if there aren't any:
+    const Record& r = records()[row];
+    text.clear();
+    text += string(r.icao);
+    if (r.iata != 0) {
+        text += QLatin1Char('/');
+        text += string(r.iata);
+    }
+    text += QLatin1String(": ");
+    text += string(r.name);
+    if (r.city != 0) {
+        text += QLatin1String(", ");
+        text += string(r.city);
+    }
+    text += QLatin1String(", ");
+    text += string(r.country);
+}
+
+QString AirportEntries::displayText (int row) const {
+    QString text;
+    displayText(row, text);
+    return text;
+}
+
+void AirportEntries::setData (const QByteArray& records, const QString& strings) {
+    recordBytes = records;
+    pool = strings;
+    interned.clear();
+}
+
+bool AirportEntries::validate (const QByteArray& records, const QString& strings) {
+    if (records.size() % int(sizeof(Record)) != 0) return false;
+    if (records.isEmpty()) return true;
+    if (strings.isEmpty() || strings.at(0).unicode() != 0) return false;
+    const Record* r = reinterpret_cast<const Record*>(records.constData());
+    const Record* end = r + records.size() / int(sizeof(Record));
+    for (; r != end; r++) {
+        for (quint32 offset: { r->icao, r->iata, r->name, r->city, r->country }) {
+            if (offset >= quint32(strings.size())) return false;
+            if (quint64(offset) + 1 + strings.at(int(offset)).unicode() > quint64(strings.size())) return false;
+        }
+    }
+    return true;
+}
+
 
 
 // AirportModel
 
-void AirportNameModel::readData (QByteArray csvFile) {
-    for (QByteArray line: csvFile.split('\n')) {
-        if (line.isEmpty()) continue;
+void ParseAirportsCSV (const char* begin, const char* end, AirportEntries& entries) {
+    // Example lines:
+    // 1638,"Lisbon Portela Airport","Lisbon","Portugal","LIS","LPPT",38.7812995911,-9.13591957092,...
+    // 1631,"Montijo Airport","Montijo","Portugal",\N,"LPMT",38.703899383499994,-9.035920143130001,...
+    // Only the first 8 columns are used.
+    const int usedFields = 8;
+    CSVField fields[usedFields];
 
-        // Example lines:
-        // 1638,"Lisbon Portela Airport","Lisbon","Portugal","LIS","LPPT",38.7812995911,-9.13591957092,...
-        // 1631,"Montijo Airport","Montijo","Portugal",\N,"LPMT",38.703899383499994,-9.035920143130001,...
-        QList<QByteArray> fields = line.split(',');
+    const char* p = begin;
+    while (p < end) {
+        if (scanCSVRecord(p, end, fields, usedFields) < usedFields) continue;
 
         auto name    = processCSVField(fields[1]);
         auto city    = processCSVField(fields[2]);
         auto country = processCSVField(fields[3]);
         auto iata    = processCSVField(fields[4]);
         auto icao    = processCSVField(fields[5]);
+        entries.append(icao, iata, name, city, country, processCSVCoordinate(fields[6]),
+            processCSVCoordinate(fields[7]));
+    }
+}
 
-        AirportNameEntry entry;
-        entry.icao = QString(icao);
-        if (city.isEmpty() && iata.isEmpty()) {
-            entry.full = QString("%1: %2, %3").arg(icao, name, country);
-        } else if (city.isEmpty()) {
-            entry.full = QString("%1/%2: %3, %4").arg(icao, iata, name, country);
-        } else if (iata.isEmpty()) {
-            entry.full = QString("%1: %2, %3, %4").arg(icao, name, city, country);
-        } else {
-            entry.full = QString("%1/%2: %3, %4, %5").arg(icao, iata, name, city, country);
-        }
+void AirportNameModel::readData (QByteArray csvFile) {
+    TRACE_SPAN("airports", "AirportNameModel::readData");
+    AirportData data;
+    data.entries.reserve(csvFile.count('\n'));
+    ParseAirportsCSV(csvFile.constData(), csvFile.constData() + csvFile.size(), data.entries);
+    data.entries.squeeze();
+    data.searchIndex.build(data.entries);
+    data.spatialIndex.build(data.entries);
+    setAirports(data);
+}
 
-        entries.append(entry);
-    }
+void AirportNameModel::setAirports (const AirportData& data) {
+    TRACE_SPAN("airports", "AirportNameModel::setAirports");
+    beginResetModel();
+    airportData = data;
+    displayCache.clear();
+    endResetModel();
+}
+
+QVector<int> AirportNameModel::search (const QString& query, int limit) const {
+    return airportData.searchIndex.search(airportData.entries, query, limit);
+}
+
+QVector<int> AirportNameModel::nearby (int row, double radiusNm, int limit) const {
+    if (row < 0 || row >= rowCount()) return QVector<int>();
+    // The airport itself is indexed too, if it has an ICAO code, so ask for one more:
+    auto rows = airportData.spatialIndex.nearest(airportData.entries.latitude(row),
+        airportData.entries.longitude(row), limit + 1, radiusNm);
+    rows.removeOne(row);
+    if (rows.size() > limit) rows.resize(limit);
+    return rows;
 }
 
 QModelIndex AirportNameModel::index (int row, int column, const QModelIndex &parent) const {
@@ -59,7 +240,7 @@ QModelIndex AirportNameModel::parent (const QModelIndex &index) const {
 }
 
 int AirportNameModel::rowCount (const QModelIndex &parent) const {
-    return entries.length();
+    return airportData.entries.size();
 }
 
 int AirportNameModel::columnCount (const QModelIndex &parent) const {
@@ -69,24 +250,445 @@ int AirportNameModel::columnCount (const QModelIndex &parent) const {
 QVariant AirportNameModel::data (const QModelIndex &index, int role) const {
     if (index.column() != 0 || index.row() < 0 || index.row() >= rowCount())
         return QVariant();
-    if (role == Qt::DisplayRole)
-        return QVariant(entries[index.row()].full);
+    // Entries point into their string pool (or the mapped snapshot), so hand out copies that stay valid if the
+    // model goes away while a view or the search box still holds on to them.
+    if (role == Qt::DisplayRole) {
+        if (QString* text = displayCache.object(index.row())) return QVariant(*text);
+        QString* text = new QString(airportData.entries.displayText(index.row()));
+        displayCache.insert(index.row(), text);
+        return QVariant(*text);
+    }
     if (role == Qt::EditRole)
-        return QVariant(entries[index.row()].icao);
+        return QVariant(airportData.entries.icao(index.row()).toString());
     return QVariant();
 }
 
 
 
+// DiffingTableModel
+
+const int DiffingTableModel::pageSize;
+
+int DiffingTableModel::rowCount (const QModelIndex& parent) const {
+    if (parent.isValid()) return 0;
+    return rows;
+}
+
+bool DiffingTableModel::canFetchMore (const QModelIndex& parent) const {
+    return !parent.isValid() && rowSource.isEmpty() && rows < availableRows();
+}
+
+void DiffingTableModel::fetchMore (const QModelIndex& parent) {
+    if (!canFetchMore(parent)) return;
+    showRows(qMin(availableRows(), rows + pageSize));
+}
+
+void DiffingTableModel::setPaged (bool on) {
+    paged = on;
+    if (!paged && rowSource.isEmpty()) showRows(availableRows());
+}
+
+void DiffingTableModel::showRows (int count) {
+    if (count <= rows) return;
+    beginInsertRows(QModelIndex(), rows, count - 1);
+    rows = count;
+    endInsertRows();
+}
+
+void DiffingTableModel::applyDiff (const QVector<QString>& previousKeys, const QVector<QString>& nextKeys,
+    const std::function<bool (int previousRow, int nextRow)>& same)
+{
+    TRACE_SPAN("weather", "diff rows");
+    QHash<QString, int> nextRows;
+    nextRows.reserve(nextKeys.size());
+    for (int i = 0; i < nextKeys.size(); i++) {
+        nextRows.insert(nextKeys[i], i);
+    }
+    rows = previousKeys.size();
+    rowSource.resize(rows);
+    for (int row = 0; row < rows; row++) {
+        rowSource[row] = ~row;
+    }
+
+    // Remove the rows that are gone, bottom up so the ones above keep their numbers:
+    for (int last = rows - 1; last >= 0; last--) {
+        if (nextRows.contains(previousKeys[last])) continue;
+        int first = last;
+        while (first > 0 && !nextRows.contains(previousKeys[first - 1])) first--;
+        beginRemoveRows(QModelIndex(), first, last);
+        rowSource.remove(first, last - first + 1);
+        rows -= last - first + 1;
+        endRemoveRows();
+        last = first;
+    }
+
+    // The rows that are left have to be in the same order in the next data. They always are for dataserver
+    // responses (newest first), but if they aren't, give up and reset:
+    QVector<int> targets (rows);
+    for (int row = 0; row < rows; row++) {
+        targets[row] = nextRows.value(previousKeys[~rowSource[row]]);
+        if (row > 0 && targets[row] <= targets[row - 1]) {
+            beginResetModel();
+            rowSource.clear();
+            rows = nextKeys.size();
+            endResetModel();
+            return;
+        }
+    }
+
+    // Insert the new rows in between the old ones, and switch the old ones over to the next data:
+    QVector<int> changed;
+    int row = 0;
+    for (int next = 0; next < nextKeys.size(); ) {
+        if (row < rows && targets[row] == next) {
+            if (!same(~rowSource[row], next)) changed.append(row);
+            rowSource[row] = next;
+            row++;
+            next++;
+            continue;
+        }
+        int count = (row < rows ? targets[row] : nextKeys.size()) - next;
+        beginInsertRows(QModelIndex(), row, row + count - 1);
+        rowSource.insert(row, count, 0);
+        targets.insert(row, count, -1);
+        for (int i = 0; i < count; i++) {
+            rowSource[row + i] = next + i;
+        }
+        rows += count;
+        endInsertRows();
+        row += count;
+        next += count;
+    }
+
+    // Every row shows the next data now, in order:
+    rowSource.clear();
+    for (int i = 0; i < changed.size(); ) {
+        int first = changed[i];
+        int last = first;
+        while (++i < changed.size() && changed[i] == last + 1) last++;
+        emit dataChanged(index(first, 0), index(last, columnCount() - 1));
+    }
+}
+
+
+
 // ForecastModel
 
+static SkyLayer readSkyLayer (const QXmlStreamAttributes& attributes) {
+    // <sky_condition sky_cover="BKN" cloud_base_ft_agl="3000" cloud_type="CB" />
+    SkyLayer layer;
+    layer.cover = attributes.value(QLatin1String("sky_cover")).toString();
+    layer.cloudType = attributes.value(QLatin1String("cloud_type")).toString();
+    bool ok = false;
+    int base = attributes.value(QLatin1String("cloud_base_ft_agl")).toInt(&ok);
+    if (ok) layer.baseFt = base;
+    return layer;
+}
+
+// Formats a sky layer the way it appears in the raw report, e.g. "BKN030CB".
+static void appendSkyLayer (QString& text, const QString& cover, int baseFt, const QString& cloudType) {
+    if (!text.isEmpty()) text += ' ';
+    text += cover;
+    if (baseFt >= 0) text += QString("%1").arg(baseFt / 100, 3, 10, QChar('0'));
+    text += cloudType;
+}
+
+QString FormatSkyLayers (const QVector<SkyLayer>& layers) {
+    QString text;
+    for (const SkyLayer& layer: layers) {
+        appendSkyLayer(text, layer.cover, layer.baseFt, layer.cloudType);
+    }
+    return text;
+}
+
+static ChangeIndicator parseChangeIndicator (const QString& text) {
+    if (text == QLatin1String("FM"))    return ChangeIndicator::From;
+    if (text == QLatin1String("BECMG")) return ChangeIndicator::Becoming;
+    if (text == QLatin1String("TEMPO")) return ChangeIndicator::Tempo;
+    if (text == QLatin1String("PROB"))  return ChangeIndicator::Prob;
+    return ChangeIndicator::None;
+}
+
+QString FormatChangeIndicator (ChangeIndicator indicator, int probability) {
+    switch (indicator) {
+        case ChangeIndicator::None:     return QString();
+        case ChangeIndicator::From:     return QString("FM");
+        case ChangeIndicator::Becoming: return QString("BECMG");
+        case ChangeIndicator::Tempo:    return QString("TEMPO");
+        case ChangeIndicator::Prob:     return QString("PROB%1").arg(probability);
+    }
+    return QString();
+}
+
+int TafRecords::appendReport (const TafRecords& other, int report) {
+    reports.append(other.reports[report]);
+    int copy = reports.size() - 1;
+    for (TafForecast forecast: other.forecasts) {
+        if (forecast.report != report) continue;
+        forecast.report = copy;
+        forecasts.append(forecast);
+    }
+    return copy;
+}
+
+void TafRecords::append (const TafRecords& other) {
+    int offset = reports.size();
+    reports += other.reports;
+    forecasts.reserve(forecasts.size() + other.forecasts.size());
+    for (TafForecast forecast: other.forecasts) {
+        forecast.report += offset;
+        forecasts.append(forecast);
+    }
+}
+
+static TafField tafField (const QStringRef& name, bool inForecast) {
+    if (inForecast) {
+        if (name == QLatin1String("fcst_time_from"))   return TafField::From;
+        if (name == QLatin1String("fcst_time_to"))     return TafField::To;
+        if (name == QLatin1String("change_indicator")) return TafField::ChangeIndicator;
+        if (name == QLatin1String("probability"))      return TafField::Probability;
+        if (name == QLatin1String("wx_string"))        return TafField::WxString;
+        return TafField::None;
+    }
+    if (name == QLatin1String("raw_text"))   return TafField::RawText;
+    if (name == QLatin1String("station_id")) return TafField::StationId;
+    if (name == QLatin1String("issue_time")) return TafField::IssueTime;
+    return TafField::None;
+}
+
+static void storeTafField (TafRecords& records, const TafXmlState& state) {
+    // Times look like 2018-09-07T12:00:00Z, which ISODate parsing turns into a UTC QDateTime.
+    TafReport& r = records.reports[state.report];
+    switch (state.field) {
+        case TafField::None:      break;
+        case TafField::RawText:   r.rawText = state.text; break;
+        case TafField::StationId: r.stationId = state.text; break;
+        case TafField::IssueTime: r.issueTime = QDateTime::fromString(state.text, Qt::ISODate); break;
+        default: {
+            TafForecast& f = records.forecasts[state.forecast];
+            switch (state.field) {
+                case TafField::From:            f.from = QDateTime::fromString(state.text, Qt::ISODate); break;
+                case TafField::To:              f.to = QDateTime::fromString(state.text, Qt::ISODate); break;
+                case TafField::ChangeIndicator: f.changeIndicator = parseChangeIndicator(state.text); break;
+                case TafField::Probability:     f.probability = state.text.toInt(); break;
+                case TafField::WxString:        f.wxStrings.append(state.text); break;
+                default: break;
+            }
+        }
+    }
+}
+
+void ReadTafXml (QXmlStreamReader& xml, TafRecords& records) {
+    TafXmlState state;
+    ReadTafXml(xml, records, state);
+}
+
+void ReadTafXml (QXmlStreamReader& xml, TafRecords& records, TafXmlState& state) {
+    // A flat state machine instead of nested readNextStartElement loops, so it can stop wherever the reader runs
+    // out of data and carry on from there the next time.
+    while (!xml.atEnd()) {
+        switch (xml.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                auto name = xml.name();
+                if (name == QLatin1String("TAF")) {
+                    state.report = records.reports.size();
+                    records.reports.append(TafReport());
+                } else if (state.report < 0) {
+                    break;
+                } else if (name == QLatin1String("forecast")) {
+                    state.forecast = records.forecasts.size();
+                    records.forecasts.append(TafForecast());
+                    records.forecasts[state.forecast].report = state.report;
+                } else if (state.forecast >= 0 && name == QLatin1String("sky_condition")) {
+                    records.forecasts[state.forecast].skyLayers.append(readSkyLayer(xml.attributes()));
+                } else {
+                    state.field = tafField(name, state.forecast >= 0);
+                    state.text.resize(0);
+                }
+                break;
+            }
+            case QXmlStreamReader::Characters:
+                if (state.field != TafField::None) state.text.append(xml.text());
+                break;
+            case QXmlStreamReader::EndElement: {
+                auto name = xml.name();
+                if (state.field != TafField::None) {
+                    storeTafField(records, state);
+                } else if (name == QLatin1String("forecast")) {
+                    state.forecast = -1;
+                } else if (name == QLatin1String("TAF")) {
+                    state.report = -1;
+                    state.forecast = -1;
+                }
+                state.field = TafField::None;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void TafStreamReader::clear () {
+    xml.clear();
+    state = TafXmlState();
+    records = TafRecords();
+    reportsOut = 0;
+    forecastsOut = 0;
+}
+
+bool TafStreamReader::hasFailed () const {
+    // Running out of data is expected here; after any other error the rest of the response is ignored.
+    return xml.hasError() && xml.error() != QXmlStreamReader::PrematureEndOfDocumentError;
+}
+
+TafRecords TafStreamReader::read (const QByteArray& data) {
+    TafRecords batch;
+    if (hasFailed()) return batch;
+    xml.addData(data);
+    ReadTafXml(xml, records, state);
+
+    // Everything before the report being read (if any) is complete. Forecasts are stored in report order:
+    int complete = state.report >= 0 ? state.report : records.reports.size();
+    int first = reportsOut;
+    for (; reportsOut < complete; reportsOut++) {
+        batch.reports.append(records.reports[reportsOut]);
+    }
+    for (; forecastsOut < records.forecasts.size() && records.forecasts[forecastsOut].report < complete;
+        forecastsOut++)
+    {
+        batch.forecasts.append(records.forecasts[forecastsOut]);
+        batch.forecasts.last().report -= first;
+    }
+    return batch;
+}
+
+// A forecast is identified by its TAF and its validity. The same period can show up more than once in a TAF (e.g. a
+// TEMPO group covering a whole FM group), so repeats are numbered.
+static QVector<QString> forecastKeys (const TafRecords& records, int count) {
+    QVector<QString> keys;
+    keys.reserve(count);
+    QHash<QString, int> repeats;
+    for (int i = 0; i < count; i++) {
+        const TafForecast& f = records.forecasts[i];
+        const TafReport& r = records.reports[f.report];
+        QString key = QString("%1 %2 %3 %4 %5").arg(r.stationId).arg(r.issueTime.toSecsSinceEpoch())
+            .arg(f.from.toSecsSinceEpoch()).arg(f.to.toSecsSinceEpoch()).arg(int(f.changeIndicator));
+        int repeat = repeats[key]++;
+        keys.append(key + ' ' + QString::number(repeat));
+    }
+    return keys;
+}
+
+static bool sameForecast (const TafRecords& a, int i, const TafRecords& b, int j) {
+    const TafForecast& x = a.forecasts[i];
+    const TafForecast& y = b.forecasts[j];
+    if (x.probability != y.probability || x.wxStrings != y.wxStrings) return false;
+    if (x.skyLayers.size() != y.skyLayers.size()) return false;
+    for (int k = 0; k < x.skyLayers.size(); k++) {
+        const SkyLayer& p = x.skyLayers[k];
+        const SkyLayer& q = y.skyLayers[k];
+        if (p.cover != q.cover || p.baseFt != q.baseFt || p.cloudType != q.cloudType) return false;
+    }
+    return a.reports[x.report].rawText == b.reports[y.report].rawText;
+}
+
+void ForecastModel::update (const TafRecords& next) {
+    previous = records;
+    records = next;
+    applyDiff(forecastKeys(previous, rows), forecastKeys(records, diffLimit(records.forecasts.size())),
+        [this] (int previousRow, int nextRow) { return sameForecast(previous, previousRow, records, nextRow); });
+    previous = TafRecords();
+}
+
+void ForecastModel::resetReader () {
+    reader.clear();
+    pending = TafRecords();
+    reading = false;
+    staged = false;
+    readerFed = false;
+}
+
 void ForecastModel::readData (QIODevice* device) {
-    document.setContent(device);
+    TRACE_SPAN("weather", "ForecastModel::readData");
+    resetReader();
+    TafRecords next;
+    QXmlStreamReader deviceXml (device);
+    ReadTafXml(deviceXml, next);
+    if (deviceXml.hasError()) {
+        cerr << "ForecastModel::readData: " << deviceXml.errorString().toStdString() << endl;
+    }
+    update(next);
+}
+
+void ForecastModel::beginData () {
+    resetReader();
+    // With forecasts on screen, read the new ones aside and diff them in once they're all there, instead of
+    // starting from an empty table:
+    staged = rows > 0;
+    if (!staged) records = TafRecords();
+    reading = true;
+}
+
+void ForecastModel::appendData (const QByteArray& data) {
+    if (!reading || reader.hasFailed()) return;
+    TRACE_SPAN("weather", "ForecastModel::appendData");
+    readerFed = true;
+    TafRecords batch = reader.read(data);
+    if (reader.hasFailed()) {
+        cerr << "ForecastModel::appendData: " << reader.errorString().toStdString() << endl;
+    }
+    appendTafs(batch);
+}
+
+void ForecastModel::appendTafs (const TafRecords& batch) {
+    if (!reading) return;
+    if (staged) {
+        pending.append(batch);
+        return;
+    }
+    // Show up to a page; fetchMore shows the rest.
+    records.append(batch);
+    showRows(diffLimit(availableRows()));
+}
+
+int ForecastModel::availableRows () const {
+    return records.forecasts.size();
+}
+
+void ForecastModel::endData () {
+    // Without appendData, the reader has nothing to say about whether the response was complete. Giving up on
+    // appendTafs batches is nothing to warn about:
+    if (reading && !readerFed) {
+        resetReader();
+        return;
+    }
+    endData(reader.isComplete());
+}
+
+void ForecastModel::endData (bool complete) {
+    if (!reading) return;
+    // A response that was cut off doesn't replace the forecasts we had:
+    if (!complete) {
+        cerr << "ForecastModel::endData: incomplete response" << endl;
+    }
+    TafRecords next = pending;
+    bool apply = staged && complete;
+    resetReader();
+    if (apply) update(next);
+}
+
+void ForecastModel::clear () {
+    beginResetModel();
+    resetReader();
+    records = TafRecords();
+    rows = 0;
     endResetModel();
 }
 
-int ForecastModel::rowCount (const QModelIndex& parent) const {
-    return document.elementsByTagName("forecast").count();
+void ForecastModel::setTafs (const TafRecords& tafs) {
+    resetReader();
+    update(tafs);
 }
 
 int ForecastModel::columnCount (const QModelIndex& parent) const {
@@ -94,19 +696,26 @@ int ForecastModel::columnCount (const QModelIndex& parent) const {
 }
 
 QVariant ForecastModel::data (const QModelIndex &index, int role) const {
-    if (role != Qt::DisplayRole) return QVariant();
-
-    auto taf = document.elementsByTagName("TAF").item(0).toElement();
-    auto f = taf.elementsByTagName("forecast").item(index.row()).toElement();
-    if (f.isNull()) return QVariant();
+    if (role != Qt::DisplayRole && role != SortRole) return QVariant();
+    if (index.row() < 0 || index.row() >= rows) return QVariant();
 
+    int row = sourceRow(index.row());
+    const TafRecords& source = row < 0 ? previous : records;
+    const TafForecast& f = source.forecasts[row < 0 ? ~row : row];
+    if (role == SortRole) {
+        switch (index.column()) {
+            case 0: return QVariant(f.from);
+            case 1: return QVariant(f.to);
+            case 4: return QVariant(f.skyLayers.isEmpty() ? -1 : f.skyLayers.first().baseFt);
+        }
+    }
     switch (index.column()) {
-        case 0: return QVariant(f.elementsByTagName("fcst_time_from").item(0).toElement().text());
-        case 1: return QVariant(f.elementsByTagName("fcst_time_to").item(0).toElement().text());
-        case 2: return QVariant(f.elementsByTagName("change_indicator").item(0).toElement().text());
-        case 3: return QVariant(f.elementsByTagName("wx_string").item(0).toElement().text());
-        case 4: return QVariant(f.elementsByTagName("sky_condition").item(0).toElement().attribute("sky_cover"));
-        case 5: return QVariant(taf.elementsByTagName("raw_text").item(0).toElement().text());
+        case 0: return QVariant(f.from.toString(Qt::ISODate));
+        case 1: return QVariant(f.to.toString(Qt::ISODate));
+        case 2: return QVariant(FormatChangeIndicator(f.changeIndicator, f.probability));
+        case 3: return QVariant(f.wxStrings.join(' '));
+        case 4: return QVariant(FormatSkyLayers(f.skyLayers));
+        case 5: return QVariant(source.reports[f.report].rawText);
     }
     return QVariant();
 }
@@ -127,52 +736,565 @@ QVariant ForecastModel::headerData (int section, Qt::Orientation orientation, in
 
 
 
+// MetarColumns
+
+void MetarColumns::clear () {
+    *this = MetarColumns();
+}
+
+int MetarColumns::appendRow () {
+    const float missing = qQNaN();
+    station.append(0);
+    observationTime.append(0);
+    tempC.append(missing);
+    dewpointC.append(missing);
+    windDirDeg.append(missing);
+    windSpeedKt.append(missing);
+    visibilityMi.append(missing);
+    skyFirst.append(quint32(skyCover.size()));
+    skyCount.append(0);
+    rawOffset.append(quint32(rawText.size()));
+    rawLength.append(0);
+    return count() - 1;
+}
+
+static void windKernel (const float* directionDeg, const float* speedKt, float headingDeg, float* headwindKt,
+    float* crosswindKt, int n);
+
+int MetarColumns::appendRow (const MetarColumns& other, int from) {
+    int row = appendRow();
+    station[row] = internStation(QStringRef(&other.stations[other.station[from]]));
+    observationTime[row] = other.observationTime[from];
+    tempC[row] = other.tempC[from];
+    dewpointC[row] = other.dewpointC[from];
+    windDirDeg[row] = other.windDirDeg[from];
+    windSpeedKt[row] = other.windSpeedKt[from];
+    visibilityMi[row] = other.visibilityMi[from];
+    for (quint32 i = other.skyFirst[from]; i < other.skyFirst[from] + other.skyCount[from]; i++) {
+        skyCover.append(internSkyCover(QStringRef(&other.skyCovers[other.skyCover[i]])));
+        skyBaseFt.append(other.skyBaseFt[i]);
+        skyCount[row]++;
+    }
+    rawText.append(other.rawText.midRef(int(other.rawOffset[from]), int(other.rawLength[from])));
+    rawLength[row] = other.rawLength[from];
+
+    // Carry the derived columns over too, if there are any and ours are complete, so derive() has nothing left to
+    // do for the row, e.g. when it was derived on the thread pool. Only the wind components depend on the runway:
+    if (from < other.flightCategory.size() && flightCategory.size() == row) {
+        ceilingFt.append(other.ceilingFt[from]);
+        flightCategory.append(other.flightCategory[from]);
+        humidityPct.append(other.humidityPct[from]);
+        spreadC.append(other.spreadC[from]);
+        headwindKt.append(other.headwindKt[from]);
+        crosswindKt.append(other.crosswindKt[from]);
+        bool sameRunway = runwayHeadingDeg == other.runwayHeadingDeg
+            || (qIsNaN(runwayHeadingDeg) && qIsNaN(other.runwayHeadingDeg));
+        if (!sameRunway) {
+            windKernel(windDirDeg.constData() + row, windSpeedKt.constData() + row, runwayHeadingDeg,
+                headwindKt.data() + row, crosswindKt.data() + row, 1);
+        }
+    }
+    return row;
+}
+
+void MetarColumns::append (const MetarColumns& other) {
+    for (int row = 0; row < other.count(); row++) {
+        appendRow(other, row);
+    }
+}
+
+quint16 MetarColumns::internStation (const QStringRef& id) {
+    QString key = id.toString();
+    auto it = stationIndex.constFind(key);
+    if (it != stationIndex.constEnd()) return it.value();
+    quint16 i = quint16(stations.size());
+    stations.append(key);
+    stationIndex.insert(key, i);
+    return i;
+}
+
+quint8 MetarColumns::internSkyCover (const QStringRef& cover) {
+    // There's only a handful of distinct values, so a linear search is fine.
+    for (int i = 0; i < skyCovers.size(); i++) {
+        if (skyCovers[i] == cover) return quint8(i);
+    }
+    skyCovers.append(cover.toString());
+    return quint8(skyCovers.size() - 1);
+}
+
+QString MetarColumns::raw (int row) const {
+    return rawText.mid(int(rawOffset[row]), int(rawLength[row]));
+}
+
+QString MetarColumns::sky (int row) const {
+    QString text;
+    for (quint32 i = skyFirst[row]; i < skyFirst[row] + skyCount[row]; i++) {
+        appendSkyLayer(text, skyCovers[skyCover[i]], skyBaseFt[i], QString());
+    }
+    return text;
+}
+
+// The derived-column kernels are plain loops over contiguous arrays without branches, so the compiler can
+// vectorise them. Missing (NaN) inputs give missing outputs by way of the arithmetic itself.
+
+// FAA flight categories: LIFR below 500 ft or 1 mi, IFR below 1000 ft or 3 mi, MVFR up to 3000 ft or 5 mi, VFR
+// above that. The worse of the two decides; if neither is known, neither is the category.
+static void flightCategoryKernel (const float* ceilingFt, const float* visibilityMi, quint8* category, int n) {
+    for (int i = 0; i < n; i++) {
+        float c = ceilingFt[i];
+        float v = visibilityMi[i];
+        int byCeiling = int(c <= 3000) + int(c < 1000) + int(c < 500);
+        int byVisibility = int(v <= 5) + int(v < 3) + int(v < 1);
+        int known = int(c == c) | int(v == v);
+        category[i] = quint8(known * (1 + qMax(byCeiling, byVisibility)));
+    }
+}
+
+// Relative humidity from the Magnus formula, with the Alduchov and Eskridge coefficients.
+static void humidityKernel (const float* tempC, const float* dewpointC, float* humidityPct, float* spreadC, int n) {
+    const float b = 17.625f;
+    const float c = 243.04f;
+    for (int i = 0; i < n; i++) {
+        float t = tempC[i];
+        float d = dewpointC[i];
+        humidityPct[i] = 100 * std::exp(b * d / (c + d) - b * t / (c + t));
+        spreadC[i] = t - d;
+    }
+}
+
+static void windKernel (const float* directionDeg, const float* speedKt, float headingDeg, float* headwindKt,
+    float* crosswindKt, int n)
+{
+    const float toRadians = float(M_PI / 180);
+    for (int i = 0; i < n; i++) {
+        float angle = (directionDeg[i] - headingDeg) * toRadians;
+        headwindKt[i] = speedKt[i] * std::cos(angle);
+        crosswindKt[i] = speedKt[i] * std::sin(angle);
+    }
+}
+
+void MetarColumns::derive (int end) {
+    if (end < 0) end = count();
+    int begin = flightCategory.size();
+    if (end <= begin) return;
+    int n = end - begin;
+    ceilingFt.resize(end);
+    flightCategory.resize(end);
+    humidityPct.resize(end);
+    spreadC.resize(end);
+    headwindKt.resize(end);
+    crosswindKt.resize(end);
+
+    // The ceiling needs each report's sky layers, so it's found the ordinary way:
+    QVector<bool> ceilingCover (skyCovers.size());
+    for (int i = 0; i < skyCovers.size(); i++) {
+        const QString& cover = skyCovers[i];
+        ceilingCover[i] = cover == QLatin1String("BKN") || cover == QLatin1String("OVC")
+            || cover == QLatin1String("OVX") || cover == QLatin1String("VV");
+    }
+    for (int row = begin; row < end; row++) {
+        float ceiling = skyCount[row] == 0 ? qQNaN() : qInf();
+        for (quint32 i = skyFirst[row]; i < skyFirst[row] + skyCount[row]; i++) {
+            if (ceilingCover[skyCover[i]] && skyBaseFt[i] >= 0) ceiling = qMin(ceiling, float(skyBaseFt[i]));
+        }
+        ceilingFt[row] = ceiling;
+    }
+
+    flightCategoryKernel(ceilingFt.constData() + begin, visibilityMi.constData() + begin,
+        flightCategory.data() + begin, n);
+    humidityKernel(tempC.constData() + begin, dewpointC.constData() + begin, humidityPct.data() + begin,
+        spreadC.data() + begin, n);
+    windKernel(windDirDeg.constData() + begin, windSpeedKt.constData() + begin, runwayHeadingDeg,
+        headwindKt.data() + begin, crosswindKt.data() + begin, n);
+}
+
+void MetarColumns::setRunwayHeading (float headingDeg) {
+    runwayHeadingDeg = headingDeg;
+    windKernel(windDirDeg.constData(), windSpeedKt.constData(), headingDeg, headwindKt.data(), crosswindKt.data(),
+        headwindKt.size());
+}
+
+// Parses the dataserver's fixed timestamp format (2018-09-07T12:00:00Z) without going through QDateTime.
+static qint64 parseTimestamp (const QStringRef& text) {
+    auto number = [&text] (int pos, int length) {
+        int value = 0;
+        for (int i = pos; i < pos + length; i++) {
+            if (!text.at(i).isDigit()) return -1;
+            value = value * 10 + text.at(i).digitValue();
+        }
+        return value;
+    };
+    bool fixedFormat = (text.size() == 19 || (text.size() == 20 && text.at(19) == 'Z')) && text.at(4) == '-'
+        && text.at(7) == '-' && text.at(10) == 'T' && text.at(13) == ':' && text.at(16) == ':';
+    if (fixedFormat) {
+        QDate date (number(0, 4), number(5, 2), number(8, 2));
+        int h = number(11, 2), m = number(14, 2), sec = number(17, 2);
+        if (date.isValid() && h >= 0 && h < 24 && m >= 0 && m < 60 && sec >= 0 && sec < 60) {
+            const qint64 unixEpochJulianDay = 2440588;
+            return (date.toJulianDay() - unixEpochJulianDay) * 86400 + h * 3600 + m * 60 + sec;
+        }
+    }
+    // Anything else (time zone offsets, fractional seconds...) goes through the slow path:
+    return QDateTime::fromString(text.toString(), Qt::ISODate).toSecsSinceEpoch();
+}
+
+static float parseFloat (QStringRef text) {
+    // Visibility is reported as e.g. "10+" when it's above the maximum reportable value.
+    if (text.endsWith('+')) text = text.left(text.size() - 1);
+    bool ok = false;
+    float value = text.toFloat(&ok);
+    return ok ? value : qQNaN();
+}
+
+static MetarField metarField (const QStringRef& name) {
+    if (name == QLatin1String("raw_text"))              return MetarField::RawText;
+    if (name == QLatin1String("station_id"))            return MetarField::StationId;
+    if (name == QLatin1String("observation_time"))      return MetarField::ObservationTime;
+    if (name == QLatin1String("temp_c"))                return MetarField::Temp;
+    if (name == QLatin1String("dewpoint_c"))            return MetarField::Dewpoint;
+    if (name == QLatin1String("wind_dir_degrees"))      return MetarField::WindDir;
+    if (name == QLatin1String("wind_speed_kt"))         return MetarField::WindSpeed;
+    if (name == QLatin1String("visibility_statute_mi")) return MetarField::Visibility;
+    return MetarField::None;
+}
+
+static void storeMetarField (MetarColumns& c, int row, MetarField field, const QStringRef& text) {
+    switch (field) {
+        case MetarField::None:            break;
+        case MetarField::RawText:         break; // appended to rawText as it's read
+        case MetarField::StationId:       c.station[row] = c.internStation(text); break;
+        case MetarField::ObservationTime: c.observationTime[row] = parseTimestamp(text); break;
+        case MetarField::Temp:            c.tempC[row] = parseFloat(text); break;
+        case MetarField::Dewpoint:        c.dewpointC[row] = parseFloat(text); break;
+        case MetarField::WindDir:         c.windDirDeg[row] = parseFloat(text); break;
+        case MetarField::WindSpeed:       c.windSpeedKt[row] = parseFloat(text); break;
+        case MetarField::Visibility:      c.visibilityMi[row] = parseFloat(text); break;
+    }
+}
+
+void MetarStreamReader::clear () {
+    xml.clear();
+    state = MetarXmlState();
+    columns.clear();
+    rowsOut = 0;
+}
+
+bool MetarStreamReader::hasFailed () const {
+    return xml.hasError() && xml.error() != QXmlStreamReader::PrematureEndOfDocumentError;
+}
+
+MetarColumns MetarStreamReader::read (const QByteArray& data) {
+    MetarColumns batch;
+    if (hasFailed()) return batch;
+    xml.addData(data);
+    ReadMetarXml(xml, columns, state);
+    // The row being read (if any) is the last one:
+    int complete = state.row >= 0 ? state.row : columns.count();
+    for (; rowsOut < complete; rowsOut++) {
+        batch.appendRow(columns, rowsOut);
+    }
+    return batch;
+}
+
+void ReadMetarXml (QXmlStreamReader& xml, MetarColumns& c) {
+    MetarXmlState state;
+    ReadMetarXml(xml, c, state);
+}
+
+void ReadMetarXml (QXmlStreamReader& xml, MetarColumns& c, MetarXmlState& state) {
+    // Field text is collected in state.text, which keeps its capacity between fields, and parsed from there when
+    // the element ends; the reader may hand it out in more than one piece when it's fed incrementally.
+    while (!xml.atEnd()) {
+        switch (xml.readNext()) {
+            case QXmlStreamReader::StartElement: {
+                auto name = xml.name();
+                if (name == QLatin1String("METAR")) {
+                    state.row = c.appendRow();
+                } else if (state.row >= 0 && name == QLatin1String("sky_condition")) {
+                    auto attributes = xml.attributes();
+                    bool ok = false;
+                    int base = attributes.value(QLatin1String("cloud_base_ft_agl")).toInt(&ok);
+                    c.skyCover.append(c.internSkyCover(attributes.value(QLatin1String("sky_cover"))));
+                    c.skyBaseFt.append(ok ? base : -1);
+                    c.skyCount[state.row]++;
+                } else if (state.row >= 0) {
+                    state.field = metarField(name);
+                    state.text.resize(0);
+                }
+                break;
+            }
+            case QXmlStreamReader::Characters: {
+                if (state.row < 0 || state.field == MetarField::None) break;
+                auto text = xml.text();
+                if (state.field == MetarField::RawText) {
+                    c.rawText.append(text);
+                    c.rawLength[state.row] += quint32(text.size());
+                } else {
+                    state.text.append(text);
+                }
+                break;
+            }
+            case QXmlStreamReader::EndElement:
+                if (state.row >= 0 && state.field != MetarField::None) {
+                    storeMetarField(c, state.row, state.field, QStringRef(&state.text));
+                }
+                if (xml.name() == QLatin1String("METAR")) state.row = -1;
+                state.field = MetarField::None;
+                break;
+            default:
+                break;
+        }
+    }
+    c.derive(state.row >= 0 ? state.row : c.count());
+}
+
+
+
 // MetarModel
 
+// Reports are identified by station and observation time.
+static QVector<QString> metarKeys (const MetarColumns& c, int count) {
+    QVector<QString> keys;
+    keys.reserve(count);
+    for (int row = 0; row < count; row++) {
+        keys.append(c.stations[c.station[row]] + ' ' + QString::number(c.observationTime[row]));
+    }
+    return keys;
+}
+
+static bool sameValue (float a, float b) {
+    return a == b || (qIsNaN(a) && qIsNaN(b));
+}
+
+static bool sameMetar (const MetarColumns& a, int i, const MetarColumns& b, int j) {
+    if (!sameValue(a.tempC[i], b.tempC[j]) || !sameValue(a.dewpointC[i], b.dewpointC[j])
+        || !sameValue(a.windDirDeg[i], b.windDirDeg[j]) || !sameValue(a.windSpeedKt[i], b.windSpeedKt[j])
+        || !sameValue(a.visibilityMi[i], b.visibilityMi[j]) || a.skyCount[i] != b.skyCount[j]) {
+        return false;
+    }
+    for (quint32 k = 0; k < a.skyCount[i]; k++) {
+        quint32 x = a.skyFirst[i] + k;
+        quint32 y = b.skyFirst[j] + k;
+        if (a.skyBaseFt[x] != b.skyBaseFt[y] || a.skyCovers[a.skyCover[x]] != b.skyCovers[b.skyCover[y]]) return false;
+    }
+    return a.rawText.midRef(int(a.rawOffset[i]), int(a.rawLength[i]))
+        == b.rawText.midRef(int(b.rawOffset[j]), int(b.rawLength[j]));
+}
+
+void MetarModel::update (const MetarColumns& next) {
+    previous = columns;
+    columns = next;
+    generation++;
+    if (!sameValue(columns.runwayHeadingDeg, runwayHeading)) columns.setRunwayHeading(runwayHeading);
+    columns.derive();
+    applyDiff(metarKeys(previous, rows), metarKeys(columns, diffLimit(columns.count())),
+        [this] (int previousRow, int nextRow) { return sameMetar(previous, previousRow, columns, nextRow); });
+    previous.clear();
+}
+
+void MetarModel::resetReader () {
+    reader.clear();
+    pending.clear();
+    reading = false;
+    staged = false;
+    readerFed = false;
+}
+
 void MetarModel::readData (QIODevice* device) {
-    document.setContent(device);
+    TRACE_SPAN("weather", "MetarModel::readData");
+    resetReader();
+    MetarColumns next;
+    QXmlStreamReader deviceXml (device);
+    ReadMetarXml(deviceXml, next);
+    if (deviceXml.hasError()) {
+        cerr << "MetarModel::readData: " << deviceXml.errorString().toStdString() << endl;
+    }
+    update(next);
+}
+
+void MetarModel::beginData () {
+    resetReader();
+    staged = rows > 0;
+    if (!staged) {
+        columns.clear();
+        columns.setRunwayHeading(runwayHeading);
+        generation++;
+    }
+    reading = true;
+}
+
+void MetarModel::appendData (const QByteArray& data) {
+    if (!reading || reader.hasFailed()) return;
+    TRACE_SPAN("weather", "MetarModel::appendData");
+    readerFed = true;
+    MetarColumns batch = reader.read(data);
+    if (reader.hasFailed()) {
+        cerr << "MetarModel::appendData: " << reader.errorString().toStdString() << endl;
+    }
+    appendMetars(batch);
+}
+
+void MetarModel::appendMetars (const MetarColumns& batch) {
+    if (!reading) return;
+    if (staged) {
+        pending.append(batch);
+        return;
+    }
+    // The batch was derived where it was read, and append() carries that over:
+    columns.append(batch);
+    showRows(diffLimit(availableRows()));
+}
+
+int MetarModel::availableRows () const {
+    return columns.count();
+}
+
+void MetarModel::endData () {
+    // Like ForecastModel::endData:
+    if (reading && !readerFed) {
+        resetReader();
+        return;
+    }
+    endData(reader.isComplete());
+}
+
+void MetarModel::endData (bool complete) {
+    if (!reading) return;
+    if (!complete) {
+        cerr << "MetarModel::endData: incomplete response" << endl;
+    }
+    MetarColumns next = pending;
+    bool apply = staged && complete;
+    resetReader();
+    if (apply) update(next);
+}
+
+void MetarModel::clear () {
+    beginResetModel();
+    resetReader();
+    columns.clear();
+    columns.setRunwayHeading(runwayHeading);
+    generation++;
+    rows = 0;
     endResetModel();
 }
 
-int MetarModel::rowCount (const QModelIndex& parent) const {
-    return document.elementsByTagName("METAR").count();
+void MetarModel::setMetars (const MetarColumns& metars) {
+    resetReader();
+    update(metars);
+}
+
+void MetarModel::setRunwayHeading (float headingDeg) {
+    runwayHeading = headingDeg;
+    columns.setRunwayHeading(headingDeg);
+    generation++;
+    if (rows > 0) emit dataChanged(index(0, MetarHeadwind), index(rows - 1, MetarCrosswind));
+}
+
+void MetarModel::showAllRows (bool all) {
+    setPaged(!all);
+}
+
+const MetarColumns* MetarModel::metarAt (int row, int& metarRow) const {
+    if (row < 0 || row >= rows) return nullptr;
+    metarRow = sourceRow(row);
+    if (metarRow >= 0) return &columns;
+    metarRow = ~metarRow;
+    return &previous;
 }
 
 int MetarModel::columnCount (const QModelIndex& parent) const {
-    return 8;
+    return MetarColumnCount;
 }
 
-QVariant MetarModel::data (const QModelIndex &index, int role) const {
-    if (role != Qt::DisplayRole) return QVariant();
+static QVariant formatValue (float value, const char* unit) {
+    if (qIsNaN(value)) return QVariant();
+    return QVariant(QString::number(value) + QString(unit));
+}
 
-    auto m = document.elementsByTagName("METAR").item(index.row()).toElement();
-    if (m.isNull()) return QVariant();
+static QVariant formatRounded (float value, const char* unit) {
+    if (qIsNaN(value)) return QVariant();
+    return QVariant(QString::number(qRound(value)) + QString(unit));
+}
 
-    switch (index.column()) {
-        case 0: return QVariant(m.elementsByTagName("observation_time").item(0).toElement().text());
-        case 1: return QVariant(m.elementsByTagName("temp_c").item(0).toElement().text() + QString("°C"));
-        case 2: return QVariant(m.elementsByTagName("dewpoint_c").item(0).toElement().text() + QString("°C"));
-        case 3: return QVariant(m.elementsByTagName("wind_dir_degrees").item(0).toElement().text() + QString("°"));
-        case 4: return QVariant(m.elementsByTagName("wind_speed_kt").item(0).toElement().text() + QString(" kt"));
-        case 5: return QVariant(m.elementsByTagName("visibility_statute_mi").item(0).toElement().text() + QString("mi"));
-        case 6: return QVariant(m.elementsByTagName("sky_condition").item(0).toElement().attribute("sky_cover"));
-        case 7: return QVariant(m.elementsByTagName("raw_text").item(0).toElement().text());
+static QString flightCategoryName (FlightCategory category) {
+    switch (category) {
+        case FlightCategory::Unknown: return QString();
+        case FlightCategory::VFR:     return QString("VFR");
+        case FlightCategory::MVFR:    return QString("MVFR");
+        case FlightCategory::IFR:     return QString("IFR");
+        case FlightCategory::LIFR:    return QString("LIFR");
+    }
+    return QString();
+}
+
+QVariant MetarColumns::display (int row, int column) const {
+    bool derived = row < flightCategory.size();
+    switch (column) {
+        case MetarTime:          return QVariant(QDateTime::fromSecsSinceEpoch(observationTime[row], Qt::UTC)
+                                     .toString(Qt::ISODate));
+        case MetarTemperature:   return formatValue(tempC[row], "°C");
+        case MetarDewpoint:      return formatValue(dewpointC[row], "°C");
+        case MetarWindDirection: return formatValue(windDirDeg[row], "°");
+        case MetarWindSpeed:     return formatValue(windSpeedKt[row], " kt");
+        case MetarVisibility:    return formatValue(visibilityMi[row], "mi");
+        case MetarSky:           return QVariant(sky(row));
+        case MetarRawText:       return QVariant(raw(row));
+    }
+    if (!derived) return QVariant();
+    switch (column) {
+        case MetarFlightCategory: return QVariant(flightCategoryName(FlightCategory(flightCategory[row])));
+        case MetarHumidity:       return formatRounded(humidityPct[row], "%");
+        case MetarSpread:         return formatValue(spreadC[row], "°C");
+        case MetarHeadwind:       return formatRounded(headwindKt[row], " kt");
+        case MetarCrosswind: {
+            float crosswind = crosswindKt[row];
+            return formatRounded(qAbs(crosswind), crosswind < 0 ? " kt L" : " kt R");
+        }
+    }
+    return QVariant();
+}
+
+QVariant MetarColumns::background (int row, int column) const {
+    if (column != MetarFlightCategory || row >= flightCategory.size()) return QVariant();
+    // The usual colours for the categories, lightened so the text stays readable:
+    switch (FlightCategory(flightCategory[row])) {
+        case FlightCategory::Unknown: return QVariant();
+        case FlightCategory::VFR:     return QVariant(QColor(200, 230, 201));
+        case FlightCategory::MVFR:    return QVariant(QColor(187, 222, 251));
+        case FlightCategory::IFR:     return QVariant(QColor(255, 205, 210));
+        case FlightCategory::LIFR:    return QVariant(QColor(225, 190, 231));
     }
     return QVariant();
 }
 
+QVariant MetarModel::data (const QModelIndex &index, int role) const {
+    if (role != Qt::DisplayRole && role != Qt::BackgroundRole) return QVariant();
+    if (index.row() < 0 || index.row() >= rows) return QVariant();
+    int row = sourceRow(index.row());
+    const MetarColumns& source = row < 0 ? previous : columns;
+    if (row < 0) row = ~row;
+    if (role == Qt::BackgroundRole) return source.background(row, index.column());
+    return source.display(row, index.column());
+}
+
 QVariant MetarModel::headerData (int section, Qt::Orientation orientation, int role) const {
     if (role != Qt::DisplayRole) return QVariant();
     if (orientation != Qt::Orientation::Horizontal) return QVariant();
     switch (section) {
-        case 0: return QVariant(tr("Time"));
-        case 1: return QVariant(tr("Temperature"));
-        case 2: return QVariant(tr("Dew point"));
-        case 3: return QVariant(tr("Wind"));
-        case 4: return QVariant(tr("Wind speed"));
-        case 5: return QVariant(tr("Visibility"));
-        case 6: return QVariant(tr("Sky condition"));
-        case 7: return QVariant(tr("Raw METAR text"));
+        case MetarTime:           return QVariant(tr("Time"));
+        case MetarTemperature:    return QVariant(tr("Temperature"));
+        case MetarDewpoint:       return QVariant(tr("Dew point"));
+        case MetarWindDirection:  return QVariant(tr("Wind"));
+        case MetarWindSpeed:      return QVariant(tr("Wind speed"));
+        case MetarVisibility:     return QVariant(tr("Visibility"));
+        case MetarSky:            return QVariant(tr("Sky condition"));
+        case MetarFlightCategory: return QVariant(tr("Category"));
+        case MetarHumidity:       return QVariant(tr("Humidity"));
+        case MetarSpread:         return QVariant(tr("Spread"));
+        case MetarHeadwind:       return QVariant(tr("Headwind"));
+        case MetarCrosswind:      return QVariant(tr("Crosswind"));
+        case MetarRawText:        return QVariant(tr("Raw METAR text"));
     }
     return QVariant();
 }
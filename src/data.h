@@ -1,19 +1,96 @@
 #pragma once
+#include <functional>
 #include <QtCore/QIODevice>
+#include <QtCore/QCache>
 #include <QtCore/QList>
 #include <QtCore/QString>
 #include <QtCore/QTextCodec>
 #include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QAbstractItemModel>
 #include <QtCore/QStringListModel>
 #include <QtCore/QDateTime>
-#include <QtXml/QDomDocument>
+#include <QtCore/QVector>
+#include <QtCore/QStringList>
+#include <QtCore/QHash>
+#include <QtCore/QXmlStreamReader>
+#include <QtCore/QtNumeric>
+#include "search.h"
+#include "spatial.h"
 
 // QStringList ReadAirportData (QByteArray csvFile);
 
-struct AirportNameEntry {
-    QString icao; // ICAO airport code for EditRole, e.g. "LROP"
-    QString full; // data for DisplayRole, e.g. "LROP/OTP: Henri Coanda International Airport, Bucharest, Romania"
+// The airport list, stored compactly: one fixed-size record per airport, holding offsets into a shared UTF-16 string
+// pool. Each string in the pool is preceded by its length. Cities and countries are interned, so the few thousand
+// distinct ones are stored once however many airports share them. The display text, e.g.
+// "LROP/OTP: Henri Coanda International Airport, Bucharest, Romania", isn't stored; it's put together on request.
+// Coordinates are kept in the record itself, NaN if the file doesn't have them.
+class AirportEntries {
+    public:
+        struct Record {
+            quint32 icao;    // pool offsets
+            quint32 iata;
+            quint32 name;
+            quint32 city;
+            quint32 country;
+            float latitude;  // degrees, north positive
+            float longitude; // degrees, east positive
+        };
+
+        int size () const { return recordBytes.size() / int(sizeof(Record)); }
+        void reserve (int count);
+        void append (const QString& icao, const QString& iata, const QString& name, const QString& city,
+            const QString& country, float latitude, float longitude);
+        void append (const AirportEntries& other);
+        // Drops the interning table and spare capacity once everything's been added.
+        void squeeze ();
+
+        // These point into the pool, so they're only valid for as long as the entries are:
+        QStringRef icao (int row) const    { return string(records()[row].icao); }
+        QStringRef iata (int row) const    { return string(records()[row].iata); }
+        QStringRef name (int row) const    { return string(records()[row].name); }
+        QStringRef city (int row) const    { return string(records()[row].city); }
+        QStringRef country (int row) const { return string(records()[row].country); }
+        float latitude (int row) const     { return records()[row].latitude; }
+        float longitude (int row) const    { return records()[row].longitude; }
+        // Puts the display text for row into text, reusing its buffer.
+        void displayText (int row, QString& text) const;
+        QString displayText (int row) const;
+
+        // For the snapshot: Record[size()] and the pool.
+        const QByteArray& recordData () const { return recordBytes; }
+        const QString& stringPool () const { return pool; }
+        void setData (const QByteArray& records, const QString& strings);
+        // Checks that the records only point at complete strings inside the pool.
+        static bool validate (const QByteArray& records, const QString& strings);
+    private:
+        const Record* records () const { return reinterpret_cast<const Record*>(recordBytes.constData()); }
+        QStringRef string (quint32 offset) const {
+            return pool.midRef(int(offset) + 1, pool.at(int(offset)).unicode());
+        }
+        quint32 addString (const QString& text, bool intern);
+
+        QByteArray recordBytes;
+        QString pool;                     // starts with the empty string, at offset 0
+        QHash<QString, quint32> interned; // while adding entries
+};
+
+// Parses the airports.dat records in [begin, end) and appends them to entries. The range has to start and end on a
+// record boundary.
+void ParseAirportsCSV (const char* begin, const char* end, AirportEntries& entries);
+
+// Everything AirportNameModel knows about the airports. This is plain data, so it can be built on a worker thread
+// and handed over to the model afterwards.
+struct AirportData {
+    QSharedPointer<QFile> snapshotFile; // set if the entries and indexes point into a mapped snapshot
+    AirportEntries entries;
+    AirportSearchIndex searchIndex;
+    AirportSpatialIndex spatialIndex;
+
+    // Binary snapshot of the entries and indexes, see snapshot.cpp:
+    bool readSnapshot (const QString& path);
+    bool writeSnapshot (const QString& path) const;
 };
 
 class AirportNameModel : public QAbstractItemModel {
@@ -21,33 +98,343 @@ class AirportNameModel : public QAbstractItemModel {
     // EditRole    -> LROP
     public:
         void readData (QByteArray csvFile);
+        void setAirports (const AirportData& data);
+        const AirportData& airports () const { return airportData; }
         QModelIndex index (int row, int column, const QModelIndex &parent = QModelIndex()) const;
         QModelIndex parent (const QModelIndex &index) const;
         int rowCount (const QModelIndex &parent = QModelIndex()) const;
         int columnCount (const QModelIndex &parent = QModelIndex()) const;
         QVariant data (const QModelIndex &index, int role = Qt::DisplayRole) const;
+        // Ranked, typo-tolerant search over the DisplayRole text; returns up to limit rows, best match first.
+        QVector<int> search (const QString& query, int limit) const;
+        // Up to limit other airports with an ICAO code at most radiusNm away from row, nearest first.
+        QVector<int> nearby (int row, double radiusNm, int limit) const;
     private:
-        QList<AirportNameEntry> entries;
+        AirportData airportData;
+        // Display texts of the rows shown lately; only a few rows are ever visible (in the completion popup):
+        mutable QCache<int, QString> displayCache { 256 };
+};
+
+// One layer from a <sky_condition> element, e.g. sky_cover="BKN" cloud_base_ft_agl="3000" cloud_type="CB".
+struct SkyLayer {
+    QString cover;     // SKC, CLR, FEW, SCT, BKN, OVC, OVX, VV...
+    int baseFt = -1;   // cloud base in feet AGL, or -1 if not reported
+    QString cloudType; // CB, TCU or empty
+};
+
+enum class ChangeIndicator : quint8 {
+    None,     // initial forecast period
+    From,     // FM
+    Becoming, // BECMG
+    Tempo,    // TEMPO
+    Prob,     // PROB
+};
+
+// TAF-level data shared by all of its forecast periods.
+struct TafReport {
+    QString stationId;
+    QDateTime issueTime;
+    QString rawText;
 };
 
-class ForecastModel : public QAbstractTableModel {
+// A single forecast period (<forecast> element) from a TAF.
+struct TafForecast {
+    int report = 0; // index into TafRecords::reports
+    QDateTime from;
+    QDateTime to;
+    ChangeIndicator changeIndicator = ChangeIndicator::None;
+    int probability = 0; // only set for PROB groups
+    QStringList wxStrings;
+    QVector<SkyLayer> skyLayers;
+};
+
+// Display text for TAF fields, e.g. "BKN030CB OVC080" and "PROB30":
+QString FormatSkyLayers (const QVector<SkyLayer>& layers);
+QString FormatChangeIndicator (ChangeIndicator indicator, int probability);
+
+// Parsed TAFs: the report-level data and the forecast periods of all reports.
+struct TafRecords {
+    QVector<TafReport> reports;
+    QVector<TafForecast> forecasts;
+
+    // Appends a copy of another store's report with its forecasts, or all of its reports:
+    int appendReport (const TafRecords& other, int report);
+    void append (const TafRecords& other);
+};
+
+enum class TafField : quint8 { None, RawText, StationId, IssueTime, From, To, ChangeIndicator, Probability, WxString };
+
+// Where ReadTafXml left off, so a response can be read in pieces as it arrives.
+struct TafXmlState {
+    int report = -1;   // report being read, or -1
+    int forecast = -1; // forecast being read, or -1; forecasts before it are complete
+    TafField field = TafField::None;
+    QString text;      // text of the current field, which can arrive in several pieces
+};
+
+// Reads every <TAF> element of a dataserver TAF response, appending to records. With the state overload, the reader
+// can be fed with QXmlStreamReader::addData and ReadTafXml called again whenever more data is in.
+void ReadTafXml (QXmlStreamReader& xml, TafRecords& records);
+void ReadTafXml (QXmlStreamReader& xml, TafRecords& records, TafXmlState& state);
+
+// Reads a TAF response a piece at a time and hands out the reports each piece completes, with their forecasts.
+// Used by ForecastModel::appendData, and by WeatherDecoder (see decoder.h) to do the same on the thread pool.
+class TafStreamReader {
     public:
-        void readData (QIODevice* device);
+        void clear ();
+        TafRecords read (const QByteArray& data);
+        // Whether the whole response has been read, without errors:
+        bool isComplete () const { return xml.atEnd() && !xml.hasError(); }
+        // Whether reading stopped on an error, rather than just running out of data:
+        bool hasFailed () const;
+        QString errorString () const { return xml.errorString(); }
+    private:
+        QXmlStreamReader xml;
+        TafXmlState state;
+        TafRecords records;
+        int reportsOut = 0;   // reports handed out so far
+        int forecastsOut = 0; // and their forecasts
+};
+
+// Table model that moves to new data by diffing it against the rows on screen: rows are matched up by a key, and
+// only the ones that were removed, added or changed are signalled, so views keep their scroll position, selection
+// and column widths.
+// Views are handed the rows a page at a time through canFetchMore/fetchMore, as they scroll down, so a long history
+// costs no more to show (or diff) than a short one until it's scrolled through.
+class DiffingTableModel : public QAbstractTableModel {
+    public:
+        static const int pageSize = 200;
         int rowCount (const QModelIndex& parent = QModelIndex()) const;
+        bool canFetchMore (const QModelIndex& parent) const;
+        void fetchMore (const QModelIndex& parent);
+        // Without paging, every available row is shown as soon as it's in, e.g. for a view that sorts them.
+        void setPaged (bool on);
+        bool isPaged () const { return paged; }
+    protected:
+        // Rows of the current data that are complete, and could be shown.
+        virtual int availableRows () const = 0;
+        // How many of the next data's nextCount rows to diff in or show: as many as are shown, and at least a page;
+        // all of them without paging.
+        int diffLimit (int nextCount) const { return paged ? qMin(nextCount, qMax(rows, pageSize)) : nextCount; }
+        // Shows more of the available rows, up to count.
+        void showRows (int count);
+
+        // Goes from the rows shown, whose keys are previousKeys, to rows with nextKeys. same(previousRow, nextRow)
+        // tells whether a row that's in both still has the same content. While this runs, rowSource maps each row to
+        // either the next data (>= 0) or the previous data (~row); before and after, rows map 1:1 to the next data.
+        void applyDiff (const QVector<QString>& previousKeys, const QVector<QString>& nextKeys,
+            const std::function<bool (int previousRow, int nextRow)>& same);
+        int sourceRow (int row) const { return rowSource.isEmpty() ? row : rowSource[row]; }
+
+        int rows = 0; // rows the views know about
+        QVector<int> rowSource;
+        bool paged = true;
+};
+
+class ForecastModel : public DiffingTableModel {
+    // The response is decoded once in readData, so data() and rowCount() don't have to touch the XML again.
+    // Alternatively, beginData/appendData/endData decode it while it downloads, or appendTafs takes the reports as
+    // they're decoded elsewhere (see decoder.h) and endData(complete) says whether they all came in. If the model is
+    // empty, reports are inserted as they complete; otherwise the new forecasts are diffed against the old ones once
+    // they're all in.
+    public:
+        // Values to sort the rows by, where the display text wouldn't do: the times, and the lowest sky layer's base.
+        static const int SortRole = Qt::UserRole;
+
+        void readData (QIODevice* device);
+        void beginData ();
+        void appendData (const QByteArray& data);
+        void appendTafs (const TafRecords& batch);
+        // Without an argument, ends what appendData read, or gives up on what appendTafs was given.
+        void endData ();
+        void endData (bool complete);
+        bool isReading () const { return reading; }
+        void clear ();
+        // Shows records that didn't come from a response, e.g. from the history store:
+        void setTafs (const TafRecords& tafs);
+        const TafRecords& tafs () const { return records; }
         int columnCount (const QModelIndex& parent = QModelIndex()) const;
         QVariant data (const QModelIndex &index, int role = Qt::DisplayRole) const;
         QVariant headerData (int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    protected:
+        int availableRows () const;
+    private:
+        void update (const TafRecords& next);
+        void resetReader ();
+
+        TafRecords records;
+        TafRecords previous; // only set during update
+
+        TafStreamReader reader;
+        TafRecords pending;  // what's being read, if it's diffed in at the end
+        bool reading = false;
+        bool staged = false;
+        bool readerFed = false; // appendData was used, rather than appendTafs
+};
+
+// Columns of MetarModel, also used for the METAR columns of the watchlist.
+enum MetarColumn {
+    MetarTime,
+    MetarTemperature,
+    MetarDewpoint,
+    MetarWindDirection,
+    MetarWindSpeed,
+    MetarVisibility,
+    MetarSky,
+    MetarFlightCategory,
+    MetarHumidity,
+    MetarSpread,
+    MetarHeadwind,
+    MetarCrosswind,
+    MetarRawText,
+    MetarColumnCount
+};
+
+enum class FlightCategory : quint8 { Unknown, VFR, MVFR, IFR, LIFR };
+
+// METAR reports stored column-wise, one entry per report in each of the per-report vectors.
+// Missing numeric values are NaN; units are only added when the values are displayed.
+// The derived columns are computed by derive() in plain loops over the arrays, once as the reports come in, rather
+// than for every cell that's painted.
+struct MetarColumns {
+    QVector<quint16> station;         // index into stations
+    QVector<qint64>  observationTime; // seconds since the Unix epoch, UTC
+    QVector<float>   tempC;
+    QVector<float>   dewpointC;
+    QVector<float>   windDirDeg;
+    QVector<float>   windSpeedKt;
+    QVector<float>   visibilityMi;
+    QVector<quint32> skyFirst;        // first layer of the report in skyCover/skyBaseFt
+    QVector<quint8>  skyCount;
+    QVector<quint32> rawOffset;       // raw_text of the report, as a slice of rawText
+    QVector<quint32> rawLength;
+
+    // Derived per report, see derive():
+    QVector<float>   ceilingFt;       // lowest BKN/OVC/OVX/VV layer; infinity without one, NaN without sky layers
+    QVector<quint8>  flightCategory;  // FlightCategory, from the ceiling and visibility
+    QVector<float>   humidityPct;     // relative humidity, from the temperature and dew point
+    QVector<float>   spreadC;         // temperature minus dew point
+    QVector<float>   headwindKt;      // wind components for runwayHeadingDeg; negative for a tailwind
+    QVector<float>   crosswindKt;     // positive from the right
+    float runwayHeadingDeg = qQNaN();
+
+    // Sky layers of all reports:
+    QVector<quint8>  skyCover;        // index into skyCovers
+    QVector<qint32>  skyBaseFt;       // -1 if not reported
+
+    QStringList stations;
+    QStringList skyCovers;
+    QString rawText;
+
+    int count () const { return observationTime.size(); }
+    void clear ();
+    int appendRow ();
+    // Appends a copy of another store's row, or all of its rows, with their derived columns if both stores have them:
+    int appendRow (const MetarColumns& other, int row);
+    void append (const MetarColumns& other);
+    quint16 internStation (const QStringRef& id);
+    quint8 internSkyCover (const QStringRef& cover);
+    QString raw (int row) const;
+    QString sky (int row) const;
+    // Computes the derived columns for the rows up to end (every row if it's -1) that don't have them yet.
+    void derive (int end = -1);
+    // Sets the runway heading for the wind components and recomputes them.
+    void setRunwayHeading (float headingDeg);
+    // Display text for a MetarColumn, with units added:
+    QVariant display (int row, int column) const;
+    // Background colour for a MetarColumn; the flight category is colour-coded.
+    QVariant background (int row, int column) const;
+
+    private:
+        QHash<QString, quint16> stationIndex;
+};
+
+enum class MetarField : quint8 { None, RawText, StationId, ObservationTime, Temp, Dewpoint, WindDir, WindSpeed, Visibility };
+
+// Where ReadMetarXml left off, so a response can be read in pieces as it arrives.
+struct MetarXmlState {
+    int row = -1; // row being read, or -1; rows before it are complete
+    MetarField field = MetarField::None;
+    QString text; // text of the current field, which can arrive in several pieces
+};
+
+// Single-pass streaming parse of a dataserver METAR response into columns, appending to whatever is already there.
+// With the state overload, the reader can be fed with QXmlStreamReader::addData and ReadMetarXml called again
+// whenever more data is in.
+void ReadMetarXml (QXmlStreamReader& xml, MetarColumns& columns);
+void ReadMetarXml (QXmlStreamReader& xml, MetarColumns& columns, MetarXmlState& state);
+
+// Like TafStreamReader, for METAR responses. The reports handed out have their derived columns, without a runway.
+class MetarStreamReader {
+    public:
+        void clear ();
+        MetarColumns read (const QByteArray& data);
+        bool isComplete () const { return xml.atEnd() && !xml.hasError(); }
+        bool hasFailed () const;
+        QString errorString () const { return xml.errorString(); }
     private:
-        QDomDocument document;
+        QXmlStreamReader xml;
+        MetarXmlState state;
+        MetarColumns columns;
+        int rowsOut = 0;
+};
+
+// Models whose rows show METARs, so MetarSortFilterModel (see filter.h) can sort and filter them on the typed
+// columns rather than the display text.
+class MetarRowSource {
+    public:
+        virtual ~MetarRowSource () {}
+        // The store and row behind a model row, or null if the row has no METAR.
+        virtual const MetarColumns* metarAt (int row, int& metarRow) const = 0;
+        // The store most rows come from, which keys are cached for; other stores are looked at a row at a time.
+        virtual const MetarColumns* metarStore () const = 0;
+        // The MetarColumn a model column shows, or -1 for columns that aren't from a METAR.
+        virtual int metarColumn (int column) const = 0;
+        // Changes whenever rows already in metarStore change, but not when rows are appended to it.
+        virtual quint32 metarGeneration () const = 0;
+        // Whether to show every row rather than a page at a time (see DiffingTableModel), while the rows are sorted
+        // or filtered.
+        virtual void showAllRows (bool all) {}
 };
 
-class MetarModel : public QAbstractTableModel {
+class MetarModel : public DiffingTableModel, public MetarRowSource {
+    // Like ForecastModel, either decodes a whole response in readData or one piece at a time in appendData, or
+    // takes reports decoded elsewhere through appendMetars.
     public:
         void readData (QIODevice* device);
-        int rowCount (const QModelIndex& parent = QModelIndex()) const;
+        void beginData ();
+        void appendData (const QByteArray& data);
+        void appendMetars (const MetarColumns& batch);
+        void endData ();
+        void endData (bool complete);
+        bool isReading () const { return reading; }
+        void clear ();
+        void setMetars (const MetarColumns& metars);
+        const MetarColumns& metars () const { return columns; }
+        // Runway heading in degrees for the headwind and crosswind columns, NaN to leave them empty.
+        void setRunwayHeading (float headingDeg);
+        const MetarColumns* metarAt (int row, int& metarRow) const;
+        const MetarColumns* metarStore () const { return &columns; }
+        int metarColumn (int column) const { return column; }
+        quint32 metarGeneration () const { return generation; }
+        void showAllRows (bool all);
         int columnCount (const QModelIndex& parent = QModelIndex()) const;
         QVariant data (const QModelIndex &index, int role = Qt::DisplayRole) const;
         QVariant headerData (int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    protected:
+        int availableRows () const;
     private:
-        QDomDocument document;
+        void update (const MetarColumns& next);
+        void resetReader ();
+
+        MetarColumns columns;
+        MetarColumns previous; // only set during update
+
+        MetarStreamReader reader;
+        MetarColumns pending;
+        bool reading = false;
+        bool staged = false;
+        bool readerFed = false; // appendData was used, rather than appendMetars
+        float runwayHeading = qQNaN();
+        quint32 generation = 0;
 };
@@ -0,0 +1,50 @@
+#include "dataserver.h"
+#include <QtCore/QUrlQuery>
+
+static QUrl dataserverBaseUrl ("https://aviationweather.gov/adds/dataserver_current/httpparam");
+static QUrl airportDataUrl ("https://raw.githubusercontent.com/jpatokal/openflights/master/data/airports.dat");
+
+QUrl DataserverBaseUrl () {
+    return dataserverBaseUrl;
+}
+
+void SetDataserverBaseUrl (const QUrl& url) {
+    dataserverBaseUrl = url;
+}
+
+QUrl AirportDataUrl () {
+    return airportDataUrl;
+}
+
+void SetAirportDataUrl (const QUrl& url) {
+    airportDataUrl = url;
+}
+
+QUrl DataserverUrl (const QString& dataSource, const QStringList& stations,
+    const QList<QPair<QString, QString>>& parameters)
+{
+    QUrlQuery query;
+    query.addQueryItem("dataSource", dataSource);
+    query.addQueryItem("requestType", "retrieve");
+    query.addQueryItem("format", "xml");
+    query.addQueryItem("stationString", stations.join(','));
+    for (const auto& parameter: parameters) {
+        query.addQueryItem(parameter.first, parameter.second);
+    }
+    QUrl url (dataserverBaseUrl);
+    url.setQuery(query);
+    return url;
+}
+
+QUrl DataserverTAFUrl (const QString& station) {
+    return DataserverUrl("tafs", QStringList(station), { { "hoursBeforeNow", "24" }, { "mostRecent", "true" } });
+}
+
+QUrl DataserverMETARUrl (const QString& station) {
+    return DataserverUrl("metars", QStringList(station), { { "hoursBeforeNow", QString::number(DataserverMETARHours) } });
+}
+
+QUrl DataserverFeedUrl (const QString& dataSource) {
+    // .../dataserver_current/httpparam -> .../dataserver_current/current/metars.cache.xml.gz
+    return dataserverBaseUrl.resolved(QUrl("current/" + dataSource + ".cache.xml.gz"));
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+
+// Request URLs for the aviationweather.gov ADDS dataserver and the OpenFlights airport list.
+// dataSource is "metars" or "tafs"; several stations can be requested at once, the dataserver takes a
+// comma-separated stationString. Parameters are always added in the same order, since the URL is also the key for
+// WeatherCache.
+
+// Where requests go. The defaults are the real servers; a stand-in (see standin.h) can be used instead.
+QUrl DataserverBaseUrl ();
+void SetDataserverBaseUrl (const QUrl& url);
+QUrl AirportDataUrl ();
+void SetAirportDataUrl (const QUrl& url);
+
+QUrl DataserverUrl (const QString& dataSource, const QStringList& stations,
+    const QList<QPair<QString, QString>>& parameters);
+
+// The requests used for a single airport search:
+QUrl DataserverTAFUrl (const QString& station);   // most recent TAF from the last 24 hours
+QUrl DataserverMETARUrl (const QString& station); // all METARs from the last DataserverMETARHours hours
+const int DataserverMETARHours = 48;
+
+// The all-stations cache file for dataSource, gzip'd XML refreshed every few minutes, see feed.h:
+QUrl DataserverFeedUrl (const QString& dataSource);
@@ -0,0 +1,172 @@
+#include "decoder.h"
+#include "trace.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QPointer>
+#include <QtCore/QUrlQuery>
+#include <iostream>
+using namespace std;
+
+WeatherDecoder::WeatherDecoder (QObject* parent) : QObject(parent) {}
+
+WeatherDecoder::~WeatherDecoder () {
+    // Whatever the tasks decode from here on is dropped. The calls they already queued go with the decoder.
+    for (const QSharedPointer<Stream>& stream: streams) {
+        stream->cancelled.store(1);
+    }
+    for (QFuture<void>& task: tasks) {
+        task.waitForFinished();
+    }
+}
+
+int WeatherDecoder::decodeTafs (const CancellationToken& token, TafCallback onBatch) {
+    auto stream = QSharedPointer<Stream>::create();
+    stream->tafs = true;
+    stream->onTafs = onBatch;
+    return open(token, stream);
+}
+
+int WeatherDecoder::decodeMetars (const CancellationToken& token, MetarCallback onBatch) {
+    auto stream = QSharedPointer<Stream>::create();
+    stream->tafs = false;
+    stream->onMetars = onBatch;
+    return open(token, stream);
+}
+
+int WeatherDecoder::open (const CancellationToken& token, QSharedPointer<Stream> stream) {
+    int id = nextId++;
+    stream->id = id;
+    streams.insert(id, stream);
+    QPointer<WeatherDecoder> decoder (this);
+    token.onCancel([decoder, id] () {
+        if (decoder != nullptr) decoder->cancel(id);
+    });
+    return id;
+}
+
+void WeatherDecoder::append (int id, const QByteArray& data) {
+    QSharedPointer<Stream> stream = streams.value(id);
+    if (stream.isNull() || data.isEmpty()) return;
+    stream->receivedData = true;
+    enqueue(stream, data, false);
+}
+
+void WeatherDecoder::finish (int id, const QByteArray& body, FinishedCallback finished) {
+    QSharedPointer<Stream> stream = streams.value(id);
+    if (stream.isNull()) return;
+    stream->onFinished = finished;
+    enqueue(stream, stream->receivedData ? QByteArray() : body, true);
+}
+
+void WeatherDecoder::cancel (int id) {
+    QSharedPointer<Stream> stream = streams.take(id);
+    if (stream.isNull()) return;
+    stream->cancelled.store(1);
+    QMutexLocker lock (&stream->mutex);
+    stream->queue.clear();
+}
+
+void WeatherDecoder::decodeAll (const QVector<RequestResult>& results, const CancellationToken& token,
+    ReportsCallback finished)
+{
+    track(QtConcurrent::run([this, results, token, finished] () {
+        TRACE_SPAN("weather", "decode responses");
+        auto metars = QSharedPointer<MetarColumns>::create();
+        auto tafs = QSharedPointer<TafRecords>::create();
+        for (const RequestResult& result: results) {
+            QXmlStreamReader xml (result.body);
+            if (QUrlQuery(result.url).queryItemValue("dataSource") == "tafs") {
+                ReadTafXml(xml, *tafs);
+            } else {
+                ReadMetarXml(xml, *metars);
+            }
+            if (xml.hasError()) cerr << "WeatherDecoder: " << xml.errorString().toStdString() << endl;
+        }
+        // The token is only looked at on the GUI thread:
+        QMetaObject::invokeMethod(this, [token, finished, metars, tafs] () {
+            if (!token.isCancelled()) finished(*metars, *tafs);
+        }, Qt::QueuedConnection);
+    }));
+}
+
+void WeatherDecoder::track (QFuture<void> task) {
+    // Forget the tasks that are done, so the list stays short:
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        it = it->isFinished() ? tasks.erase(it) : it + 1;
+    }
+    tasks.append(task);
+}
+
+void WeatherDecoder::enqueue (QSharedPointer<Stream> stream, const QByteArray& data, bool finishing) {
+    QMutexLocker lock (&stream->mutex);
+    if (!data.isEmpty()) stream->queue.append(data);
+    if (finishing) stream->finishing = true;
+    if (stream->running) return;
+    stream->running = true;
+    lock.unlock();
+    track(QtConcurrent::run([this, stream] () { readQueue(stream); }));
+}
+
+void WeatherDecoder::readQueue (QSharedPointer<Stream> stream) {
+    // Runs on the pool. Whatever was queued in the meantime is read in one go and delivered as one batch.
+    TRACE_SPAN("weather", "decode response");
+    for (;;) {
+        QByteArray data;
+        bool finishing;
+        {
+            QMutexLocker lock (&stream->mutex);
+            for (const QByteArray& piece: stream->queue) {
+                data += piece;
+            }
+            stream->queue.clear();
+            finishing = stream->finishing;
+            // Once the stream is finished, running stays set, so nothing starts reading it again:
+            if (data.isEmpty() && !finishing) {
+                stream->running = false;
+                return;
+            }
+        }
+        if (stream->cancelled.load()) return;
+
+        if (data.isEmpty()) {
+            bool complete = stream->tafs ? stream->tafReader.isComplete() : stream->metarReader.isComplete();
+            QMetaObject::invokeMethod(this, [this, stream, complete] () { deliverFinished(stream, complete); },
+                Qt::QueuedConnection);
+            return;
+        }
+
+        if (stream->tafs) {
+            auto batch = QSharedPointer<const TafRecords>(new TafRecords(stream->tafReader.read(data)));
+            if (stream->tafReader.hasFailed()) {
+                cerr << "WeatherDecoder: " << stream->tafReader.errorString().toStdString() << endl;
+            }
+            if (batch->reports.isEmpty()) continue;
+            QMetaObject::invokeMethod(this, [this, stream, batch] () { deliverTafs(stream, batch); },
+                Qt::QueuedConnection);
+        } else {
+            auto batch = QSharedPointer<const MetarColumns>(new MetarColumns(stream->metarReader.read(data)));
+            if (stream->metarReader.hasFailed()) {
+                cerr << "WeatherDecoder: " << stream->metarReader.errorString().toStdString() << endl;
+            }
+            if (batch->count() == 0) continue;
+            QMetaObject::invokeMethod(this, [this, stream, batch] () { deliverMetars(stream, batch); },
+                Qt::QueuedConnection);
+        }
+    }
+}
+
+void WeatherDecoder::deliverTafs (QSharedPointer<Stream> stream, QSharedPointer<const TafRecords> batch) {
+    if (stream->cancelled.load()) return;
+    stream->onTafs(stream->id, batch);
+}
+
+void WeatherDecoder::deliverMetars (QSharedPointer<Stream> stream, QSharedPointer<const MetarColumns> batch) {
+    if (stream->cancelled.load()) return;
+    stream->onMetars(stream->id, batch);
+}
+
+void WeatherDecoder::deliverFinished (QSharedPointer<Stream> stream, bool complete) {
+    if (stream->cancelled.load()) return;
+    streams.remove(stream->id);
+    if (stream->onFinished) stream->onFinished(complete);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <functional>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QFuture>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include "data.h"
+#include "requests.h"
+
+// Decodes weather responses on the global thread pool, so the GUI thread only has to put the reports in the models.
+//
+// Each response gets a stream, which is fed the body a piece at a time as it downloads. A stream's pieces are read
+// in order, by one pool task at a time, with TafStreamReader or MetarStreamReader; different streams are read in
+// parallel. Whatever reports a task completes come back to the GUI thread as one immutable batch, over a queued
+// call, for ForecastModel::appendTafs or MetarModel::appendMetars.
+//
+// Every stream belongs to a CancellationToken. Once that's cancelled, e.g. because a newer search superseded the one
+// the stream was for, the pieces it hasn't read yet are dropped, and so is anything it decoded that hasn't been
+// delivered yet.
+class WeatherDecoder : public QObject {
+    Q_OBJECT
+    public:
+        // The stream's ID and a batch of its reports:
+        typedef std::function<void(int, QSharedPointer<const TafRecords>)> TafCallback;
+        typedef std::function<void(int, QSharedPointer<const MetarColumns>)> MetarCallback;
+        // Whether the response was complete and well-formed:
+        typedef std::function<void(bool)> FinishedCallback;
+        typedef std::function<void(const MetarColumns&, const TafRecords&)> ReportsCallback;
+
+        WeatherDecoder (QObject* parent = nullptr);
+        // Waits for the pool tasks that are still running, as they call back through the decoder.
+        ~WeatherDecoder ();
+        // Start a stream. IDs go up, so a stream with a higher one was started later.
+        int decodeTafs (const CancellationToken& token, TafCallback onBatch);
+        int decodeMetars (const CancellationToken& token, MetarCallback onBatch);
+        void append (int stream, const QByteArray& data);
+        // There's no more data for the stream. If none was appended, body is read instead, e.g. for responses that
+        // didn't come in piece by piece. finished is called after the last batch has been delivered.
+        void finish (int stream, const QByteArray& body, FinishedCallback finished);
+        // Drops the stream and whatever it hasn't delivered, without calling anything else.
+        void cancel (int stream);
+
+        // Decodes whole responses of either kind (going by their dataSource) in one pool task, and calls finished
+        // with all of their reports, unless token has been cancelled by then.
+        void decodeAll (const QVector<RequestResult>& results, const CancellationToken& token,
+            ReportsCallback finished);
+    private:
+        struct Stream {
+            int id;
+            bool tafs;
+            TafCallback onTafs;
+            MetarCallback onMetars;
+            FinishedCallback onFinished;
+            bool receivedData = false;
+
+            // Shared with the pool task reading the stream:
+            QMutex mutex;
+            QList<QByteArray> queue;
+            bool finishing = false;
+            bool running = false; // a task is reading the queue
+            QAtomicInt cancelled;
+
+            // Only touched by the task reading the stream:
+            TafStreamReader tafReader;
+            MetarStreamReader metarReader;
+        };
+
+        int open (const CancellationToken& token, QSharedPointer<Stream> stream);
+        void track (QFuture<void> task);
+        void enqueue (QSharedPointer<Stream> stream, const QByteArray& data, bool finishing);
+        void readQueue (QSharedPointer<Stream> stream);
+        void deliverTafs (QSharedPointer<Stream> stream, QSharedPointer<const TafRecords> batch);
+        void deliverMetars (QSharedPointer<Stream> stream, QSharedPointer<const MetarColumns> batch);
+        void deliverFinished (QSharedPointer<Stream> stream, bool complete);
+
+        QHash<int, QSharedPointer<Stream>> streams;
+        QList<QFuture<void>> tasks; // pool tasks that may still be running
+        int nextId = 1;
+};
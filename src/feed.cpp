@@ -0,0 +1,269 @@
+#include "feed.h"
+#include "trace.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QXmlStreamReader>
+#include <algorithm>
+#include <iostream>
+#include <zlib.h>
+using namespace std;
+
+// GzipDecoder
+
+GzipDecoder::GzipDecoder () : stream(new z_stream_s()) {
+    // 16 + MAX_WBITS: expect a gzip header and trailer rather than zlib's.
+    if (inflateInit2(stream.data(), 16 + MAX_WBITS) != Z_OK) error = QString("couldn't initialise zlib");
+}
+
+GzipDecoder::~GzipDecoder () {
+    inflateEnd(stream.data());
+}
+
+bool GzipDecoder::decode (const QByteArray& data, QByteArray& out) {
+    if (!error.isEmpty()) return false;
+    char buffer[64 * 1024];
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream->avail_in = uInt(data.size());
+    do {
+        if (streamEnded && stream->avail_in > 0) {
+            // Another member follows:
+            inflateReset(stream.data());
+            streamEnded = false;
+        }
+        stream->next_out = reinterpret_cast<Bytef*>(buffer);
+        stream->avail_out = uInt(sizeof(buffer));
+        int result = inflate(stream.data(), Z_NO_FLUSH);
+        out.append(buffer, int(sizeof(buffer) - stream->avail_out));
+        if (result == Z_STREAM_END) {
+            streamEnded = true;
+        } else if (result == Z_BUF_ERROR) {
+            break; // needs more input
+        } else if (result != Z_OK) {
+            error = QString::fromLatin1(stream->msg != nullptr ? stream->msg : "corrupt data");
+            return false;
+        }
+    } while (stream->avail_in > 0 || stream->avail_out == 0);
+    return true;
+}
+
+
+
+// FeedData
+
+void FeedData::index () {
+    TRACE_SPAN("feed", "index feed");
+    metarRows.clear();
+    for (int row = 0; row < metars.count(); row++) {
+        metarRows[metars.stations[metars.station[row]]].append(row);
+    }
+    for (QVector<int>& rows: metarRows) {
+        std::sort(rows.begin(), rows.end(), [this] (int a, int b) {
+            return metars.observationTime[a] > metars.observationTime[b];
+        });
+    }
+
+    tafReports.clear();
+    for (int report = 0; report < tafs.reports.size(); report++) {
+        tafReports[tafs.reports[report].stationId].append(report);
+    }
+    for (QVector<int>& reports: tafReports) {
+        std::sort(reports.begin(), reports.end(), [this] (int a, int b) {
+            return tafs.reports[a].issueTime > tafs.reports[b].issueTime;
+        });
+    }
+
+    // Forecasts are stored in report order, so each report's are a range:
+    tafForecastBegin.fill(0, tafs.reports.size() + 1);
+    for (const TafForecast& forecast: tafs.forecasts) {
+        tafForecastBegin[forecast.report + 1]++;
+    }
+    for (int report = 0; report < tafs.reports.size(); report++) {
+        tafForecastBegin[report + 1] += tafForecastBegin[report];
+    }
+}
+
+bool FeedData::contains (const QString& station) const {
+    return metarRows.contains(station) || tafReports.contains(station);
+}
+
+MetarColumns FeedData::stationMetars (const QString& station) const {
+    MetarColumns columns;
+    for (int row: metarRows.value(station)) {
+        columns.appendRow(metars, row);
+    }
+    columns.derive();
+    return columns;
+}
+
+TafRecords FeedData::stationTafs (const QString& station) const {
+    TafRecords records;
+    for (int report: tafReports.value(station)) {
+        records.reports.append(tafs.reports[report]);
+        for (int i = tafForecastBegin[report]; i < tafForecastBegin[report + 1]; i++) {
+            TafForecast forecast = tafs.forecasts[i];
+            forecast.report = records.reports.size() - 1;
+            records.forecasts.append(forecast);
+        }
+    }
+    return records;
+}
+
+
+
+// FeedIngest
+
+FeedIngest::FeedIngest (bool tafs) : tafs(tafs) {}
+
+bool FeedIngest::append (const QByteArray& compressed) {
+    if (failed) return false;
+    if (!decoder.decode(compressed, text)) {
+        failed = true;
+        error = decoder.errorString();
+        return false;
+    }
+    dispatch(false);
+    return true;
+}
+
+bool FeedIngest::finish () {
+    if (!failed && !decoder.atEnd()) {
+        failed = true;
+        error = QString("the file is cut off");
+    }
+    dispatch(true);
+    return !failed;
+}
+
+void FeedIngest::dispatch (bool all) {
+    if (!all && text.size() < chunkSize) return;
+    // Only whole records are handed out: from the first opening tag to the end of the last closing tag, wrapped in
+    // a <data> element so the readers see a document. What comes before the first record is the response header;
+    // what comes after the last one is kept until more data arrives.
+    QByteArray open = tafs ? "<TAF>" : "<METAR>";
+    QByteArray close = tafs ? "</TAF>" : "</METAR>";
+    int begin = text.indexOf(open);
+    if (begin < 0) {
+        text = text.right(open.size() - 1); // the start of a tag, maybe
+        return;
+    }
+    int end = text.lastIndexOf(close);
+    if (end < begin) {
+        text.remove(0, begin);
+        return;
+    }
+    end += close.size();
+    QByteArray chunk = "<data>" + text.mid(begin, end - begin) + "</data>";
+    text.remove(0, end);
+
+    if (tafs) {
+        tafChunks.append(QtConcurrent::run([chunk] () {
+            TRACE_SPAN("feed", "parse TAF chunk");
+            TafRecords records;
+            QXmlStreamReader xml (chunk);
+            ReadTafXml(xml, records);
+            if (xml.hasError()) cerr << "FeedIngest: " << xml.errorString().toStdString() << endl;
+            return records;
+        }));
+    } else {
+        metarChunks.append(QtConcurrent::run([chunk] () {
+            TRACE_SPAN("feed", "parse METAR chunk");
+            MetarColumns columns;
+            QXmlStreamReader xml (chunk);
+            ReadMetarXml(xml, columns);
+            if (xml.hasError()) cerr << "FeedIngest: " << xml.errorString().toStdString() << endl;
+            return columns;
+        }));
+    }
+}
+
+void FeedIngest::mergeInto (FeedData& data) {
+    for (QFuture<MetarColumns>& chunk: metarChunks) {
+        data.metars.append(chunk.result());
+    }
+    for (QFuture<TafRecords>& chunk: tafChunks) {
+        data.tafs.append(chunk.result());
+    }
+    metarChunks.clear();
+    tafChunks.clear();
+}
+
+
+
+// WeatherFeed
+
+WeatherFeed::WeatherFeed (RequestCoordinator* requestCoordinator, QObject* parent)
+    : QObject(parent), requestCoordinator(requestCoordinator), timer(new QTimer(this)),
+      merge(new QFutureWatcher<QSharedPointer<const FeedData>>(this)),
+      current(new FeedData())
+{
+    connect(timer, &QTimer::timeout, this, &WeatherFeed::refresh);
+    connect(merge, &QFutureWatcherBase::finished, this, [this] () {
+        current = merge->result();
+        refreshing = false;
+        emit refreshed(true);
+    });
+}
+
+void WeatherFeed::setUrls (const QUrl& metars, const QUrl& tafs) {
+    metarUrl = metars;
+    tafUrl = tafs;
+}
+
+void WeatherFeed::setRefreshInterval (int seconds) {
+    if (seconds > 0) {
+        timer->start(seconds * 1000);
+    } else {
+        timer->stop();
+    }
+}
+
+void WeatherFeed::refresh () {
+    // A refresh supersedes whatever the previous one was still waiting for:
+    refreshToken.cancel();
+    refreshToken = CancellationToken();
+    refreshing = true;
+    auto metarIngest = QSharedPointer<FeedIngest>::create(false);
+    auto tafIngest = QSharedPointer<FeedIngest>::create(true);
+    requestCoordinator->getAll({ metarUrl, tafUrl }, refreshToken,
+        [this, metarIngest, tafIngest] (const QVector<RequestResult>& results) {
+            requestsFinished(results, metarIngest, tafIngest);
+        },
+        [metarIngest, tafIngest] (int request, const QByteArray& data) {
+            (request == 0 ? metarIngest : tafIngest)->append(data);
+        });
+}
+
+void WeatherFeed::requestsFinished (const QVector<RequestResult>& results, QSharedPointer<FeedIngest> metarIngest,
+    QSharedPointer<FeedIngest> tafIngest)
+{
+    bool ok = true;
+    for (const RequestResult& result: results) {
+        if (result.error != QNetworkReply::NoError) {
+            cerr << "WeatherFeed: " << result.url.toString().toStdString() << " failed with code "
+                 << result.error << endl;
+            ok = false;
+        }
+    }
+    for (const auto& ingest: { metarIngest, tafIngest }) {
+        if (ok && !ingest->finish()) {
+            cerr << "WeatherFeed: couldn't decompress: " << ingest->errorString().toStdString() << endl;
+            ok = false;
+        }
+    }
+    if (!ok) {
+        refreshing = false;
+        emit refreshed(false);
+        return;
+    }
+
+    // Waiting for the parsing jobs and merging them can take a moment, so that's done on the thread pool too:
+    merge->setFuture(QtConcurrent::run([metarIngest, tafIngest] () -> QSharedPointer<const FeedData> {
+        TRACE_SPAN("feed", "merge feed");
+        auto data = QSharedPointer<FeedData>::create();
+        data->loadedAt = QDateTime::currentDateTimeUtc();
+        metarIngest->mergeInto(*data);
+        tafIngest->mergeInto(*data);
+        data->metars.derive();
+        data->index();
+        return data;
+    }));
+}
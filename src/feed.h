@@ -0,0 +1,113 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QFuture>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+#include "data.h"
+#include "requests.h"
+
+// Feed mode: instead of asking the dataserver about one station at a time, download the all-stations cache files
+// it publishes every few minutes (metars.cache.xml.gz and tafs.cache.xml.gz, several thousand stations each) and
+// answer every lookup from memory until the next refresh.
+//
+// The files are decompressed as they download. Whenever enough complete records have come in, they're handed to
+// the thread pool to be parsed, so parsing runs in parallel with the download and with itself. Once both files are
+// in, the parsed chunks are merged in file order and indexed by station, off the GUI thread.
+//
+// Feed URLs can point at a saved file (file://) or be replayed from a recording (see replay.h) for offline runs.
+
+struct z_stream_s;
+
+// Inflates a gzip stream, which may consist of several members, a piece at a time.
+class GzipDecoder {
+    public:
+        GzipDecoder ();
+        ~GzipDecoder ();
+        // Appends what data decompresses to to out. Returns false if the data is corrupt.
+        bool decode (const QByteArray& data, QByteArray& out);
+        // Whether the data so far ends on the end of a member, i.e. isn't cut off.
+        bool atEnd () const { return streamEnded; }
+        const QString& errorString () const { return error; }
+    private:
+        QScopedPointer<z_stream_s> stream;
+        bool streamEnded = false;
+        QString error;
+};
+
+// Every report from the feed, with each station's reports indexed.
+struct FeedData {
+    QDateTime loadedAt;
+    MetarColumns metars;
+    TafRecords tafs;
+    QHash<QString, QVector<int>> metarRows;  // station -> rows in metars, newest first
+    QHash<QString, QVector<int>> tafReports; // station -> reports in tafs, newest first
+    QVector<int> tafForecastBegin;           // first forecast of each report, plus the end of the last one
+
+    // Builds the station indexes, once metars and tafs are filled in.
+    void index ();
+    bool contains (const QString& station) const;
+    // One station's reports, for MetarModel::setMetars and ForecastModel::setTafs:
+    MetarColumns stationMetars (const QString& station) const;
+    TafRecords stationTafs (const QString& station) const;
+};
+
+// Decompresses one feed file as it arrives and parses its records in chunks on the global thread pool.
+class FeedIngest {
+    public:
+        static const int chunkSize = 512 * 1024; // decompressed bytes per parsing job
+
+        FeedIngest (bool tafs);
+        // Returns false once the file turns out to be corrupt.
+        bool append (const QByteArray& compressed);
+        // Parses whatever's left. Returns false if the file is corrupt or cut off.
+        bool finish ();
+        // Waits for the parsing jobs and appends their records to data, in file order.
+        void mergeInto (FeedData& data);
+        const QString& errorString () const { return error; }
+    private:
+        void dispatch (bool all);
+
+        bool tafs;
+        GzipDecoder decoder;
+        QByteArray text; // decompressed but not handed out yet
+        QList<QFuture<MetarColumns>> metarChunks;
+        QList<QFuture<TafRecords>> tafChunks;
+        bool failed = false;
+        QString error;
+};
+
+// Downloads both feed files through a RequestCoordinator, every refreshInterval seconds.
+class WeatherFeed : public QObject {
+    Q_OBJECT
+    public:
+        WeatherFeed (RequestCoordinator* requestCoordinator, QObject* parent = nullptr);
+        void setUrls (const QUrl& metarUrl, const QUrl& tafUrl);
+        // 0 to only refresh when refresh() is called.
+        void setRefreshInterval (int seconds);
+        void refresh ();
+        bool isRefreshing () const { return refreshing; }
+        // The last complete download; empty until the first refresh is done.
+        QSharedPointer<const FeedData> data () const { return current; }
+    signals:
+        void refreshed (bool ok);
+    private:
+        void requestsFinished (const QVector<RequestResult>& results, QSharedPointer<FeedIngest> metarIngest,
+            QSharedPointer<FeedIngest> tafIngest);
+
+        RequestCoordinator* requestCoordinator;
+        QUrl metarUrl;
+        QUrl tafUrl;
+        QTimer* timer;
+        CancellationToken refreshToken;
+        bool refreshing = false;
+        QFutureWatcher<QSharedPointer<const FeedData>>* merge;
+        QSharedPointer<const FeedData> current;
+};
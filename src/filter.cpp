@@ -0,0 +1,255 @@
+#include "filter.h"
+#include "trace.h"
+#include <QtCore/QRegularExpression>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+// Keys
+
+template <typename T>
+static void copyKeys (const QVector<T>& values, int begin, int end, double* keys) {
+    // Derived columns can be shorter than the others until derive() has run:
+    int known = qMax(begin, qMin(end, values.size()));
+    for (int row = begin; row < known; row++) {
+        keys[row - begin] = double(values[row]);
+    }
+    std::fill(keys + (known - begin), keys + (end - begin), std::numeric_limits<double>::quiet_NaN());
+}
+
+void MetarSortKeys (const MetarColumns& columns, int column, int begin, int end, double* keys) {
+    switch (column) {
+        case MetarTime:          copyKeys(columns.observationTime, begin, end, keys); return;
+        case MetarTemperature:   copyKeys(columns.tempC, begin, end, keys); return;
+        case MetarDewpoint:      copyKeys(columns.dewpointC, begin, end, keys); return;
+        case MetarWindDirection: copyKeys(columns.windDirDeg, begin, end, keys); return;
+        case MetarWindSpeed:     copyKeys(columns.windSpeedKt, begin, end, keys); return;
+        case MetarVisibility:    copyKeys(columns.visibilityMi, begin, end, keys); return;
+        case MetarSky:           copyKeys(columns.ceilingFt, begin, end, keys); return;
+        case MetarHumidity:      copyKeys(columns.humidityPct, begin, end, keys); return;
+        case MetarSpread:        copyKeys(columns.spreadC, begin, end, keys); return;
+        case MetarHeadwind:      copyKeys(columns.headwindKt, begin, end, keys); return;
+        case MetarCrosswind:
+            copyKeys(columns.crosswindKt, begin, end, keys);
+            for (int i = 0; i < end - begin; i++) {
+                keys[i] = qAbs(keys[i]);
+            }
+            return;
+        case MetarFlightCategory:
+            copyKeys(columns.flightCategory, begin, end, keys);
+            for (int i = 0; i < end - begin; i++) {
+                if (keys[i] == double(FlightCategory::Unknown)) keys[i] = std::numeric_limits<double>::quiet_NaN();
+            }
+            return;
+    }
+    std::fill(keys, keys + (end - begin), std::numeric_limits<double>::quiet_NaN());
+}
+
+
+
+// MetarFilter
+
+static const struct {
+    const char* name;
+    int column;
+} filterColumns[] = {
+    { "temp",       MetarTemperature },
+    { "dewpoint",   MetarDewpoint },
+    { "dew",        MetarDewpoint },
+    { "direction",  MetarWindDirection },
+    { "dir",        MetarWindDirection },
+    { "wind",       MetarWindSpeed },
+    { "speed",      MetarWindSpeed },
+    { "visibility", MetarVisibility },
+    { "vis",        MetarVisibility },
+    { "ceiling",    MetarSky },
+    { "category",   MetarFlightCategory },
+    { "cat",        MetarFlightCategory },
+    { "humidity",   MetarHumidity },
+    { "rh",         MetarHumidity },
+    { "spread",     MetarSpread },
+    { "headwind",   MetarHeadwind },
+    { "crosswind",  MetarCrosswind },
+};
+
+static int filterColumn (const QString& name) {
+    // A column can be given by any of its names, or the start of a longer one ("temperature", "visib"):
+    for (const auto& column: filterColumns) {
+        if (name == column.name) return column.column;
+    }
+    for (const auto& column: filterColumns) {
+        QString full (column.name);
+        if (full.size() > 3 && (name.startsWith(full) || full.startsWith(name))) return column.column;
+    }
+    return -1;
+}
+
+bool MetarFilter::parse (const QString& text, MetarFilter& filter, QString* error) {
+    static const QRegularExpression separator ("\\s+and\\s+|\\s*(?:&&|,)\\s*",
+        QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression condition ("^([a-z]+)\\s*(<=|>=|!=|==|=|<|>)\\s*(-?\\d+(?:\\.\\d+)?|[a-z]+)"
+        "\\s*[a-z°%]*$", QRegularExpression::CaseInsensitiveOption);
+
+    MetarFilter parsed;
+    for (const QString& part: text.trimmed().split(separator, QString::SkipEmptyParts)) {
+        QRegularExpressionMatch match = condition.match(part.trimmed());
+        if (!match.hasMatch()) {
+            if (error != nullptr) *error = QString("can't read \"%1\"").arg(part.trimmed());
+            return false;
+        }
+        MetarCondition c;
+        c.column = filterColumn(match.captured(1).toLower());
+        if (c.column < 0) {
+            if (error != nullptr) *error = QString("unknown column \"%1\"").arg(match.captured(1));
+            return false;
+        }
+
+        QString op = match.captured(2);
+        if (op == "<")       c.op = CompareOp::Less;
+        else if (op == "<=") c.op = CompareOp::LessEqual;
+        else if (op == ">")  c.op = CompareOp::Greater;
+        else if (op == ">=") c.op = CompareOp::GreaterEqual;
+        else if (op == "!=") c.op = CompareOp::NotEqual;
+        else                 c.op = CompareOp::Equal;
+
+        // Categories go from VFR to LIFR, so e.g. "cat >= IFR" is IFR or worse:
+        QString value = match.captured(3).toUpper();
+        bool ok;
+        c.value = value.toDouble(&ok);
+        if (!ok && c.column == MetarFlightCategory) {
+            ok = true;
+            if (value == "VFR")       c.value = double(FlightCategory::VFR);
+            else if (value == "MVFR") c.value = double(FlightCategory::MVFR);
+            else if (value == "IFR")  c.value = double(FlightCategory::IFR);
+            else if (value == "LIFR") c.value = double(FlightCategory::LIFR);
+            else ok = false;
+        }
+        if (!ok) {
+            if (error != nullptr) *error = QString("\"%1\" isn't a value for %2").arg(match.captured(3),
+                match.captured(1));
+            return false;
+        }
+        parsed.conditions.append(c);
+    }
+    filter = parsed;
+    return true;
+}
+
+template <typename Compare>
+static void matchKeys (const double* keys, int count, double value, quint8* mask, Compare compare) {
+    // A branch-free loop over plain arrays, which compilers vectorise. NaN compares false, so rows without a value
+    // never match.
+    for (int i = 0; i < count; i++) {
+        mask[i] &= quint8(compare(keys[i], value));
+    }
+}
+
+void MetarFilter::match (const MetarColumns& columns, int begin, int end, quint8* mask) const {
+    int count = end - begin;
+    std::fill(mask, mask + count, quint8(1));
+    QVector<double> keys (count);
+    for (const MetarCondition& c: conditions) {
+        MetarSortKeys(columns, c.column, begin, end, keys.data());
+        const double* k = keys.constData();
+        switch (c.op) {
+            case CompareOp::Less:         matchKeys(k, count, c.value, mask, std::less<double>()); break;
+            case CompareOp::LessEqual:    matchKeys(k, count, c.value, mask, std::less_equal<double>()); break;
+            case CompareOp::Greater:      matchKeys(k, count, c.value, mask, std::greater<double>()); break;
+            case CompareOp::GreaterEqual: matchKeys(k, count, c.value, mask, std::greater_equal<double>()); break;
+            case CompareOp::Equal:        matchKeys(k, count, c.value, mask, std::equal_to<double>()); break;
+            case CompareOp::NotEqual:
+                matchKeys(k, count, c.value, mask, [] (double a, double b) { return a < b || a > b; });
+                break;
+        }
+    }
+}
+
+
+
+// MetarSortFilterModel
+
+MetarSortFilterModel::MetarSortFilterModel (QObject* parent) : QSortFilterProxyModel(parent) {}
+
+void MetarSortFilterModel::setMetarModel (QAbstractItemModel* model, MetarRowSource* rows) {
+    this->rows = rows;
+    keyCache = Cache();
+    filterCache = Cache();
+    setSourceModel(model);
+}
+
+void MetarSortFilterModel::setFilter (const MetarFilter& filter) {
+    TRACE_SPAN("ui", "filter METARs");
+    metarFilter = filter;
+    filterCache = Cache();
+    if (rows != nullptr) rows->showAllRows(sortColumn() >= 0 || !metarFilter.isEmpty());
+    invalidateFilter();
+}
+
+void MetarSortFilterModel::sort (int column, Qt::SortOrder order) {
+    TRACE_SPAN("ui", "sort METARs");
+    if (rows != nullptr) rows->showAllRows(column >= 0 || !metarFilter.isEmpty());
+    QSortFilterProxyModel::sort(column, order);
+}
+
+void MetarSortFilterModel::validate (Cache& cache, int column) const {
+    const MetarColumns* store = rows->metarStore();
+    quint32 generation = rows->metarGeneration();
+    if (cache.store == store && cache.generation == generation && cache.column == column) return;
+    cache = Cache();
+    cache.store = store;
+    cache.generation = generation;
+    cache.column = column;
+}
+
+double MetarSortFilterModel::sortKey (int sourceRow, int column) const {
+    int metarRow;
+    const MetarColumns* store = rows->metarAt(sourceRow, metarRow);
+    if (store == nullptr) return std::numeric_limits<double>::quiet_NaN();
+    if (store != rows->metarStore()) {
+        // A row that's on its way out, see DiffingTableModel::applyDiff:
+        double key;
+        MetarSortKeys(*store, column, metarRow, metarRow + 1, &key);
+        return key;
+    }
+    validate(keyCache, column);
+    int known = keyCache.keys.size();
+    if (metarRow >= known) {
+        keyCache.keys.resize(store->count());
+        MetarSortKeys(*store, column, known, store->count(), keyCache.keys.data() + known);
+    }
+    return keyCache.keys[metarRow];
+}
+
+bool MetarSortFilterModel::matches (int sourceRow) const {
+    int metarRow;
+    const MetarColumns* store = rows->metarAt(sourceRow, metarRow);
+    if (store == nullptr) return false;
+    if (store != rows->metarStore()) {
+        quint8 match;
+        metarFilter.match(*store, metarRow, metarRow + 1, &match);
+        return match != 0;
+    }
+    validate(filterCache, -1);
+    int known = filterCache.matches.size();
+    if (metarRow >= known) {
+        filterCache.matches.resize(store->count());
+        metarFilter.match(*store, known, store->count(), filterCache.matches.data() + known);
+    }
+    return filterCache.matches[metarRow] != 0;
+}
+
+bool MetarSortFilterModel::lessThan (const QModelIndex& left, const QModelIndex& right) const {
+    int column = rows != nullptr ? rows->metarColumn(left.column()) : -1;
+    if (column < 0 || column == MetarRawText) return QSortFilterProxyModel::lessThan(left, right);
+    double a = sortKey(left.row(), column);
+    double b = sortKey(right.row(), column);
+    // Rows without a value go last, whichever way round they're sorted:
+    bool aMissing = qIsNaN(a), bMissing = qIsNaN(b);
+    if (aMissing || bMissing) return aMissing != bMissing && aMissing != (sortOrder() == Qt::AscendingOrder);
+    return a < b;
+}
+
+bool MetarSortFilterModel::filterAcceptsRow (int sourceRow, const QModelIndex& sourceParent) const {
+    if (metarFilter.isEmpty() || rows == nullptr) return true;
+    return matches(sourceRow);
+}
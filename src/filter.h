@@ -0,0 +1,76 @@
+#pragma once
+#include <QtCore/QSortFilterProxyModel>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include "data.h"
+
+// Sorting and filtering of the tables that show METARs (MetarModel and WatchlistModel, see MetarRowSource), on the
+// typed columns of MetarColumns. The display text has units in it ("12°C", "5 kt"), so it would sort as text, and
+// parsing it back for every comparison would be slow.
+
+// Sort keys for rows [begin, end) of a MetarColumn, as doubles, NaN where the value is missing. The crosswind is
+// keyed by its strength, whichever side it's from, and the sky condition by the ceiling. The raw text has no keys.
+void MetarSortKeys (const MetarColumns& columns, int column, int begin, int end, double* keys);
+
+enum class CompareOp : quint8 { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+struct MetarCondition {
+    int column; // MetarColumn
+    CompareOp op;
+    double value;
+};
+
+// Rows that meet all of a list of conditions, e.g. "wind > 25 kt and vis < 3 mi" or "cat >= IFR, crosswind > 15".
+// Rows that are missing a value don't meet any condition on it.
+class MetarFilter {
+    public:
+        // Parses conditions joined by "and", "&&" or commas. Each is a column name (temp, dewpoint, dir, wind, vis,
+        // ceiling, category, humidity, spread, headwind or crosswind, or a longer form of these), a comparison and a
+        // number. Units after the number are ignored, and categories can be given by name. An empty text gives an
+        // empty filter, which every row passes.
+        static bool parse (const QString& text, MetarFilter& filter, QString* error = nullptr);
+        bool isEmpty () const { return conditions.isEmpty(); }
+        // Sets mask[i] to whether row begin + i matches, for rows [begin, end). Works a condition at a time, over
+        // the keys of its column, rather than a row at a time.
+        void match (const MetarColumns& columns, int begin, int end, quint8* mask) const;
+
+        QVector<MetarCondition> conditions;
+};
+
+// Sorts and filters a MetarRowSource. The sort keys of the sort column and the filter matches are worked out for the
+// whole of the source's metarStore at once and cached, so sorting only compares doubles, and filtering a row is a
+// lookup. As rows are appended to the store, the caches are extended to them; when its rows change (metarGeneration),
+// the caches start over.
+// Columns that aren't from a METAR sort by their text. While the rows are sorted or filtered, the source shows all of
+// them rather than a page at a time (see MetarRowSource::showAllRows), as only sorting what's been paged in would be
+// misleading.
+class MetarSortFilterModel : public QSortFilterProxyModel {
+    Q_OBJECT
+    public:
+        MetarSortFilterModel (QObject* parent = nullptr);
+        // model and rows are the same object, as a model and as a MetarRowSource.
+        void setMetarModel (QAbstractItemModel* model, MetarRowSource* rows);
+        void setFilter (const MetarFilter& filter);
+        const MetarFilter& filter () const { return metarFilter; }
+        void sort (int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    protected:
+        bool lessThan (const QModelIndex& left, const QModelIndex& right) const override;
+        bool filterAcceptsRow (int sourceRow, const QModelIndex& sourceParent) const override;
+    private:
+        struct Cache {
+            const MetarColumns* store = nullptr;
+            quint32 generation = 0;
+            int column = -1;
+            QVector<double> keys;
+            QVector<quint8> matches;
+        };
+
+        double sortKey (int sourceRow, int column) const;
+        bool matches (int sourceRow) const;
+        void validate (Cache& cache, int column) const;
+
+        MetarRowSource* rows = nullptr;
+        MetarFilter metarFilter;
+        mutable Cache keyCache;
+        mutable Cache filterCache;
+};
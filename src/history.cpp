@@ -0,0 +1,458 @@
+// On-disk history of fetched METARs and TAFs, see history.h.
+//
+// Segment layout (native byte order):
+//   SegmentHeader
+//   records, each a RecordHeader followed by `size` bytes of payload
+//
+// METAR payload:
+//   HistoryMetar
+//   HistorySkyLayer[skyCount]
+//   char[rawLength]             raw_text, UTF-8
+//
+// TAF payload:
+//   HistoryTaf
+//   char[rawLength]             raw_text, UTF-8
+//   forecastCount times:
+//     HistoryForecast
+//     wxCount times: quint8 length, char[length] (UTF-8)
+//     HistorySkyLayer[skyCount]
+//
+// A crash can leave a partly written record at the end of a segment. It fails validation when the segment is
+// indexed and is overwritten by the next append.
+#include "history.h"
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRegularExpression>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+static const char segmentMagic[8] = { 'W', 'T', 'H', 'I', 'S', 'T', 'R', 'Y' };
+static const quint32 segmentVersion = 1;
+static const quint32 segmentByteOrder = 0x01020304;
+static const int blockSize = 64; // records per sparse index entry
+
+struct SegmentHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+};
+static_assert(sizeof(SegmentHeader) == 16, "SegmentHeader must not contain padding");
+
+struct RecordHeader {
+    quint32 size;     // of the payload
+    quint32 checksum; // FNV-1a of the payload
+    qint64 time;      // observation time (METAR) or issue time (TAF)
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must not contain padding");
+
+struct HistoryMetar {
+    float tempC;
+    float dewpointC;
+    float windDirDeg;
+    float windSpeedKt;
+    float visibilityMi;
+    quint16 rawLength;
+    quint8 skyCount;
+    quint8 reserved;
+};
+static_assert(sizeof(HistoryMetar) == 24, "HistoryMetar must not contain padding");
+
+struct HistorySkyLayer {
+    char cover[8];     // NUL-padded
+    char cloudType[4]; // NUL-padded
+    qint32 baseFt;
+};
+static_assert(sizeof(HistorySkyLayer) == 16, "HistorySkyLayer must not contain padding");
+
+struct HistoryTaf {
+    quint16 rawLength;
+    quint16 forecastCount;
+};
+
+struct HistoryForecast {
+    qint64 from;
+    qint64 to;
+    quint8 changeIndicator;
+    quint8 probability;
+    quint8 wxCount;
+    quint8 skyCount;
+    quint32 reserved;
+};
+static_assert(sizeof(HistoryForecast) == 24, "HistoryForecast must not contain padding");
+
+static quint32 checksum (const char* data, qint64 size) {
+    quint32 hash = 2166136261u;
+    for (qint64 i = 0; i < size; i++) {
+        hash ^= quint8(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void appendStruct (QByteArray& payload, const T& value) {
+    payload.append(reinterpret_cast<const char*>(&value), int(sizeof(T)));
+}
+
+// Reads a T at p and advances p, unless that would go past end.
+template <typename T>
+static bool readStruct (const char*& p, const char* end, T& value) {
+    if (end - p < qint64(sizeof(T))) return false;
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static void copyPadded (char* target, int size, const QString& text) {
+    QByteArray bytes = text.toLatin1();
+    memset(target, 0, size_t(size));
+    memcpy(target, bytes.constData(), size_t(qMin(size, bytes.size())));
+}
+
+static QString readPadded (const char* source, int size) {
+    return QString::fromLatin1(source, int(qstrnlen(source, uint(size))));
+}
+
+static HistorySkyLayer skyLayer (const QString& cover, int baseFt, const QString& cloudType) {
+    HistorySkyLayer layer;
+    copyPadded(layer.cover, sizeof(layer.cover), cover);
+    copyPadded(layer.cloudType, sizeof(layer.cloudType), cloudType);
+    layer.baseFt = baseFt;
+    return layer;
+}
+
+// Station IDs become directory names, so only accept what a station ID can actually look like:
+static bool validStation (const QString& station) {
+    static const QRegularExpression pattern ("^[A-Z0-9]{3,8}$");
+    return pattern.match(station).hasMatch();
+}
+
+
+
+// HistoryStore
+
+HistoryStore::HistoryStore(const QString& directory) : root(directory) {}
+
+QString HistoryStore::segmentPath(const QString& station, Kind kind, qint64 time) const {
+    QDate date = QDateTime::fromSecsSinceEpoch(time, Qt::UTC).date();
+    return QString("%1/%2/%3-%4-%5.seg").arg(root, station, kind == Metars ? "metars" : "tafs")
+        .arg(date.year()).arg(date.month(), 2, 10, QChar('0'));
+}
+
+QStringList HistoryStore::stations() const {
+    return QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+}
+
+void HistoryStore::indexRecord(Segment& segment, qint64 offset, qint64 time) {
+    if (segment.blocks.isEmpty() || segment.blocks.last().count == blockSize) {
+        Block block;
+        block.offset = offset;
+        block.minTime = time;
+        block.maxTime = time;
+        segment.blocks.append(block);
+    }
+    Block& block = segment.blocks.last();
+    block.count++;
+    block.minTime = qMin(block.minTime, time);
+    block.maxTime = qMax(block.maxTime, time);
+    segment.times.insert(time);
+}
+
+HistoryStore::Segment& HistoryStore::segment(const QString& path) {
+    Segment& segment = segments[path];
+    if (segment.loaded) return segment;
+    segment.loaded = true;
+
+    QFile file (path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(SegmentHeader))) return segment;
+    const uchar* data = file.map(0, file.size());
+    if (data == nullptr) return segment;
+    const char* begin = reinterpret_cast<const char*>(data);
+    const char* end = begin + file.size();
+
+    const SegmentHeader* header = reinterpret_cast<const SegmentHeader*>(begin);
+    if (memcmp(header->magic, segmentMagic, sizeof(header->magic)) != 0 || header->version != segmentVersion
+        || header->byteOrder != segmentByteOrder) {
+        cerr << "HistoryStore: " << path.toStdString() << " isn't a segment we can read, starting it over" << endl;
+        return segment;
+    }
+
+    // Walk the record headers, stopping at the first one that doesn't check out (a torn write):
+    const char* p = begin + sizeof(SegmentHeader);
+    RecordHeader record;
+    while (readStruct(p, end, record)) {
+        if (end - p < qint64(record.size) || checksum(p, record.size) != record.checksum) break;
+        indexRecord(segment, qint64(p - begin) - qint64(sizeof(RecordHeader)), record.time);
+        p += record.size;
+        segment.size = qint64(p - begin);
+    }
+    if (segment.size == 0) segment.size = sizeof(SegmentHeader);
+    return segment;
+}
+
+bool HistoryStore::append(const QString& path, const QVector<qint64>& times, const QVector<QByteArray>& payloads) {
+    Segment& target = segment(path);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file (path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        cerr << "HistoryStore: can't write " << path.toStdString() << endl;
+        return false;
+    }
+
+    QByteArray data;
+    if (target.size == 0) {
+        // New (or unreadable) segment, start it over:
+        SegmentHeader header;
+        memcpy(header.magic, segmentMagic, sizeof(header.magic));
+        header.version = segmentVersion;
+        header.byteOrder = segmentByteOrder;
+        appendStruct(data, header);
+        target.size = sizeof(SegmentHeader);
+        target.blocks.clear();
+        target.times.clear();
+        file.resize(0);
+    } else if (file.size() != target.size) {
+        file.resize(target.size); // drop a torn record
+    }
+
+    qint64 offset = target.size;
+    for (int i = 0; i < payloads.size(); i++) {
+        RecordHeader record;
+        record.size = quint32(payloads[i].size());
+        record.checksum = checksum(payloads[i].constData(), payloads[i].size());
+        record.time = times[i];
+        appendStruct(data, record);
+        data.append(payloads[i]);
+        indexRecord(target, offset, times[i]);
+        offset += qint64(sizeof(RecordHeader)) + payloads[i].size();
+    }
+
+    file.seek(file.size());
+    if (file.write(data) != data.size()) {
+        // Forget what we know about this segment, it'll be re-read (and the partial write dropped) next time:
+        segments.remove(path);
+        return false;
+    }
+    target.size = offset;
+    return true;
+}
+
+template <typename Visit>
+void HistoryStore::query(const QString& station, Kind kind, qint64 from, qint64 to, Visit visit) {
+    if (!validStation(station) || from >= to) return;
+
+    // One segment per month, from the month of `from` to the month of the last second before `to`:
+    QDate month = QDateTime::fromSecsSinceEpoch(from, Qt::UTC).date();
+    month = QDate(month.year(), month.month(), 1);
+    QDate last = QDateTime::fromSecsSinceEpoch(to - 1, Qt::UTC).date();
+    QVector<Match> matches;
+    QList<QSharedPointer<QFile>> files;
+    QVector<const char*> bases;
+    for (; month <= last; month = month.addMonths(1)) {
+        qint64 monthStart = QDateTime(month, QTime(0, 0), Qt::UTC).toSecsSinceEpoch();
+        QString path = segmentPath(station, kind, monthStart);
+        const Segment& s = segment(path);
+        if (s.blocks.isEmpty()) continue;
+
+        QSharedPointer<QFile> file (new QFile(path));
+        if (!file->open(QIODevice::ReadOnly) || file->size() < s.size) continue;
+        const uchar* data = file->map(0, s.size);
+        if (data == nullptr) continue;
+        const char* base = reinterpret_cast<const char*>(data);
+
+        // Only blocks whose time range overlaps the query are read:
+        for (const Block& block: s.blocks) {
+            if (block.maxTime < from || block.minTime >= to) continue;
+            const char* p = base + block.offset;
+            for (int i = 0; i < block.count; i++) {
+                RecordHeader record;
+                memcpy(&record, p, sizeof(record));
+                if (record.time >= from && record.time < to) {
+                    qint64 offset = qint64(p - base) + qint64(sizeof(RecordHeader));
+                    matches.append(Match { record.time, bases.size(), offset, record.size });
+                }
+                p += sizeof(RecordHeader) + record.size;
+            }
+        }
+        files.append(file);
+        bases.append(base);
+    }
+
+    std::sort(matches.begin(), matches.end(), [] (const Match& a, const Match& b) { return a.time > b.time; });
+    for (const Match& match: matches) {
+        visit(match.time, bases[match.segment] + match.offset, match.size);
+    }
+}
+
+int HistoryStore::addMetars(const MetarColumns& c) {
+    QHash<QString, QVector<qint64>> times;
+    QHash<QString, QVector<QByteArray>> payloads;
+    for (int row = 0; row < c.count(); row++) {
+        const QString& station = c.stations.value(c.station[row]);
+        qint64 time = c.observationTime[row];
+        if (!validStation(station) || time <= 0) continue;
+        QString path = segmentPath(station, Metars, time);
+        if (segment(path).times.contains(time) || times[path].contains(time)) continue;
+
+        QByteArray raw = c.raw(row).toUtf8().left(0xFFFF);
+        HistoryMetar metar;
+        metar.tempC = c.tempC[row];
+        metar.dewpointC = c.dewpointC[row];
+        metar.windDirDeg = c.windDirDeg[row];
+        metar.windSpeedKt = c.windSpeedKt[row];
+        metar.visibilityMi = c.visibilityMi[row];
+        metar.rawLength = quint16(raw.size());
+        metar.skyCount = c.skyCount[row];
+        metar.reserved = 0;
+
+        QByteArray payload;
+        appendStruct(payload, metar);
+        for (quint32 i = c.skyFirst[row]; i < c.skyFirst[row] + c.skyCount[row]; i++) {
+            appendStruct(payload, skyLayer(c.skyCovers[c.skyCover[i]], c.skyBaseFt[i], QString()));
+        }
+        payload.append(raw);
+        times[path].append(time);
+        payloads[path].append(payload);
+    }
+
+    int written = 0;
+    for (auto it = payloads.constBegin(); it != payloads.constEnd(); ++it) {
+        if (append(it.key(), times[it.key()], it.value())) written += it.value().size();
+    }
+    return written;
+}
+
+int HistoryStore::addTafs(const TafRecords& records) {
+    // Forecasts are stored with their report, so group them first:
+    QVector<QVector<const TafForecast*>> forecasts (records.reports.size());
+    for (const TafForecast& forecast: records.forecasts) {
+        if (forecast.report >= 0 && forecast.report < forecasts.size()) forecasts[forecast.report].append(&forecast);
+    }
+
+    QHash<QString, QVector<qint64>> times;
+    QHash<QString, QVector<QByteArray>> payloads;
+    for (int report = 0; report < records.reports.size(); report++) {
+        const TafReport& r = records.reports[report];
+        qint64 time = r.issueTime.toSecsSinceEpoch();
+        if (!validStation(r.stationId) || !r.issueTime.isValid()) continue;
+        QString path = segmentPath(r.stationId, Tafs, time);
+        if (segment(path).times.contains(time) || times[path].contains(time)) continue;
+
+        QByteArray raw = r.rawText.toUtf8().left(0xFFFF);
+        HistoryTaf taf;
+        taf.rawLength = quint16(raw.size());
+        taf.forecastCount = quint16(qMin(forecasts[report].size(), 0xFFFF));
+
+        QByteArray payload;
+        appendStruct(payload, taf);
+        payload.append(raw);
+        for (int i = 0; i < taf.forecastCount; i++) {
+            const TafForecast& f = *forecasts[report][i];
+            HistoryForecast forecast;
+            forecast.from = f.from.isValid() ? f.from.toSecsSinceEpoch() : 0;
+            forecast.to = f.to.isValid() ? f.to.toSecsSinceEpoch() : 0;
+            forecast.changeIndicator = quint8(f.changeIndicator);
+            forecast.probability = quint8(f.probability);
+            forecast.wxCount = quint8(qMin(f.wxStrings.size(), 0xFF));
+            forecast.skyCount = quint8(qMin(f.skyLayers.size(), 0xFF));
+            forecast.reserved = 0;
+            appendStruct(payload, forecast);
+            for (int w = 0; w < forecast.wxCount; w++) {
+                QByteArray wx = f.wxStrings[w].toUtf8().left(0xFF);
+                payload.append(char(quint8(wx.size())));
+                payload.append(wx);
+            }
+            for (int l = 0; l < forecast.skyCount; l++) {
+                const SkyLayer& layer = f.skyLayers[l];
+                appendStruct(payload, skyLayer(layer.cover, layer.baseFt, layer.cloudType));
+            }
+        }
+        times[path].append(time);
+        payloads[path].append(payload);
+    }
+
+    int written = 0;
+    for (auto it = payloads.constBegin(); it != payloads.constEnd(); ++it) {
+        if (append(it.key(), times[it.key()], it.value())) written += it.value().size();
+    }
+    return written;
+}
+
+void HistoryStore::readMetars(const QString& station, qint64 from, qint64 to, MetarColumns& c) {
+    quint16 stationId = c.internStation(QStringRef(&station));
+    query(station, Metars, from, to, [&c, stationId] (qint64 time, const char* p, quint32 size) {
+        const char* end = p + size;
+        HistoryMetar metar;
+        if (!readStruct(p, end, metar)) return;
+        if (end - p < qint64(metar.skyCount) * qint64(sizeof(HistorySkyLayer)) + metar.rawLength) return;
+
+        int row = c.appendRow();
+        c.station[row] = stationId;
+        c.observationTime[row] = time;
+        c.tempC[row] = metar.tempC;
+        c.dewpointC[row] = metar.dewpointC;
+        c.windDirDeg[row] = metar.windDirDeg;
+        c.windSpeedKt[row] = metar.windSpeedKt;
+        c.visibilityMi[row] = metar.visibilityMi;
+        for (int i = 0; i < metar.skyCount; i++) {
+            HistorySkyLayer layer;
+            readStruct(p, end, layer);
+            QString cover = readPadded(layer.cover, sizeof(layer.cover));
+            c.skyCover.append(c.internSkyCover(QStringRef(&cover)));
+            c.skyBaseFt.append(layer.baseFt);
+            c.skyCount[row]++;
+        }
+        QString raw = QString::fromUtf8(p, metar.rawLength);
+        c.rawText.append(raw);
+        c.rawLength[row] = quint32(raw.size());
+    });
+    c.derive();
+}
+
+void HistoryStore::readTafs(const QString& station, qint64 from, qint64 to, TafRecords& records) {
+    query(station, Tafs, from, to, [&records, &station] (qint64 time, const char* p, quint32 size) {
+        const char* end = p + size;
+        HistoryTaf taf;
+        if (!readStruct(p, end, taf) || end - p < taf.rawLength) return;
+
+        TafReport report;
+        report.stationId = station;
+        report.issueTime = QDateTime::fromSecsSinceEpoch(time, Qt::UTC);
+        report.rawText = QString::fromUtf8(p, taf.rawLength);
+        p += taf.rawLength;
+
+        QVector<TafForecast> forecasts;
+        for (int i = 0; i < taf.forecastCount; i++) {
+            HistoryForecast forecast;
+            if (!readStruct(p, end, forecast)) return;
+            TafForecast f;
+            f.report = records.reports.size();
+            if (forecast.from != 0) f.from = QDateTime::fromSecsSinceEpoch(forecast.from, Qt::UTC);
+            if (forecast.to != 0) f.to = QDateTime::fromSecsSinceEpoch(forecast.to, Qt::UTC);
+            f.changeIndicator = ChangeIndicator(forecast.changeIndicator);
+            f.probability = forecast.probability;
+            for (int w = 0; w < forecast.wxCount; w++) {
+                quint8 length;
+                if (!readStruct(p, end, length) || end - p < length) return;
+                f.wxStrings.append(QString::fromUtf8(p, length));
+                p += length;
+            }
+            for (int l = 0; l < forecast.skyCount; l++) {
+                HistorySkyLayer layer;
+                if (!readStruct(p, end, layer)) return;
+                SkyLayer sky;
+                sky.cover = readPadded(layer.cover, sizeof(layer.cover));
+                sky.cloudType = readPadded(layer.cloudType, sizeof(layer.cloudType));
+                sky.baseFt = layer.baseFt;
+                f.skyLayers.append(sky);
+            }
+            forecasts.append(f);
+        }
+        records.reports.append(report);
+        records.forecasts += forecasts;
+    });
+}
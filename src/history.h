@@ -0,0 +1,64 @@
+#pragma once
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+#include "data.h"
+
+// Every METAR and TAF the application has fetched, kept on disk so older data can be looked at without the
+// dataserver (which only goes back a few days).
+//
+// Reports are appended to one segment file per station, kind and month, e.g. history/LROP/metars-2018-09.seg, and
+// never rewritten. A report already in the store (same station and observation/issue time) isn't added again.
+// For each segment that's been touched, a sparse index of the record times (one entry per block of records) and the
+// set of stored times are kept in memory; the records themselves are only read for queries.
+class HistoryStore {
+    public:
+        HistoryStore(const QString& directory);
+        const QString& directory() const { return root; }
+
+        // Adds the reports that aren't stored yet, returns how many were written.
+        int addMetars(const MetarColumns& columns);
+        int addTafs(const TafRecords& records);
+
+        // Appends the station's reports with from <= time < to (seconds since the Unix epoch), newest first like
+        // dataserver responses. TAFs are selected by issue time.
+        void readMetars(const QString& station, qint64 from, qint64 to, MetarColumns& columns);
+        void readTafs(const QString& station, qint64 from, qint64 to, TafRecords& records);
+
+        QStringList stations() const;
+    private:
+        enum Kind { Metars, Tafs };
+
+        struct Block {
+            qint64 offset;  // of the first record in the file
+            int count = 0;
+            qint64 minTime;
+            qint64 maxTime;
+        };
+        struct Segment {
+            bool loaded = false;
+            qint64 size = 0;       // end of the last valid record, where the next one goes
+            QVector<Block> blocks;
+            QSet<qint64> times;
+        };
+        // A record found by a query: its time and where its payload is.
+        struct Match {
+            qint64 time;
+            int segment;   // index into the segments mapped by the query
+            qint64 offset;
+            quint32 size;
+        };
+
+        QString segmentPath(const QString& station, Kind kind, qint64 time) const;
+        Segment& segment(const QString& path);
+        void indexRecord(Segment& segment, qint64 offset, qint64 time);
+        bool append(const QString& path, const QVector<qint64>& times, const QVector<QByteArray>& payloads);
+        // Calls visit(time, payload, size) for the station's records in [from, to), newest first.
+        template <typename Visit>
+        void query(const QString& station, Kind kind, qint64 from, qint64 to, Visit visit);
+
+        QString root;
+        QHash<QString, Segment> segments; // by path
+};
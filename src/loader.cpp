@@ -0,0 +1,75 @@
+#include "loader.h"
+#include "trace.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
+#include <QtConcurrent/QtConcurrent>
+
+QVector<QPair<int, int>> SplitAirportsCSV (const QByteArray& csvFile, int chunkCount) {
+    QVector<QPair<int, int>> chunks;
+    const char* data = csvFile.constData();
+    int size = csvFile.size();
+    int targetSize = qMax(1, size / qMax(1, chunkCount));
+
+    // Only split on line breaks outside of quotes. Doubled quotes flip the state twice, so they cancel out.
+    int begin = 0;
+    bool quoted = false;
+    for (int i = 0; i < size; i++) {
+        if (data[i] == '"') {
+            quoted = !quoted;
+        } else if (data[i] == '\n' && !quoted && i + 1 - begin >= targetSize) {
+            chunks.append(qMakePair(begin, i + 1));
+            begin = i + 1;
+        }
+    }
+    if (begin < size) chunks.append(qMakePair(begin, size));
+    return chunks;
+}
+
+// Map functor for QtConcurrent::blockingMapped.
+struct ParseAirportsChunk {
+    typedef AirportEntries result_type;
+
+    const QByteArray* csvFile;
+    AirportDataLoader* loader;
+    QAtomicInt* chunksDone;
+    int chunkCount;
+
+    AirportEntries operator() (const QPair<int, int>& chunk) const {
+        TRACE_SPAN("airports", "parse CSV chunk");
+        AirportEntries entries;
+        ParseAirportsCSV(csvFile->constData() + chunk.first, csvFile->constData() + chunk.second, entries);
+        emit loader->progress(chunksDone->fetchAndAddOrdered(1) + 1, chunkCount);
+        return entries;
+    }
+};
+
+AirportDataLoader::AirportDataLoader(QObject* parent) : QObject(parent) {
+    qRegisterMetaType<QSharedPointer<AirportData>>();
+}
+
+AirportDataLoader::~AirportDataLoader() {
+    task.waitForFinished();
+}
+
+void AirportDataLoader::start(QByteArray csvFile, QString snapshotPath) {
+    task = QtConcurrent::run([this, csvFile, snapshotPath] () {
+        TRACE_SPAN("airports", "load airport data");
+        // A few chunks per thread, so a slow chunk doesn't hold up the others and progress moves smoothly:
+        auto chunks = SplitAirportsCSV(csvFile, QThread::idealThreadCount() * 4);
+        QAtomicInt chunksDone (0);
+        ParseAirportsChunk parse { &csvFile, this, &chunksDone, chunks.size() };
+        auto parts = QtConcurrent::blockingMapped<QList<AirportEntries>>(chunks, parse);
+
+        // Merging adds the strings again, so cities and countries end up interned across chunks:
+        auto data = QSharedPointer<AirportData>::create();
+        data->entries.reserve(csvFile.count('\n'));
+        for (const auto& part: parts) {
+            data->entries.append(part);
+        }
+        data->entries.squeeze();
+        data->searchIndex.build(data->entries);
+        data->spatialIndex.build(data->entries);
+        bool snapshotWritten = data->writeSnapshot(snapshotPath);
+        emit loaded(data, snapshotWritten);
+    });
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QFuture>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+#include "data.h"
+
+Q_DECLARE_METATYPE(QSharedPointer<AirportData>)
+
+// Splits a CSV file into roughly chunkCount [begin, end) byte ranges that start and end on record boundaries.
+QVector<QPair<int, int>> SplitAirportsCSV (const QByteArray& csvFile, int chunkCount);
+
+// Parses airports.dat on the global thread pool, so the GUI stays responsive while the airports load. The file is
+// split into chunks that are parsed in parallel and merged in file order, after which the search index is built and
+// the snapshot is written. The signals are emitted from worker threads and reach the GUI thread as queued calls.
+class AirportDataLoader : public QObject {
+    Q_OBJECT
+    public:
+        AirportDataLoader(QObject* parent = nullptr);
+        // Waits for a load that's still running, as it emits the signals through the loader.
+        ~AirportDataLoader();
+        void start(QByteArray csvFile, QString snapshotPath);
+    signals:
+        void progress(int chunksDone, int chunkCount);
+        void loaded(QSharedPointer<AirportData> data, bool snapshotWritten);
+    private:
+        QFuture<void> task;
+};
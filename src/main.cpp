@@ -1,6 +1,12 @@
 #include "main.h"
 #include "util.h"
+#include "dataserver.h"
+#include "batch.h"
+#include "standin.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 using namespace std;
 
@@ -10,7 +16,67 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     setWindowTitle(qApp->applicationDisplayName());
     resize(900, 700);
 
-    networkAccessManager = new QNetworkAccessManager();
+    networkAccessManager = new ReplayNetworkAccessManager();
+
+    // Point the requests somewhere else (e.g. a local stand-in, see standin.h) and record or replay the responses
+    // (see replay.h) if configured, for repeatable timing runs:
+    SetDataserverBaseUrl(gSettings->value("network/dataserverUrl", DataserverBaseUrl()).toUrl());
+    SetAirportDataUrl(gSettings->value("network/airportDataUrl", AirportDataUrl()).toUrl());
+    QString networkMode = gSettings->value("network/mode").toString();
+    if (networkMode == "record" || networkMode == "replay") {
+        NetworkConditions conditions;
+        conditions.latency = gSettings->value("network/replayLatency", 0).toInt();
+        conditions.jitter = gSettings->value("network/replayJitter", 0).toInt();
+        conditions.bandwidth = gSettings->value("network/replayBandwidth", 0).toLongLong();
+        conditions.errorRate = gSettings->value("network/replayErrorRate", 0.0).toDouble();
+        networkAccessManager->setConditions(conditions);
+        auto mode = networkMode == "record" ? ReplayNetworkAccessManager::Mode::Record
+                                            : ReplayNetworkAccessManager::Mode::Replay;
+        QString recordings = QFileInfo(gSettings->fileName()).absoluteDir().filePath("recordings");
+        networkAccessManager->setMode(mode, gSettings->value("network/recordings", recordings).toString());
+    }
+
+    // Cache weather responses on disk, next to the settings file:
+    weatherCache = new WeatherCache();
+    weatherCache->setCacheDirectory(QFileInfo(gSettings->fileName()).absoluteDir().filePath("cache"));
+    weatherCache->setMaximumCacheSize(gSettings->value("cache/maxSize", 16 * 1024 * 1024).toLongLong());
+    weatherCache->setTimeToLive("metars", gSettings->value("cache/metarTTL", 10 * 60).toInt());
+    weatherCache->setTimeToLive("tafs", gSettings->value("cache/tafTTL", 30 * 60).toInt());
+    networkAccessManager->setCache(weatherCache);
+
+    // Keep every report we fetch, so older data can be paged through later:
+    historyStore = new HistoryStore(QFileInfo(gSettings->fileName()).absoluteDir().filePath("history"));
+
+    requestCoordinator = new RequestCoordinator(networkAccessManager, this);
+    requestCoordinator->setMaxConnectionsPerHost(gSettings->value("network/maxConnectionsPerHost", 4).toInt());
+    requestCoordinator->setMaxRetries(gSettings->value("network/maxRetries", 2).toInt());
+
+    // Responses are decoded on the thread pool, see decoder.h:
+    weatherDecoder = new WeatherDecoder(this);
+
+    // In feed mode, lookups are answered from the dataserver's all-stations files (see feed.h), downloaded every
+    // few minutes, instead of asking about each station:
+    if (gSettings->value("feed/enabled", false).toBool()) {
+        weatherFeed = new WeatherFeed(requestCoordinator, this);
+        weatherFeed->setUrls(gSettings->value("feed/metarUrl", DataserverFeedUrl("metars")).toUrl(),
+            gSettings->value("feed/tafUrl", DataserverFeedUrl("tafs")).toUrl());
+        weatherFeed->setRefreshInterval(gSettings->value("feed/refreshInterval", 5 * 60).toInt());
+        connect(weatherFeed, &WeatherFeed::refreshed, this, &MainWindow::weatherFeedRefreshed);
+        weatherFeed->refresh();
+    }
+
+    // Otherwise, refresh the stations on screen whenever they have new reports due (see scheduler.h):
+    if (weatherFeed == nullptr && gSettings->value("refresh/enabled", true).toBool()) {
+        refreshScheduler = new RefreshScheduler(requestCoordinator, weatherDecoder, this);
+        refreshScheduler->setBatchSize(gSettings->value("watchlist/batchSize", 25).toInt());
+        refreshScheduler->setJitter(gSettings->value("refresh/jitter", 60).toInt());
+        refreshScheduler->setSpeciInterval(gSettings->value("refresh/speciInterval", 15 * 60).toInt());
+        connect(refreshScheduler, &RefreshScheduler::refreshed, this, &MainWindow::scheduledRefreshFinished);
+    }
+
+    airportDataLoader = new AirportDataLoader(this);
+    connect(airportDataLoader, &AirportDataLoader::progress, this, &MainWindow::airportDataLoadProgress);
+    connect(airportDataLoader, &AirportDataLoader::loaded,   this, &MainWindow::airportDataLoaded);
 
     // Add status bar:
     setStatusBar(new QStatusBar(this));
@@ -38,11 +104,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
         // searchEdit->setTextMargins(4, 4, 4, 4);
         mainLayout->addWidget(searchEdit);
 
-        // Set up completion:
+        // Set up completion. Matching and ranking are done by AirportCompletionModel, which is refreshed on every
+        // edit, so the completer just shows whatever the model contains:
+        searchCompletionModel = new AirportCompletionModel();
         searchCompleter = new QCompleter();
-        searchCompleter->setCaseSensitivity(Qt::CaseInsensitive);
-        searchCompleter->setFilterMode(Qt::MatchContains);
+        searchCompleter->setCompletionMode(QCompleter::UnfilteredPopupCompletion);
         searchCompleter->setCompletionRole(Qt::DisplayRole);
+        searchCompleter->setModel(searchCompletionModel);
         searchEdit->setCompleter(searchCompleter);
 
         // Add results frame and layout (hidden by default):
@@ -60,9 +128,15 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
             resultsLayout->addWidget(forecastGroupBox, 1);
             forecastLayout = new QVBoxLayout();
             forecastGroupBox->setLayout(forecastLayout);
+            forecastSortModel = new QSortFilterProxyModel(this);
+            forecastSortModel->setSourceModel(&forecastModel);
+            forecastSortModel->setSortRole(ForecastModel::SortRole);
             forecastTable = new QTableView();
             forecastTable->setCornerButtonEnabled(false);
             forecastTable->setSelectionMode(QAbstractItemView::SelectionMode::NoSelection);
+            // Sortable by clicking the headers, but unsorted to begin with:
+            forecastTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+            forecastTable->setSortingEnabled(true);
             forecastLayout->addWidget(forecastTable);
 
             // Add METAR group box, layout and table view:
@@ -70,35 +144,224 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
             resultsLayout->addWidget(metarGroupBox, 2);
             metarLayout = new QVBoxLayout();
             metarGroupBox->setLayout(metarLayout);
+            metarSortModel = new MetarSortFilterModel(this);
+            metarSortModel->setMetarModel(&metarModel, &metarModel);
+            metarFilterEdit = new QLineEdit();
+            metarFilterEdit->setPlaceholderText(tr("Filter, e.g. wind > 25 kt and vis < 3 mi"));
+            metarFilterEdit->setClearButtonEnabled(true);
+            metarLayout->addWidget(metarFilterEdit);
             metarTable = new QTableView();
             metarTable->setCornerButtonEnabled(false);
             metarTable->setSelectionMode(QAbstractItemView::SelectionMode::NoSelection);
+            metarTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+            metarTable->setSortingEnabled(true);
             metarLayout->addWidget(metarTable);
 
+            // Watch for the tables' first paint after a lookup, see eventFilter:
+            forecastTable->viewport()->installEventFilter(this);
+            metarTable->viewport()->installEventFilter(this);
+
+            // Add buttons for paging through the stored history, a week at a time:
+            historyButtonLayout = new QHBoxLayout();
+            metarLayout->addLayout(historyButtonLayout);
+            historyOlderButton = new QPushButton(tr("Older"));
+            historyButtonLayout->addWidget(historyOlderButton);
+            historyNewerButton = new QPushButton(tr("Newer"));
+            historyNewerButton->setEnabled(false);
+            historyButtonLayout->addWidget(historyNewerButton);
+            historyButtonLayout->addStretch();
+
+            // Add the runway for the headwind and crosswind columns, by its number (heading / 10):
+            runwayLabel = new QLabel(tr("Runway"));
+            historyButtonLayout->addWidget(runwayLabel);
+            runwayBox = new QSpinBox();
+            runwayBox->setRange(0, 36);
+            runwayBox->setSpecialValueText(tr("None"));
+            historyButtonLayout->addWidget(runwayBox);
+
         // Stretch the layout, to ensure the search box is on top:
         mainLayout->addStretch();
 
+    // Add watchlist dock, with the summary table and its buttons:
+    watchlistModel = new WatchlistModel(requestCoordinator, weatherDecoder, this);
+    watchlistModel->setBatchSize(gSettings->value("watchlist/batchSize", 25).toInt());
+    watchlistModel->setStations(gSettings->value("watchlist/stations").toStringList());
+    watchlistDock = new QDockWidget(tr("Watchlist"), this);
+    watchlistDock->setObjectName("watchlistDock");
+    addDockWidget(Qt::BottomDockWidgetArea, watchlistDock);
+    watchlistDock->setWidget(new QWidget());
+    watchlistLayout = new QVBoxLayout();
+    watchlistDock->widget()->setLayout(watchlistLayout);
+        watchlistFilterEdit = new QLineEdit();
+        watchlistFilterEdit->setPlaceholderText(tr("Filter, e.g. cat >= IFR, crosswind > 15"));
+        watchlistFilterEdit->setClearButtonEnabled(true);
+        watchlistLayout->addWidget(watchlistFilterEdit);
+
+        watchlistSortModel = new MetarSortFilterModel(this);
+        watchlistSortModel->setMetarModel(watchlistModel, watchlistModel);
+        watchlistTable = new QTableView();
+        watchlistTable->setModel(watchlistSortModel);
+        watchlistTable->setCornerButtonEnabled(false);
+        watchlistTable->setSelectionMode(QAbstractItemView::SelectionMode::SingleSelection);
+        watchlistTable->setSelectionBehavior(QAbstractItemView::SelectionBehavior::SelectRows);
+        watchlistTable->verticalHeader()->hide();
+        watchlistTable->horizontalHeader()->setMinimumSectionSize(50);
+        watchlistTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+        watchlistTable->setSortingEnabled(true);
+        FitColumns(watchlistTable, true);
+        watchlistLayout->addWidget(watchlistTable);
+
+        watchlistButtonLayout = new QHBoxLayout();
+        watchlistLayout->addLayout(watchlistButtonLayout);
+        watchlistAddButton = new QPushButton(tr("Add current airport"));
+        watchlistAddButton->setEnabled(false);
+        watchlistButtonLayout->addWidget(watchlistAddButton);
+        watchlistRemoveButton = new QPushButton(tr("Remove"));
+        watchlistButtonLayout->addWidget(watchlistRemoveButton);
+        watchlistButtonLayout->addStretch();
+        watchlistRefreshButton = new QPushButton(tr("Refresh"));
+        watchlistButtonLayout->addWidget(watchlistRefreshButton);
+
+    // Add nearby stations dock, with the latest weather of the stations around the searched airport. They're all
+    // fetched in one batch, so the batch size is the maximum number of stations:
+    nearbyMaxStations = qMax(1, gSettings->value("nearby/maxStations", 25).toInt());
+    nearbyModel = new WatchlistModel(requestCoordinator, weatherDecoder, this);
+    nearbyModel->setBatchSize(nearbyMaxStations);
+    nearbyDock = new QDockWidget(tr("Nearby stations"), this);
+    nearbyDock->setObjectName("nearbyDock");
+    addDockWidget(Qt::BottomDockWidgetArea, nearbyDock);
+    tabifyDockWidget(watchlistDock, nearbyDock);
+    watchlistDock->raise();
+    nearbyDock->setWidget(new QWidget());
+    nearbyLayout = new QVBoxLayout();
+    nearbyDock->widget()->setLayout(nearbyLayout);
+        nearbyRadiusLayout = new QHBoxLayout();
+        nearbyLayout->addLayout(nearbyRadiusLayout);
+        nearbyRadiusLabel = new QLabel(tr("Within"));
+        nearbyRadiusLayout->addWidget(nearbyRadiusLabel);
+        nearbyRadiusBox = new QSpinBox();
+        nearbyRadiusBox->setRange(5, 1000);
+        nearbyRadiusBox->setSingleStep(10);
+        nearbyRadiusBox->setSuffix(tr(" nm"));
+        nearbyRadiusBox->setKeyboardTracking(false);
+        nearbyRadiusBox->setValue(gSettings->value("nearby/radiusNm", 50).toInt());
+        nearbyRadiusLayout->addWidget(nearbyRadiusBox);
+        nearbyRadiusLayout->addStretch();
+
+        nearbySortModel = new MetarSortFilterModel(this);
+        nearbySortModel->setMetarModel(nearbyModel, nearbyModel);
+        nearbyTable = new QTableView();
+        nearbyTable->setModel(nearbySortModel);
+        nearbyTable->setCornerButtonEnabled(false);
+        nearbyTable->setSelectionMode(QAbstractItemView::SelectionMode::SingleSelection);
+        nearbyTable->setSelectionBehavior(QAbstractItemView::SelectionBehavior::SelectRows);
+        nearbyTable->verticalHeader()->hide();
+        nearbyTable->horizontalHeader()->setMinimumSectionSize(50);
+        nearbyTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+        nearbyTable->setSortingEnabled(true);
+        FitColumns(nearbyTable, true);
+        nearbyLayout->addWidget(nearbyTable);
+
+    // Add debug menu, for recording performance traces (see trace.h) and checking on the weather cache:
+    debugMenu = menuBar()->addMenu(tr("&Debug"));
+    traceAction = debugMenu->addAction(tr("Record performance trace"));
+    traceAction->setCheckable(true);
+    traceAction->setChecked(TraceEnabled());
+    saveTraceAction = debugMenu->addAction(tr("Save trace..."));
+    debugMenu->addSeparator();
+    cacheStatsAction = debugMenu->addAction(tr("Show cache statistics"));
+
     // Hook up the search box and completer:
     connect(searchEdit,      &QLineEdit::returnPressed, this, &MainWindow::searchSubmitted);
+    connect(searchEdit,      &QLineEdit::textEdited,    this, &MainWindow::searchTextEdited);
     connect(searchCompleter, QOverload<const QString &>::of(&QCompleter::activated),
             this, &MainWindow::completionActivated);
 
+    // Hook up the debug menu:
+    connect(traceAction,     &QAction::toggled,   this, [] (bool checked) { SetTraceEnabled(checked); });
+    connect(saveTraceAction, &QAction::triggered, this, &MainWindow::saveTraceClicked);
+    connect(cacheStatsAction, &QAction::triggered, this, [this] () {
+        const WeatherCache::Stats& stats = weatherCache->stats();
+        statusBar()->showMessage(tr("Weather cache: %1 fresh, %2 stale, %3 missed, %4 revalidated.")
+            .arg(stats.fresh).arg(stats.stale).arg(stats.misses).arg(stats.revalidated));
+    });
+
+    // Hook up the history buttons:
+    connect(historyOlderButton, &QPushButton::clicked, this, &MainWindow::historyOlderClicked);
+    connect(historyNewerButton, &QPushButton::clicked, this, &MainWindow::historyNewerClicked);
+
+    // Hook up the runway box:
+    connect(runwayBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this] (int runway) {
+        metarModel.setRunwayHeading(runway == 0 ? qQNaN() : runway * 10.0f);
+    });
+
+    // Hook up the table filters and sorting:
+    connect(metarFilterEdit, &QLineEdit::textChanged, this, [this] () {
+        applyFilter(metarFilterEdit, metarSortModel);
+    });
+    connect(watchlistFilterEdit, &QLineEdit::textChanged, this, [this] () {
+        applyFilter(watchlistFilterEdit, watchlistSortModel);
+    });
+    connect(forecastTable->horizontalHeader(), &QHeaderView::sortIndicatorChanged, this, [this] (int section) {
+        // Like MetarSortFilterModel, sort all the forecasts rather than the ones that have been paged in. Paging
+        // comes back on when the sort is cleared, which happens whenever other forecasts are shown:
+        forecastModel.setPaged(section < 0);
+    });
+
+    // Hook up the watchlist:
+    connect(watchlistAddButton,     &QPushButton::clicked,            this, &MainWindow::watchlistAddClicked);
+    connect(watchlistRemoveButton,  &QPushButton::clicked,            this, &MainWindow::watchlistRemoveClicked);
+    connect(watchlistRefreshButton, &QPushButton::clicked,            this, &MainWindow::watchlistRefresh);
+    connect(watchlistTable,         &QTableView::activated,           this, &MainWindow::watchlistActivated);
+    connect(watchlistModel,         &WatchlistModel::refreshFinished, this, &MainWindow::watchlistRefreshFinished);
+    connect(watchlistModel,         &WatchlistModel::stationsChanged, this, [this] (const QStringList& stations) {
+        gSettings->setValue("watchlist/stations", stations);
+        if (refreshScheduler != nullptr) refreshScheduler->setStations(RefreshScheduler::Watchlist, stations);
+    });
+    if (refreshScheduler != nullptr) {
+        refreshScheduler->setStations(RefreshScheduler::Watchlist, watchlistModel->stations());
+    }
+
+    // Hook up the nearby stations:
+    connect(nearbyRadiusBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this] (int radius) {
+        gSettings->setValue("nearby/radiusNm", radius);
+        nearbyUpdate();
+    });
+    connect(nearbyTable, &QTableView::activated,           this, &MainWindow::nearbyActivated);
+    connect(nearbyModel, &WatchlistModel::refreshFinished, this, &MainWindow::nearbyRefreshFinished);
+
     getAirportData();
 }
 
+// The airport snapshot lives next to the settings file.
+static QString airportSnapshotPath() {
+    return QFileInfo(gSettings->fileName()).absoluteDir().filePath("airports.snapshot");
+}
+
 void MainWindow::getAirportData() {
+    TRACE_SPAN("airports", "getAirportData");
     // Display loading message and set progress bar to indefinite mode:
     statusBar()->showMessage(tr("Loading airport data..."));
     progressBar->show();
     progressBar->setMaximum(0);
 
-    // Load the airport data if already downloaded:
+    // Load the airport data snapshot if we already have one:
+    AirportData snapshot;
+    if (snapshot.readSnapshot(airportSnapshotPath())) {
+        auto model = new AirportNameModel();
+        model->setAirports(snapshot);
+        configureSearch(model);
+        return;
+    }
+
     if (gSettings->contains("airportData")) {
-        configureSearch(gSettings->value("airportData").toByteArray());
+        // Older versions stored the whole CSV file in the settings, convert that instead of downloading it again:
+        loadAirportData(gSettings->value("airportData").toByteArray());
     } else {
         // Get the airport data file from OpenFlights:
         QNetworkRequest request;
-        request.setUrl(QUrl("https://raw.githubusercontent.com/jpatokal/openflights/master/data/airports.dat"));
+        request.setUrl(AirportDataUrl());
+        request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false); // we have the snapshot for this
         airportDataReply = networkAccessManager->get(request);
         connect(airportDataReply, &QNetworkReply::downloadProgress, this, &MainWindow::airportDataRequestProgress);
         connect(airportDataReply, &QNetworkReply::finished,         this, &MainWindow::airportDataRequestFinished);
@@ -122,145 +385,582 @@ void MainWindow::airportDataRequestFinished() {
             tr("Couldn't download airport data.\nQNetworkReply error code: %1")
             .arg(airportDataReply->error()));
     } else {
-        configureSearch(airportDataReply->readAll());
+        loadAirportData(airportDataReply->readAll());
     }
 
     airportDataReply->deleteLater();
     airportDataReply = nullptr;
 }
 
-void MainWindow::configureSearch(QByteArray airportDataCSV) {
-    progressBar->hide();
+void MainWindow::loadAirportData(QByteArray airportDataCSV) {
+    // Parsing happens on worker threads, see airportDataLoadProgress and airportDataLoaded:
+    statusBar()->showMessage(tr("Processing airport data..."));
+    progressBar->setMaximum(0); // indefinite until the first chunk is done
+    progressBar->show();
+    airportDataLoader->start(airportDataCSV, airportSnapshotPath());
+}
+
+void MainWindow::airportDataLoadProgress(int chunksDone, int chunkCount) {
+    progressBar->setMaximum(chunkCount);
+    progressBar->setValue(chunksDone);
+}
+
+void MainWindow::airportDataLoaded(QSharedPointer<AirportData> data, bool snapshotWritten) {
+    // Don't keep the old copy of the CSV file around once the snapshot is saved:
+    if (snapshotWritten) {
+        gSettings->remove("airportData");
+    } else {
+        cerr << "airportDataLoaded: couldn't write " << airportSnapshotPath().toStdString() << endl;
+    }
+
+    auto model = new AirportNameModel();
+    model->setAirports(*data);
+    configureSearch(model);
+}
 
-    // Create an AirportNameModel and read the DAT file:
+void MainWindow::configureSearch(AirportNameModel* model) {
+    TRACE_SPAN("airports", "configureSearch");
+    // Replace the current AirportNameModel, if any:
+    searchCompletionModel->setSource(nullptr);
     if (airportNameModel != nullptr) {
         delete airportNameModel;
     }
-    airportNameModel = new AirportNameModel();
-    airportNameModel->readData(airportDataCSV);
+    airportNameModel = model;
+    nearbyCenter = -1;
 
     // Update the status bar:
     progressBar->hide();
     statusBar()->showMessage(tr("Ready"));
 
     // Enable completion:
-    searchCompleter->setModel(airportNameModel);
+    searchCompletionModel->setSource(airportNameModel);
 
     // Enable the search box:
     searchEdit->setEnabled(true);
     searchEdit->setFocus();
 
-    // Save the data for a later launch if everything went OK:
-    gSettings->setValue("airportData", QVariant(airportDataCSV));
+    // Fetch the watchlist now rather than in the constructor, so it doesn't compete with the airport data download:
+    watchlistRefresh();
+}
+
+void MainWindow::watchlistAddClicked() {
+    if (weatherRequestsAirportCode.isEmpty()) return;
+    watchlistModel->addStation(weatherRequestsAirportCode);
+    watchlistRefresh();
+}
+
+void MainWindow::watchlistRemoveClicked() {
+    QModelIndex current = watchlistTable->currentIndex();
+    if (!current.isValid()) return;
+    watchlistModel->removeStation(watchlistModel->stations().value(watchlistSortModel->mapToSource(current).row()));
+}
+
+void MainWindow::watchlistRefresh() {
+    if (watchlistModel->stations().isEmpty()) return;
+    statusBar()->showMessage(tr("Refreshing watchlist (%n station(s))...", "", watchlistModel->stations().size()));
+    watchlistModel->refresh();
+}
+
+void MainWindow::watchlistRefreshFinished(bool ok) {
+    if (ok) {
+        storeReports(watchlistModel->metarData(), watchlistModel->tafData());
+        FitColumns(watchlistTable, true);
+        statusBar()->showMessage(tr("Watchlist updated."));
+    } else {
+        statusBar()->showMessage(tr("Failed to update the watchlist."));
+    }
+}
+
+void MainWindow::watchlistActivated(const QModelIndex& index) {
+    // Show the full TAF and METAR history of the station:
+    searchEdit->setText(watchlistModel->stations().value(watchlistSortModel->mapToSource(index).row()));
+    searchSubmitted();
+}
+
+void MainWindow::applyFilter(QLineEdit* edit, MetarSortFilterModel* model) {
+    // Filtering is quick (see filter.h), so it's applied as the filter is typed. Until the text makes sense, e.g. in
+    // the middle of typing a condition, the last filter that did stays, and the edit's tooltip says what's wrong.
+    MetarFilter filter;
+    QString error;
+    if (!MetarFilter::parse(edit->text(), filter, &error)) {
+        edit->setToolTip(tr("Filter: %1").arg(error));
+        return;
+    }
+    edit->setToolTip(QString());
+    model->setFilter(filter);
+}
+
+void MainWindow::nearbyUpdate() {
+    if (airportNameModel == nullptr || nearbyCenter < 0) return;
+    // This is a spatial index lookup (see spatial.h), quick enough to redo whenever the radius changes:
+    QStringList stations;
+    for (int row: airportNameModel->nearby(nearbyCenter, nearbyRadiusBox->value(), nearbyMaxStations)) {
+        stations.append(airportNameModel->airports().entries.icao(row).toString());
+    }
+    nearbyDock->setWindowTitle(tr("Nearby stations (%1)").arg(stations.size()));
+    nearbyModel->setStations(stations);
+    if (refreshScheduler != nullptr) refreshScheduler->setStations(RefreshScheduler::Nearby, stations);
+    nearbyModel->refresh();
+}
+
+void MainWindow::nearbyRefreshFinished(bool ok) {
+    if (ok) {
+        storeReports(nearbyModel->metarData(), nearbyModel->tafData());
+        FitColumns(nearbyTable, true);
+    } else {
+        statusBar()->showMessage(tr("Failed to get the weather for the nearby stations."));
+    }
+}
+
+void MainWindow::nearbyActivated(const QModelIndex& index) {
+    // Make that station the searched airport, which moves the nearby stations along with it:
+    searchEdit->setText(nearbyModel->stations().value(nearbySortModel->mapToSource(index).row()));
+    searchSubmitted();
+}
+
+void MainWindow::searchTextEdited(const QString& text) {
+    searchCompletionModel->setQuery(text);
+    if (searchCompletionModel->rowCount() > 0) {
+        searchCompleter->complete();
+    } else {
+        searchCompleter->popup()->hide();
+    }
 }
 
 void MainWindow::completionActivated(const QString& text) {
     // This can, e.g. when selecting a completion with the keyboard and pressing Enter, cause searchSubmitted
-    // to be called twice, so requests are aborted and retried. Fortunately, this doesn't seem to be an issue.
+    // to be called twice. The second call joins the requests started by the first, see searchSubmitted.
     searchEdit->returnPressed();
 }
 
 void MainWindow::searchSubmitted() {
-    // We basically reimplement what QCompleter does internally, because completions are not updated on selection.
-    // e.g. if you type "Bucharest" and click on the entry for LROP, the completion will get stuck on LRBS.
+    TRACE_SPAN("weather", "searchSubmitted");
+    // Look the text up again instead of relying on QCompleter's current completion, which isn't updated on
+    // selection. Picking an entry from the popup puts its full text in the search box, which ranks first.
     QString searchText = searchEdit->text();
-    if (searchText.isEmpty()) return;
-    auto results = airportNameModel->match(airportNameModel->index(0,0), Qt::DisplayRole, QVariant(searchText), 1,
-        Qt::MatchContains);
-    if (results.length() <= 0) return;
-    QString airportCode = airportNameModel->data(results.first(), Qt::EditRole).toString();
-    QString airportText = airportNameModel->data(results.first(), Qt::DisplayRole).toString();
+    if (searchText.isEmpty() || airportNameModel == nullptr) return;
+    auto results = airportNameModel->search(searchText, 1);
+    if (results.isEmpty()) return;
+    QModelIndex result = airportNameModel->index(results.first(), 0);
+    QString airportCode = airportNameModel->data(result, Qt::EditRole).toString();
+    QString airportText = airportNameModel->data(result, Qt::DisplayRole).toString();
 
     // Write this into the search bar, so the user can see what airport they picked:
     searchEdit->setText(airportText);
     searchEdit->selectAll();
 
-    // Do we have a pending network request? If yes, cancel it.
-    if (weatherTAFReply != nullptr) {
-        weatherTAFReply->abort();
-        weatherTAFReply->deleteLater();
+    // Whatever we were fetching before is no longer needed. The old token is only cancelled once the new requests
+    // are registered, so if the same airport is submitted twice in a row (e.g. through completionActivated), the new
+    // search joins the requests that are already in flight instead of restarting them.
+    CancellationToken previousToken = weatherToken;
+    weatherToken = CancellationToken();
+
+    // Refreshing the same airport updates the tables in place; another airport starts them over:
+    if (airportCode != weatherRequestsAirportCode) {
+        forecastTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+        forecastModel.clear();
+        metarModel.clear();
+        FitColumns(forecastTable, true);
+        FitColumns(metarTable, true);
     }
-    if (weatherMETARReply != nullptr) {
-        weatherMETARReply->abort();
-        weatherMETARReply->deleteLater();
+    weatherRequestsAirportCode = airportCode;
+    if (refreshScheduler != nullptr) refreshScheduler->setStations(RefreshScheduler::Displayed, { airportCode });
+    if (results.first() != nearbyCenter) {
+        nearbyCenter = results.first();
+        nearbyUpdate();
+    }
+    historyEnd = 0;
+    forecastGroupBox->setTitle(tr("Forecast (TAF)"));
+    metarGroupBox->setTitle(tr("Weather reports (METAR)"));
+    historyNewerButton->setEnabled(false);
+    QUrl tafUrl = DataserverTAFUrl(airportCode);
+    QUrl metarUrl = DataserverMETARUrl(airportCode);
+    lookupStart = TraceNow();
+    lookupModelTime = 0;
+    lookupShownAt = 0;
+
+    // In feed mode, the last all-stations download has everything, so there's nothing to wait for:
+    if (weatherFeed != nullptr && weatherFeed->data()->contains(airportCode)) {
+        previousToken.cancel();
+        auto feed = weatherFeed->data();
+        TafRecords tafs = feed->stationTafs(airportCode);
+        MetarColumns metars = feed->stationMetars(airportCode);
+        forecastModel.setTafs(tafs);
+        metarModel.setMetars(metars);
+        storeReports(metars, tafs);
+        showWeatherTables();
+        progressBar->hide();
+        statusBar()->showMessage(tr("Weather data loaded for %1 (feed of %2).")
+            .arg(airportCode, feed->loadedAt.toString(Qt::ISODate)));
+        watchlistAddButton->setEnabled(true);
+        lookupSummary = tr("Weather data loaded for %1 from the feed in %2 ms").arg(airportCode);
+        lookupShownAt = TraceNow();
+        return;
     }
 
-    // Start network requests:
-    weatherRequestsAirportCode = airportCode;
-    weatherTAFRequestDidFinish = false;
-    weatherMETARRequestDidFinish = false;
-    weatherRequestsDidFail = false;
+    // Show cached data right away if we have it, and don't bother the server at all if it's still fresh:
+    QByteArray cachedTAF, cachedMETAR;
+    auto tafLookup = weatherCache->lookup(tafUrl, &cachedTAF);
+    auto metarLookup = weatherCache->lookup(metarUrl, &cachedMETAR);
+    if (tafLookup != WeatherCache::Lookup::Miss && metarLookup != WeatherCache::Lookup::Miss) {
+        bool fresh = tafLookup == WeatherCache::Lookup::Fresh && metarLookup == WeatherCache::Lookup::Fresh;
+        int tafStream, metarStream;
+        openWeatherStreams(tafStream, metarStream);
+        finishWeatherStreams(tafStream, metarStream, cachedTAF, cachedMETAR, [this, airportCode, fresh] (bool) {
+            // If the cached data is stale, the lookup goes on until the responses are in:
+            if (!fresh) return;
+            if (refreshScheduler != nullptr) {
+                refreshScheduler->noteMetars(metarModel.metars());
+                refreshScheduler->noteTafs(forecastModel.tafs());
+            }
+            lookupSummary = tr("Weather data loaded for %1 from the cache in %2 ms").arg(airportCode);
+            lookupShownAt = TraceNow();
+        });
+
+        if (fresh) {
+            previousToken.cancel();
+            progressBar->hide();
+            statusBar()->showMessage(tr("Weather data loaded for %1 (cached).").arg(airportCode));
+            watchlistAddButton->setEnabled(true);
+            return;
+        }
+        statusBar()->showMessage(tr("Showing cached data for %1, refreshing...").arg(airportCode));
+    } else {
+        statusBar()->showMessage(tr("Retrieving data for %1...").arg(airportCode));
+    }
 
-    statusBar()->showMessage(tr("Retrieving data for %1...").arg(airportCode));
+    // Start network requests. Stale cache entries are revalidated by QNetworkAccessManager:
     progressBar->setMaximum(0); // indefinite
     progressBar->show();
 
-    QNetworkRequest tafRequest;
-    QNetworkRequest metarRequest;
-    tafRequest.setUrl(QUrl(QString(
-        "https://aviationweather.gov/adds/dataserver_current/httpparam?dataSource=tafs&requestType=retrieve"
-        "&format=xml&stationString=%1&hoursBeforeNow=24&mostRecent=true")
-        .arg(airportCode)));
-    metarRequest.setUrl(QUrl(QString(
-        "https://aviationweather.gov/adds/dataserver_current/httpparam?dataSource=metars&requestType=retrieve"
-        "&format=xml&stationString=%1&hoursBeforeNow=48"
-    ).arg(airportCode)));
-    weatherTAFReply = networkAccessManager->get(tafRequest);
-    weatherMETARReply = networkAccessManager->get(metarRequest);
-    connect(weatherTAFReply,   &QNetworkReply::finished, this, &MainWindow::weatherTAFRequestFinished);
-    connect(weatherMETARReply, &QNetworkReply::finished, this, &MainWindow::weatherMETARRequestFinished);
+    // A previous search may have been cut off halfway through its responses:
+    forecastModel.endData();
+    metarModel.endData();
+
+    // Responses are decoded on the thread pool as they download, so the first rows show up before the transfer is
+    // done (see decoder.h):
+    int tafStream, metarStream;
+    openWeatherStreams(tafStream, metarStream);
+    requestCoordinator->getAll({ tafUrl, metarUrl }, weatherToken,
+        [this, airportCode, tafStream, metarStream] (const QVector<RequestResult>& results) {
+            weatherRequestsFinished(airportCode, results[0], results[1], tafStream, metarStream);
+        },
+        [this, tafStream, metarStream] (int request, const QByteArray& data) {
+            weatherDecoder->append(request == 0 ? tafStream : metarStream, data);
+        });
+    previousToken.cancel();
+}
+
+void MainWindow::openWeatherStreams(int& tafStream, int& metarStream) {
+    tafStream = weatherDecoder->decodeTafs(weatherToken,
+        [this] (int stream, QSharedPointer<const TafRecords> batch) { tafsDecoded(stream, batch.data()); });
+    metarStream = weatherDecoder->decodeMetars(weatherToken,
+        [this] (int stream, QSharedPointer<const MetarColumns> batch) { metarsDecoded(stream, batch.data()); });
+}
+
+void MainWindow::finishWeatherStreams(int tafStream, int metarStream, const QByteArray& tafBody,
+    const QByteArray& metarBody, std::function<void(bool)> finished)
+{
+    // The tables take whatever the streams decoded once both are done. If the streams didn't decode anything, they
+    // take over the tables now, so an empty response empties them:
+    auto left = QSharedPointer<int>::create(2);
+    auto complete = QSharedPointer<bool>::create(true);
+    auto streamFinished = [left, complete, finished] (bool streamComplete) {
+        *complete = *complete && streamComplete;
+        if (--*left == 0) finished(*complete);
+    };
+    weatherDecoder->finish(tafStream, tafBody, [this, tafStream, streamFinished] (bool streamComplete) {
+        tafsDecoded(tafStream, nullptr);
+        if (tafStream == forecastTableStream) forecastModel.endData(streamComplete);
+        streamFinished(streamComplete);
+    });
+    weatherDecoder->finish(metarStream, metarBody, [this, metarStream, streamFinished] (bool streamComplete) {
+        metarsDecoded(metarStream, nullptr);
+        if (metarStream == metarTableStream) metarModel.endData(streamComplete);
+        streamFinished(streamComplete);
+    });
+}
+
+void MainWindow::tafsDecoded(int stream, const TafRecords* batch) {
+    // Streams started later, e.g. for the response after the cached data, replace the earlier ones:
+    if (stream < forecastTableStream) return;
+    qint64 start = TraceNow();
+    if (stream > forecastTableStream) {
+        forecastModel.endData();
+        forecastModel.beginData();
+        forecastTableStream = stream;
+    }
+    if (batch != nullptr) forecastModel.appendTafs(*batch);
+    lookupModelTime += TraceNow() - start;
+    showWeatherTables();
+}
+
+void MainWindow::metarsDecoded(int stream, const MetarColumns* batch) {
+    if (stream < metarTableStream) return;
+    qint64 start = TraceNow();
+    if (stream > metarTableStream) {
+        metarModel.endData();
+        metarModel.beginData();
+        metarTableStream = stream;
+    }
+    if (batch != nullptr) metarModel.appendMetars(*batch);
+    lookupModelTime += TraceNow() - start;
+    showWeatherTables();
+}
+
+// Where the time of a request went, e.g. "queued 0, connect 120, server 310, download 85 ms".
+static QString NetworkBreakdown(const RequestResult& result) {
+    auto ms = [] (qint64 from, qint64 to) { return from != 0 && to >= from ? (to - from) / 1000000 : qint64(0); };
+    qint64 connected = result.encryptedAt != 0 ? result.encryptedAt : result.startedAt;
+    qint64 headers = result.headersAt != 0 ? result.headersAt : result.finishedAt;
+    return MainWindow::tr("queued %1, connect %2, server %3, download %4 ms%5")
+        .arg(ms(result.queuedAt, result.startedAt))
+        .arg(ms(result.startedAt, result.encryptedAt))
+        .arg(ms(connected, headers))
+        .arg(ms(headers, result.finishedAt))
+        .arg(result.fromCache ? MainWindow::tr(" (from the cache)") : QString());
 }
 
-void MainWindow::weatherTAFRequestFinished() {
-    if (weatherTAFReply->error() != QNetworkReply::NoError) {
-        weatherRequestsDidFail = true;
-        cerr << "weatherTAFRequestFinished: failed with code " << weatherMETARReply->error() << endl;
+void MainWindow::weatherRequestsFinished(const QString& airportCode, const RequestResult& taf,
+    const RequestResult& metar, int tafStream, int metarStream)
+{
+    TRACE_SPAN("weather", "weatherRequestsFinished");
+    progressBar->hide();
+    for (const RequestResult* result: { &taf, &metar }) {
+        if (result->error != QNetworkReply::NoError) {
+            cerr << "weatherRequestsFinished: " << result->url.toString().toStdString() << " failed with code "
+                 << result->error << " after " << result->attempts << " attempt(s)" << endl;
+        }
     }
-    weatherTAFRequestDidFinish = true;
-    if (weatherMETARRequestDidFinish) {
-        weatherRequestsFinished();
+
+    if (taf.error != QNetworkReply::NoError || metar.error != QNetworkReply::NoError) {
+        statusBar()->showMessage(tr("Failed to retrieve weather data for %1.").arg(airportCode));
+        weatherDecoder->cancel(tafStream);
+        weatherDecoder->cancel(metarStream);
+        forecastModel.endData();
+        metarModel.endData();
+        return;
     }
+
+    // The request that finished last is the one the user waited for:
+    const RequestResult& last = taf.finishedAt > metar.finishedAt ? taf : metar;
+    QString summary = tr("Weather data loaded for %1 in %3 ms: %2").arg(airportCode, NetworkBreakdown(last));
+    finishWeatherStreams(tafStream, metarStream, taf.body, metar.body,
+        [this, airportCode, summary] (bool complete) {
+            if (!complete) {
+                statusBar()->showMessage(tr("Couldn't read the weather data for %1.").arg(airportCode));
+                return;
+            }
+            statusBar()->showMessage(tr("Weather data loaded for %1.").arg(airportCode));
+            watchlistAddButton->setEnabled(true);
+            storeReports(metarModel.metars(), forecastModel.tafs());
+            lookupSummary = summary;
+            lookupShownAt = TraceNow();
+        });
 }
 
-void MainWindow::weatherMETARRequestFinished() {
-    if (weatherMETARReply->error() != QNetworkReply::NoError) {
-        weatherRequestsDidFail = true;
-        cerr << "weatherMETARRequestFinished: failed with code " << weatherMETARReply->error() << endl;
+bool MainWindow::eventFilter(QObject* watched, QEvent* event) {
+    // The first paint of a table after a lookup's data came in ends the lookup. Everything between handing the
+    // data to the views and this point is layout.
+    if (event->type() == QEvent::Paint && lookupShownAt != 0
+        && (watched == metarTable->viewport() || watched == forecastTable->viewport()))
+    {
+        qint64 now = TraceNow();
+        TraceRecord("ui", "layout until first paint", lookupShownAt, now);
+        TraceRecord("weather", "lookup", lookupStart, now);
+        if (TraceEnabled()) {
+            statusBar()->showMessage(tr("%1, filling the tables %2 ms, layout %3 ms").arg(
+                lookupSummary.arg((now - lookupStart) / 1000000),
+                QString::number(lookupModelTime / 1000000),
+                QString::number((now - lookupShownAt) / 1000000)));
+        }
+        lookupShownAt = 0;
     }
-    weatherMETARRequestDidFinish = true;
-    if (weatherTAFRequestDidFinish) {
-        weatherRequestsFinished();
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void MainWindow::saveTraceClicked() {
+    QString path = QFileDialog::getSaveFileName(this, tr("Save trace"), "weathertool-trace.json",
+        tr("Chrome trace files (*.json)"));
+    if (path.isEmpty()) return;
+    if (SaveTrace(path)) {
+        statusBar()->showMessage(tr("Trace saved to %1.").arg(QDir::toNativeSeparators(path)));
+    } else {
+        OpenMessageBox(this, QMessageBox::Warning, tr("Error"), tr("Couldn't save the trace to %1.").arg(path));
     }
 }
 
-void MainWindow::weatherRequestsFinished() {
-    progressBar->hide();
-    if (weatherRequestsDidFail) {
-        statusBar()->showMessage(tr("Failed to retrieve weather data for %1.").arg(weatherRequestsAirportCode));
+void MainWindow::weatherFeedRefreshed(bool ok) {
+    // Don't talk over the airport data progress:
+    if (progressBar->isVisible()) return;
+    if (ok) {
+        statusBar()->showMessage(tr("Feed updated: %1 stations.").arg(weatherFeed->data()->metarRows.size()));
     } else {
-        statusBar()->showMessage(tr("Processing weather data..."));
+        statusBar()->showMessage(tr("Failed to update the feed."));
+    }
+}
 
-        forecastModel.readData(weatherTAFReply);
-        forecastTable->setModel(&forecastModel);
-        forecastTable->horizontalHeader()->setMinimumSectionSize(50);
-        forecastTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeMode::ResizeToContents);
+void MainWindow::storeReports(const MetarColumns& metars, const TafRecords& tafs) {
+    historyStore->addMetars(metars);
+    historyStore->addTafs(tafs);
+    // These count as refreshed, so the scheduler doesn't fetch them again right away:
+    if (refreshScheduler != nullptr) {
+        refreshScheduler->noteMetars(metars);
+        refreshScheduler->noteTafs(tafs);
+    }
+}
 
-        metarModel.readData(weatherMETARReply);
-        metarTable->setModel(&metarModel);
-        metarTable->horizontalHeader()->setMinimumSectionSize(50);
-        metarTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeMode::ResizeToContents);
+void MainWindow::scheduledRefreshFinished(const MetarColumns& metars, const TafRecords& tafs) {
+    historyStore->addMetars(metars);
+    historyStore->addTafs(tafs);
+    watchlistModel->mergeReports(metars, tafs);
+    nearbyModel->mergeReports(metars, tafs);
+
+    // Put new reports for the searched airport on top of its tables, unless they're showing an older page of the
+    // history or a lookup is still coming in:
+    const QString& station = weatherRequestsAirportCode;
+    if (station.isEmpty() || historyEnd != 0 || forecastModel.isReading() || metarModel.isReading()) return;
+
+    const MetarColumns& shownMetars = metarModel.metars();
+    qint64 newestObservation = 0;
+    for (int row = 0; row < shownMetars.count(); row++) {
+        newestObservation = qMax(newestObservation, shownMetars.observationTime[row]);
+    }
+    QVector<int> newRows;
+    for (int row = 0; row < metars.count(); row++) {
+        if (metars.stations[metars.station[row]] == station && metars.observationTime[row] > newestObservation) {
+            newRows.append(row);
+        }
+    }
+    std::sort(newRows.begin(), newRows.end(), [&metars] (int a, int b) {
+        return metars.observationTime[a] > metars.observationTime[b];
+    });
+
+    const TafRecords& shownTafs = forecastModel.tafs();
+    QDateTime newestIssue;
+    for (const TafReport& report: shownTafs.reports) {
+        if (!newestIssue.isValid() || report.issueTime > newestIssue) newestIssue = report.issueTime;
+    }
+    int newReport = -1;
+    for (int report = 0; report < tafs.reports.size(); report++) {
+        const TafReport& taf = tafs.reports[report];
+        if (taf.stationId != station || (newestIssue.isValid() && taf.issueTime <= newestIssue)) continue;
+        if (newReport < 0 || taf.issueTime > tafs.reports[newReport].issueTime) newReport = report;
+    }
+
+    if (newRows.isEmpty() && newReport < 0) return;
+    if (!newRows.isEmpty()) {
+        // Like a lookup, show the METARs of the last DataserverMETARHours, so they don't pile up while the window
+        // stays open:
+        qint64 oldest = QDateTime::currentSecsSinceEpoch() - qint64(DataserverMETARHours) * 3600;
+        MetarColumns merged;
+        for (int row: newRows) {
+            merged.appendRow(metars, row);
+        }
+        for (int row = 0; row < shownMetars.count(); row++) {
+            if (shownMetars.observationTime[row] >= oldest) merged.appendRow(shownMetars, row);
+        }
+        merged.derive();
+        metarModel.setMetars(merged);
+    }
+    if (newReport >= 0) {
+        // A lookup only asks for the most recent TAF, and a new one supersedes the one shown:
+        TafRecords latest;
+        latest.appendReport(tafs, newReport);
+        forecastModel.setTafs(latest);
+    }
+    showWeatherTables();
+    statusBar()->showMessage(tr("New reports for %1 at %2.")
+        .arg(station, QDateTime::currentDateTimeUtc().toString("HH:mm'Z'")));
+}
 
-        statusBar()->showMessage(tr("Weather data loaded for %1.").arg(weatherRequestsAirportCode));
-        resultsFrame->show();
+void MainWindow::changeEvent(QEvent* event) {
+    // Nobody's looking at a minimised window, so don't refresh it:
+    if (event->type() == QEvent::WindowStateChange && refreshScheduler != nullptr) {
+        refreshScheduler->setPaused(isMinimized() || !isVisible());
     }
+    QMainWindow::changeEvent(event);
+}
+
+void MainWindow::showEvent(QShowEvent* event) {
+    if (refreshScheduler != nullptr) refreshScheduler->setPaused(isMinimized());
+    QMainWindow::showEvent(event);
+}
+
+void MainWindow::hideEvent(QHideEvent* event) {
+    if (refreshScheduler != nullptr) refreshScheduler->setPaused(true);
+    QMainWindow::hideEvent(event);
+}
+
+void MainWindow::historyOlderClicked() {
+    // The first page ends now and covers more than the dataserver's 48 hours:
+    historyEnd = historyEnd == 0 ? QDateTime::currentSecsSinceEpoch() : historyEnd - historyPageLength;
+    showHistory();
+}
+
+void MainWindow::historyNewerClicked() {
+    historyEnd = qMin(historyEnd + historyPageLength, QDateTime::currentSecsSinceEpoch());
+    showHistory();
+}
+
+void MainWindow::showHistory() {
+    if (weatherRequestsAirportCode.isEmpty()) return;
+
+    // Whatever's still downloading would replace the page, and has been stored anyway if it got here before:
+    weatherToken.cancel();
+    forecastModel.endData();
+    metarModel.endData();
+    progressBar->hide();
+
+    qint64 from = historyEnd - historyPageLength;
+    forecastTable->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+    TafRecords tafs;
+    historyStore->readTafs(weatherRequestsAirportCode, from, historyEnd, tafs);
+    forecastModel.setTafs(tafs);
+    MetarColumns metars;
+    historyStore->readMetars(weatherRequestsAirportCode, from, historyEnd, metars);
+    metarModel.setMetars(metars);
+    showWeatherTables();
+
+    QString range = tr("%1 to %2").arg(
+        QDateTime::fromSecsSinceEpoch(from, Qt::UTC).toString(Qt::ISODate),
+        QDateTime::fromSecsSinceEpoch(historyEnd, Qt::UTC).toString(Qt::ISODate));
+    forecastGroupBox->setTitle(tr("Forecast (TAF), issued %1").arg(range));
+    metarGroupBox->setTitle(tr("Weather reports (METAR), %1").arg(range));
+    historyNewerButton->setEnabled(historyEnd < QDateTime::currentSecsSinceEpoch());
+    statusBar()->showMessage(tr("Showing %1 stored reports for %2.")
+        .arg(metars.count()).arg(weatherRequestsAirportCode));
+}
 
-    weatherTAFReply->deleteLater();
-    weatherMETARReply->deleteLater();
-    weatherTAFReply = nullptr;
-    weatherMETARReply = nullptr;
+void MainWindow::showWeatherTables() {
+    if (forecastTable->model() != forecastSortModel) {
+        forecastTable->setModel(forecastSortModel);
+        forecastTable->horizontalHeader()->setMinimumSectionSize(50);
+    }
+    if (metarTable->model() != metarSortModel) {
+        metarTable->setModel(metarSortModel);
+        metarTable->horizontalHeader()->setMinimumSectionSize(50);
+    }
+    // The models hand out rows a page at a time as the tables scroll (see DiffingTableModel), and the columns are
+    // sized from a sample of them, so this costs the same however many reports there are:
+    FitColumns(forecastTable);
+    FitColumns(metarTable);
+    resultsFrame->show();
 }
 
 int main(int argc, char *argv[]) {
+    InitTrace();
+
+    // Headless mode doesn't need (or want) a QApplication, so check for it before creating one:
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            int result = RunBatch(argc, argv);
+            FinishTrace();
+            return result;
+        }
+        if (strcmp(argv[i], "--serve-dataserver") == 0) return RunStandIn(argc, argv);
+    }
+
     // NOTE:
     // Qt doesn't ship OpenSSL. On Linux and macOS this isn't an issue, since they have dynamic OpenSSL libs
     // that Qt can use, but on Windows the DLLs have to be placed in the application directory manually.
@@ -280,10 +980,12 @@ int main(int argc, char *argv[]) {
     QApplication::setApplicationName("WeatherTool");
     QApplication::setApplicationDisplayName("WeatherTool");
 
-    // Don't pollute the system, store settings (just the downloaded airport data for now) locally:
+    // Don't pollute the system, store settings locally. The airport data snapshot is stored next to this file.
     gSettings = new QSettings("qsettings.ini", QSettings::IniFormat);
 
     MainWindow wndMain;
     wndMain.show();
-    return app.exec();
+    int result = app.exec();
+    FinishTrace();
+    return result;
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include <QtCore/QSettings>
+#include <QtCore/QBuffer>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkRequest>
 #include <QtNetwork/QNetworkReply>
@@ -19,8 +22,27 @@
 #include <QtWidgets/QGridLayout>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QCompleter>
+#include <QtWidgets/QDockWidget>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QSpinBox>
+#include <QtWidgets/QMenuBar>
+#include <QtWidgets/QMenu>
+#include <QtWidgets/QAction>
+#include <QtWidgets/QFileDialog>
 #include <QtXml/QDomDocument>
 #include "data.h"
+#include "loader.h"
+#include "cache.h"
+#include "requests.h"
+#include "replay.h"
+#include "history.h"
+#include "watchlist.h"
+#include "decoder.h"
+#include "feed.h"
+#include "scheduler.h"
+#include "filter.h"
 
 extern QSettings* gSettings;
 
@@ -45,15 +67,45 @@ class MainWindow : public QMainWindow {
     public:
         MainWindow(QWidget *parent = nullptr);
         void getAirportData();
-        void configureSearch(QByteArray airportDataCSV);
-        void weatherRequestsFinished();
+        void loadAirportData(QByteArray airportDataCSV);
+        void configureSearch(AirportNameModel* model);
+        void weatherRequestsFinished(const QString& airportCode, const RequestResult& taf, const RequestResult& metar,
+            int tafStream, int metarStream);
+        void openWeatherStreams(int& tafStream, int& metarStream);
+        void finishWeatherStreams(int tafStream, int metarStream, const QByteArray& tafBody,
+            const QByteArray& metarBody, std::function<void(bool)> finished);
+        void tafsDecoded(int stream, const TafRecords* batch);
+        void metarsDecoded(int stream, const MetarColumns* batch);
+        void showWeatherTables();
+        void showHistory();
+        void storeReports(const MetarColumns& metars, const TafRecords& tafs);
+        void applyFilter(QLineEdit* edit, MetarSortFilterModel* model);
+        bool eventFilter(QObject* watched, QEvent* event) override;
     public slots:
         void airportDataRequestProgress(qint64 bytesReceived, qint64 bytesTotal);
         void airportDataRequestFinished();
+        void airportDataLoadProgress(int chunksDone, int chunkCount);
+        void airportDataLoaded(QSharedPointer<AirportData> data, bool snapshotWritten);
         void searchSubmitted();
+        void searchTextEdited(const QString &text);
         void completionActivated(const QString &text);
-        void weatherTAFRequestFinished();
-        void weatherMETARRequestFinished();
+        void watchlistAddClicked();
+        void watchlistRemoveClicked();
+        void watchlistRefresh();
+        void watchlistRefreshFinished(bool ok);
+        void watchlistActivated(const QModelIndex& index);
+        void nearbyUpdate();
+        void nearbyRefreshFinished(bool ok);
+        void nearbyActivated(const QModelIndex& index);
+        void weatherFeedRefreshed(bool ok);
+        void scheduledRefreshFinished(const MetarColumns& metars, const TafRecords& tafs);
+        void historyOlderClicked();
+        void historyNewerClicked();
+        void saveTraceClicked();
+    protected:
+        void changeEvent(QEvent* event) override;
+        void showEvent(QShowEvent* event) override;
+        void hideEvent(QHideEvent* event) override;
     private:
         WORKAROUND_StatusBarStyle* _WORKAROUND_StatusBarStyle;
         QProgressBar* progressBar;
@@ -61,6 +113,7 @@ class MainWindow : public QMainWindow {
         QVBoxLayout* mainLayout;
         QLineEdit* searchEdit;
         QCompleter* searchCompleter;
+        AirportCompletionModel* searchCompletionModel;
         QFrame* resultsFrame;
             QVBoxLayout* resultsLayout;
             QGroupBox* forecastGroupBox;
@@ -68,23 +121,65 @@ class MainWindow : public QMainWindow {
                 QTableView* forecastTable;
             QGroupBox* metarGroupBox;
                 QVBoxLayout* metarLayout;
+                QLineEdit* metarFilterEdit;
                 QTableView* metarTable;
+                QHBoxLayout* historyButtonLayout;
+                QPushButton* historyOlderButton;
+                QPushButton* historyNewerButton;
+                QLabel* runwayLabel;
+                QSpinBox* runwayBox;
+        QDockWidget* watchlistDock;
+            QVBoxLayout* watchlistLayout;
+            QLineEdit* watchlistFilterEdit;
+            QTableView* watchlistTable;
+            QHBoxLayout* watchlistButtonLayout;
+            QPushButton* watchlistAddButton;
+            QPushButton* watchlistRemoveButton;
+            QPushButton* watchlistRefreshButton;
+        QDockWidget* nearbyDock;
+            QVBoxLayout* nearbyLayout;
+            QHBoxLayout* nearbyRadiusLayout;
+            QLabel* nearbyRadiusLabel;
+            QSpinBox* nearbyRadiusBox;
+            QTableView* nearbyTable;
+        QMenu* debugMenu;
+            QAction* traceAction;
+            QAction* saveTraceAction;
+            QAction* cacheStatsAction;
 
-        QNetworkAccessManager* networkAccessManager;
+        ReplayNetworkAccessManager* networkAccessManager;
+        WeatherCache* weatherCache;
+        HistoryStore* historyStore;
+        static const qint64 historyPageLength = 7 * 24 * 3600;
+        qint64 historyEnd = 0; // end of the history page being shown, or 0 for the latest data
 
         QNetworkReply* airportDataReply;
+        AirportDataLoader* airportDataLoader;
         AirportNameModel* airportNameModel = nullptr;
 
-        QNetworkReply* weatherTAFReply   = nullptr;
-        QNetworkReply* weatherMETARReply = nullptr;
+        RequestCoordinator* requestCoordinator;
+        WeatherDecoder* weatherDecoder;
+        WeatherFeed* weatherFeed = nullptr; // only in feed mode
+        RefreshScheduler* refreshScheduler = nullptr; // only outside feed mode
+        CancellationToken weatherToken; // for the requests of the current search
         QString weatherRequestsAirportCode;
 
-        // Used from the weather*RequestFinished slots to check whether or not to run
-        // weatherRequestsFinished. Inelegant, but will do for now.
-        bool weatherTAFRequestDidFinish = false;
-        bool weatherMETARRequestDidFinish = false;
-        bool weatherRequestsDidFail = false;
+        // Timing of the current lookup on the trace clock, reported when the tables first paint its data:
+        qint64 lookupStart = 0;
+        qint64 lookupModelTime = 0; // spent putting decoded reports in the tables
+        qint64 lookupShownAt = 0; // when the data was handed to the views, 0 once reported
+        QString lookupSummary;
 
         ForecastModel forecastModel;
         MetarModel metarModel;
+        QSortFilterProxyModel* forecastSortModel; // the tables show these, see filter.h
+        MetarSortFilterModel* metarSortModel;
+        int forecastTableStream = 0; // decoder streams the tables are reading from
+        int metarTableStream = 0;
+        WatchlistModel* watchlistModel;
+        MetarSortFilterModel* watchlistSortModel;
+        WatchlistModel* nearbyModel;    // the stations around nearbyCenter
+        MetarSortFilterModel* nearbySortModel;
+        int nearbyCenter = -1;          // row of the searched airport in airportNameModel
+        int nearbyMaxStations = 25;
 };
@@ -0,0 +1,257 @@
+#include "replay.h"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSaveFile>
+#include <iostream>
+using namespace std;
+
+static const int chunkInterval = 50; // msecs between body chunks when the bandwidth is limited
+
+// QNetworkAccessManager decompresses bodies and doesn't pass on chunked encoding, so these would be wrong for the
+// recorded body. Content-Length is set again when replaying.
+static bool recordedHeader(const QByteArray& name) {
+    QByteArray lower = name.toLower();
+    return lower != "content-length" && lower != "content-encoding" && lower != "transfer-encoding";
+}
+
+
+
+// ReplayStore
+
+ReplayStore::ReplayStore(const QString& directory) : root(directory) {}
+
+QString ReplayStore::key(const QUrl& url) {
+    QByteArray matched = url.fileName().toUtf8() + '?' + url.query(QUrl::FullyEncoded).toUtf8();
+    return QString::fromLatin1(QCryptographicHash::hash(matched, QCryptographicHash::Sha1).toHex());
+}
+
+bool ReplayStore::load(const QUrl& url, RecordedResponse& response) const {
+    QDir dir (root);
+    QFile metaFile (dir.filePath(key(url) + ".json"));
+    QFile bodyFile (dir.filePath(key(url) + ".body"));
+    if (!metaFile.open(QIODevice::ReadOnly) || !bodyFile.open(QIODevice::ReadOnly)) return false;
+
+    QJsonObject meta = QJsonDocument::fromJson(metaFile.readAll()).object();
+    response.url = url;
+    response.status = meta.value("status").toInt(200);
+    response.headers.clear();
+    for (const QJsonValue& header: meta.value("headers").toArray()) {
+        QJsonArray pair = header.toArray();
+        response.headers.append({ pair.at(0).toString().toUtf8(), pair.at(1).toString().toUtf8() });
+    }
+    response.body = bodyFile.readAll();
+    return true;
+}
+
+bool ReplayStore::save(const RecordedResponse& response) const {
+    QDir dir (root);
+    if (!dir.mkpath(".")) return false;
+
+    QJsonArray headers;
+    for (const auto& header: response.headers) {
+        if (!recordedHeader(header.first)) continue;
+        headers.append(QJsonArray { QString::fromUtf8(header.first), QString::fromUtf8(header.second) });
+    }
+    QJsonObject meta;
+    meta.insert("url", response.url.toString(QUrl::FullyEncoded));
+    meta.insert("status", response.status);
+    meta.insert("headers", headers);
+
+    // Body first, so a .json file always has its .body:
+    QSaveFile bodyFile (dir.filePath(key(response.url) + ".body"));
+    QSaveFile metaFile (dir.filePath(key(response.url) + ".json"));
+    if (!bodyFile.open(QIODevice::WriteOnly) || bodyFile.write(response.body) != response.body.size()) return false;
+    if (!bodyFile.commit()) return false;
+    if (!metaFile.open(QIODevice::WriteOnly)) return false;
+    metaFile.write(QJsonDocument(meta).toJson());
+    return metaFile.commit();
+}
+
+
+
+// ReplayReply
+
+ReplayReply::ReplayReply(QNetworkAccessManager::Operation operation, const QNetworkRequest& request,
+    QObject* parent) : QNetworkReply(parent), timer(new QTimer(this))
+{
+    setOperation(operation);
+    setRequest(request);
+    setUrl(request.url());
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    connect(timer, &QTimer::timeout, this, &ReplayReply::playNext);
+}
+
+qint64 ReplayReply::bytesAvailable() const {
+    return buffer.size() - readOffset + QNetworkReply::bytesAvailable();
+}
+
+qint64 ReplayReply::readData(char* data, qint64 maxSize) {
+    qint64 available = buffer.size() - readOffset;
+    if (available == 0) return isFinished() ? -1 : 0;
+    qint64 size = qMin(maxSize, available);
+    memcpy(data, buffer.constData() + readOffset, size_t(size));
+    readOffset += size;
+    if (readOffset == buffer.size()) {
+        buffer.clear();
+        readOffset = 0;
+    }
+    return size;
+}
+
+void ReplayReply::abort() {
+    if (inner) {
+        inner->abort(); // finishes this reply too
+    } else {
+        finishWith(QNetworkReply::OperationCanceledError, tr("Operation canceled"));
+    }
+}
+
+void ReplayReply::setResponse(int status, const QList<QPair<QByteArray, QByteArray>>& headers) {
+    if (status != 0) setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+    for (const auto& header: headers) setRawHeader(header.first, header.second);
+    QVariant length = header(QNetworkRequest::ContentLengthHeader);
+    total = length.isValid() ? length.toLongLong() : -1;
+    emit metaDataChanged();
+}
+
+void ReplayReply::appendBody(const QByteArray& data) {
+    if (data.isEmpty()) return;
+    buffer += data;
+    received += data.size();
+    emit readyRead();
+    emit downloadProgress(received, total);
+}
+
+void ReplayReply::finishWith(QNetworkReply::NetworkError code, const QString& message) {
+    if (isFinished()) return;
+    timer->stop();
+    if (code != QNetworkReply::NoError) {
+        setError(code, message);
+        emit error(code);
+    }
+    setFinished(true);
+    emit finished();
+}
+
+void ReplayReply::play(const RecordedResponse* response, const NetworkConditions& conditions, int latency,
+    bool fail)
+{
+    playbackFound = response != nullptr;
+    if (playbackFound) playback = *response;
+    playbackError = fail ? conditions.error : QNetworkReply::NoError;
+    chunkSize = conditions.bandwidth > 0 ? qMax(qint64(1), conditions.bandwidth * chunkInterval / 1000) : 0;
+    // Always go through the timer, the caller hasn't connected to the reply yet:
+    timer->setSingleShot(true);
+    timer->start(qMax(0, latency));
+}
+
+void ReplayReply::playNext() {
+    if (!headersSent) {
+        headersSent = true;
+        if (playbackError != QNetworkReply::NoError) {
+            finishWith(playbackError, tr("Simulated network error"));
+            return;
+        }
+        if (!playbackFound) {
+            setResponse(404, {});
+            finishWith(QNetworkReply::ContentNotFoundError,
+                tr("No recorded response for %1").arg(url().toString()));
+            return;
+        }
+        auto headers = playback.headers;
+        headers.append({ "Content-Length", QByteArray::number(playback.body.size()) });
+        setResponse(playback.status, headers);
+        if (chunkSize == 0) {
+            appendBody(playback.body);
+            finishWith(QNetworkReply::NoError, QString());
+        } else {
+            timer->setSingleShot(false);
+            timer->start(chunkInterval);
+        }
+        return;
+    }
+
+    appendBody(playback.body.mid(int(bodySent), int(chunkSize)));
+    bodySent += chunkSize;
+    if (bodySent >= playback.body.size()) finishWith(QNetworkReply::NoError, QString());
+}
+
+void ReplayReply::record(QNetworkReply* reply, const ReplayStore& store) {
+    inner = reply;
+    recordDirectory = store.directory();
+    reply->setParent(this);
+
+    connect(reply, &QNetworkReply::encrypted, this, &QNetworkReply::encrypted);
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this] () {
+        setAttribute(QNetworkRequest::SourceIsFromCacheAttribute,
+            inner->attribute(QNetworkRequest::SourceIsFromCacheAttribute));
+        setResponse(inner->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), inner->rawHeaderPairs());
+    });
+    connect(reply, &QNetworkReply::readyRead, this, [this] () {
+        QByteArray data = inner->readAll();
+        recorded += data;
+        appendBody(data);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this] () {
+        QByteArray data = inner->readAll();
+        recorded += data;
+        appendBody(data);
+
+        int status = inner->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (inner->error() == QNetworkReply::NoError && status < 400) {
+            RecordedResponse response;
+            response.url = url();
+            response.status = status != 0 ? status : 200;
+            response.headers = inner->rawHeaderPairs();
+            response.body = recorded;
+            if (!ReplayStore(recordDirectory).save(response)) {
+                cerr << "ReplayReply: couldn't record " << url().toString().toStdString() << " in "
+                     << recordDirectory.toStdString() << endl;
+            }
+        }
+        finishWith(inner->error(), inner->errorString());
+    });
+}
+
+
+
+// ReplayNetworkAccessManager
+
+ReplayNetworkAccessManager::ReplayNetworkAccessManager(QObject* parent) : QNetworkAccessManager(parent) {}
+
+void ReplayNetworkAccessManager::setMode(Mode mode, const QString& directory) {
+    currentMode = mode;
+    store.reset(mode == Mode::Off ? nullptr : new ReplayStore(directory));
+    random.seed(currentConditions.seed);
+}
+
+void ReplayNetworkAccessManager::setConditions(const NetworkConditions& conditions) {
+    currentConditions = conditions;
+    random.seed(conditions.seed);
+}
+
+QNetworkReply* ReplayNetworkAccessManager::createRequest(Operation op, const QNetworkRequest& request,
+    QIODevice* outgoingData)
+{
+    if (currentMode == Mode::Off || op != GetOperation) {
+        return QNetworkAccessManager::createRequest(op, request, outgoingData);
+    }
+
+    ReplayReply* reply = new ReplayReply(op, request, this);
+    if (currentMode == Mode::Record) {
+        reply->record(QNetworkAccessManager::createRequest(op, request, outgoingData), *store);
+        return reply;
+    }
+
+    RecordedResponse response;
+    bool found = store->load(request.url(), response);
+    int latency = currentConditions.latency;
+    if (currentConditions.jitter > 0) latency += int(random.bounded(currentConditions.jitter + 1));
+    bool fail = currentConditions.errorRate > 0 && random.generateDouble() < currentConditions.errorRate;
+    reply->play(found ? &response : nullptr, currentConditions, latency, fail);
+    return reply;
+}
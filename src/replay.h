@@ -0,0 +1,115 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QPointer>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+// Record/replay for the network layer, so whole lookups can be timed offline and repeatably.
+//
+// In Record mode, requests go out as usual and every successful response is also saved to a directory. In Replay
+// mode nothing goes to the network: responses come from that directory, after a simulated latency, at a simulated
+// bandwidth, and some requests can be made to fail. URLs without a recorded response get a 404.
+//
+// Recordings are matched on the last part of the URL's path and its query, e.g. "httpparam?dataSource=metars&...",
+// so responses recorded from the real dataserver replay just as well with a different base URL.
+
+struct RecordedResponse {
+    QUrl url;
+    int status = 200;
+    QList<QPair<QByteArray, QByteArray>> headers;
+    QByteArray body;
+};
+
+// A directory of recorded responses: for each URL, KEY.json with the URL, status and headers and KEY.body with
+// the body, where KEY is the SHA-1 of the matched part of the URL.
+class ReplayStore {
+    public:
+        ReplayStore(const QString& directory);
+        const QString& directory() const { return root; }
+        bool load(const QUrl& url, RecordedResponse& response) const;
+        bool save(const RecordedResponse& response) const;
+        static QString key(const QUrl& url);
+    private:
+        QString root;
+};
+
+// How replayed responses are delivered. The random parts use their own generator seeded with `seed`, so the same
+// requests in the same order get the same delays and errors on every run.
+struct NetworkConditions {
+    int latency = 0;      // msecs until the response headers arrive
+    int jitter = 0;       // up to this many msecs are added to the latency at random
+    qint64 bandwidth = 0; // bytes per second for the body, 0 for no limit
+    double errorRate = 0; // fraction of requests that fail with `error` instead of getting their response
+    QNetworkReply::NetworkError error = QNetworkReply::TemporaryNetworkFailureError;
+    quint32 seed = 1;
+};
+
+// A reply whose body is handed to it piece by piece, by ReplayNetworkAccessManager.
+class ReplayReply : public QNetworkReply {
+    Q_OBJECT
+    public:
+        ReplayReply(QNetworkAccessManager::Operation operation, const QNetworkRequest& request,
+            QObject* parent = nullptr);
+        void abort() override;
+        qint64 bytesAvailable() const override;
+        bool isSequential() const override { return true; }
+
+        // Plays back a recorded response (or a 404, if response is null) under the given conditions.
+        void play(const RecordedResponse* response, const NetworkConditions& conditions, int latency, bool fail);
+        // Passes on what inner receives, saving the response to store once it's complete.
+        void record(QNetworkReply* inner, const ReplayStore& store);
+    protected:
+        qint64 readData(char* data, qint64 maxSize) override;
+    private:
+        void playNext();
+        void setResponse(int status, const QList<QPair<QByteArray, QByteArray>>& headers);
+        void appendBody(const QByteArray& data);
+        void finishWith(QNetworkReply::NetworkError code, const QString& message);
+
+        QByteArray buffer;                // received but not read yet, from readOffset on
+        qint64 readOffset = 0;
+        qint64 received = 0;
+        qint64 total = -1;
+        QTimer* timer;                    // delivers the latency and the body chunks
+
+        // Replay mode:
+        RecordedResponse playback;
+        bool playbackFound = false;
+        QNetworkReply::NetworkError playbackError = QNetworkReply::NoError; // simulated failure, if any
+        bool headersSent = false;
+        qint64 chunkSize = 0;             // 0 to send the whole body at once
+        qint64 bodySent = 0;
+
+        // Record mode:
+        QPointer<QNetworkReply> inner;
+        QString recordDirectory;
+        QByteArray recorded;
+};
+
+// QNetworkAccessManager that can record responses, or replay them instead of using the network. In Off mode (the
+// default) it's a plain QNetworkAccessManager.
+class ReplayNetworkAccessManager : public QNetworkAccessManager {
+    Q_OBJECT
+    public:
+        enum class Mode { Off, Record, Replay };
+
+        ReplayNetworkAccessManager(QObject* parent = nullptr);
+        void setMode(Mode mode, const QString& directory = QString());
+        Mode mode() const { return currentMode; }
+        void setConditions(const NetworkConditions& conditions);
+        const NetworkConditions& conditions() const { return currentConditions; }
+    protected:
+        QNetworkReply* createRequest(Operation op, const QNetworkRequest& request, QIODevice* outgoingData) override;
+    private:
+        Mode currentMode = Mode::Off;
+        QScopedPointer<ReplayStore> store;
+        NetworkConditions currentConditions;
+        QRandomGenerator random;
+};
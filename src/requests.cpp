@@ -0,0 +1,262 @@
+#include "requests.h"
+#include "trace.h"
+#include <QtCore/QPointer>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QTimer>
+
+
+
+// CancellationToken
+
+CancellationToken::CancellationToken() : state(new State()) {}
+
+void CancellationToken::cancel() {
+    if (state->cancelled) return;
+    state->cancelled = true;
+    // Callbacks can register more callbacks or cancel other tokens, so don't iterate over the list in place:
+    auto callbacks = state->callbacks;
+    state->callbacks.clear();
+    for (const auto& callback: callbacks) callback();
+}
+
+bool CancellationToken::isCancelled() const {
+    return state->cancelled;
+}
+
+void CancellationToken::onCancel(std::function<void()> callback) const {
+    if (state->cancelled) {
+        callback();
+    } else {
+        state->callbacks.append(callback);
+    }
+}
+
+
+
+// RequestCoordinator
+
+RequestCoordinator::RequestCoordinator(QNetworkAccessManager* networkAccessManager, QObject* parent)
+    : QObject(parent), networkAccessManager(networkAccessManager) {}
+
+void RequestCoordinator::get(const QUrl& url, const CancellationToken& token, Callback callback, DataCallback onData) {
+    if (token.isCancelled()) return;
+    QString key = url.toString(QUrl::FullyEncoded);
+    int waiterId = nextWaiterId++;
+
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        Entry entry;
+        entry.url = url;
+        entry.host = url.host();
+        entry.timing.queuedAt = TraceNow();
+        it = entries.insert(key, entry);
+        queue.append(key);
+    }
+    it->waiters.append(Waiter { waiterId, callback, onData });
+    if (onData && !it->received.isEmpty()) {
+        onData(it->received);
+    }
+
+    QPointer<RequestCoordinator> self (this);
+    token.onCancel([self, key, waiterId] () {
+        if (self) self->cancelWaiter(key, waiterId);
+    });
+    startQueued();
+}
+
+void RequestCoordinator::getAll(const QList<QUrl>& urls, const CancellationToken& token, GroupCallback callback,
+    GroupDataCallback onData)
+{
+    if (urls.isEmpty()) {
+        callback(QVector<RequestResult>());
+        return;
+    }
+    struct Group {
+        QVector<RequestResult> results;
+        int remaining;
+    };
+    auto group = QSharedPointer<Group>::create();
+    group->results.resize(urls.size());
+    group->remaining = urls.size();
+    for (int i = 0; i < urls.size(); i++) {
+        DataCallback onItemData;
+        if (onData) onItemData = [i, onData] (const QByteArray& data) { onData(i, data); };
+        get(urls[i], token, [group, i, callback] (const RequestResult& result) {
+            group->results[i] = result;
+            if (--group->remaining == 0) callback(group->results);
+        }, onItemData);
+    }
+}
+
+void RequestCoordinator::startQueued() {
+    for (int i = 0; i < queue.size(); ) {
+        const QString key = queue[i];
+        const QString& host = entries[key].host;
+        if (activePerHost.value(host) >= maxConnectionsPerHost) {
+            i++;
+            continue;
+        }
+        queue.removeAt(i);
+        start(key);
+    }
+}
+
+void RequestCoordinator::start(const QString& key) {
+    Entry& entry = entries[key];
+    entry.attempts++;
+    activePerHost[entry.host]++;
+    if (entry.attempts == 1) TraceRecord("network", "queued", entry.timing.queuedAt, TraceNow());
+    entry.timing.startedAt = TraceNow();
+    entry.timing.encryptedAt = 0;
+    entry.timing.headersAt = 0;
+    entry.reply = networkAccessManager->get(QNetworkRequest(entry.url));
+    entry.reply->setProperty("coordinatorKey", key);
+    connect(entry.reply, &QNetworkReply::encrypted, this, &RequestCoordinator::replyEncrypted);
+    connect(entry.reply, &QNetworkReply::metaDataChanged, this, &RequestCoordinator::replyMetaDataChanged);
+    connect(entry.reply, &QNetworkReply::readyRead, this, &RequestCoordinator::replyReadyRead);
+    connect(entry.reply, &QNetworkReply::finished, this, &RequestCoordinator::replyFinished);
+}
+
+bool RequestCoordinator::shouldRetry(QNetworkReply* reply, const Entry& entry) const {
+    // Waiters have already seen part of this body, starting over would hand them the same data twice:
+    if (entry.attempts > maxRetries || !entry.received.isEmpty()) return false;
+    switch (reply->error()) {
+        case QNetworkReply::ConnectionRefusedError:
+        case QNetworkReply::RemoteHostClosedError:
+        case QNetworkReply::HostNotFoundError:
+        case QNetworkReply::TimeoutError:
+        case QNetworkReply::TemporaryNetworkFailureError:
+        case QNetworkReply::NetworkSessionFailedError:
+        case QNetworkReply::ProxyTimeoutError:
+        case QNetworkReply::InternalServerError:
+        case QNetworkReply::ServiceUnavailableError:
+        case QNetworkReply::UnknownServerError:
+            return true;
+        default:
+            return false;
+    }
+}
+
+RequestCoordinator::Entry* RequestCoordinator::entryFor(QNetworkReply* reply) {
+    if (reply == nullptr) return nullptr;
+    auto it = entries.find(reply->property("coordinatorKey").toString());
+    if (it == entries.end() || it->reply != reply) return nullptr;
+    return &it.value();
+}
+
+void RequestCoordinator::replyEncrypted() {
+    Entry* entry = entryFor(qobject_cast<QNetworkReply*>(sender()));
+    if (entry == nullptr) return;
+    entry->timing.encryptedAt = TraceNow();
+    TraceRecord("network", "connect+TLS", entry->timing.startedAt, entry->timing.encryptedAt);
+}
+
+void RequestCoordinator::replyMetaDataChanged() {
+    Entry* entry = entryFor(qobject_cast<QNetworkReply*>(sender()));
+    if (entry == nullptr || entry->timing.headersAt != 0) return;
+    entry->timing.headersAt = TraceNow();
+    qint64 since = entry->timing.encryptedAt != 0 ? entry->timing.encryptedAt : entry->timing.startedAt;
+    TraceRecord("network", "waiting for server", since, entry->timing.headersAt);
+}
+
+void RequestCoordinator::replyReadyRead() {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (entryFor(reply) == nullptr) return;
+    deliverData(reply->property("coordinatorKey").toString(), reply->readAll());
+}
+
+void RequestCoordinator::deliverData(const QString& key, const QByteArray& data) {
+    if (data.isEmpty()) return;
+    Entry& entry = entries[key];
+    entry.received += data;
+    // Data callbacks may cancel (and so remove) waiters, so work on a copy:
+    QList<Waiter> waiters = entry.waiters;
+    for (const Waiter& waiter: waiters) {
+        if (waiter.onData) waiter.onData(data);
+    }
+}
+
+void RequestCoordinator::replyFinished() {
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (reply == nullptr) return;
+    reply->deleteLater();
+    QString key = reply->property("coordinatorKey").toString();
+    auto it = entries.find(key);
+    if (it == entries.end() || it->reply != reply) return;
+
+    it->reply = nullptr;
+    activePerHost[it->host]--;
+    it->timing.finishedAt = TraceNow();
+    TraceRecord("network", "request", it->timing.startedAt, it->timing.finishedAt);
+    if (it->timing.headersAt != 0) {
+        TraceRecord("network", "download", it->timing.headersAt, it->timing.finishedAt);
+    }
+
+    if (shouldRetry(reply, *it)) {
+        // Exponential backoff with jitter, so retries from many requests don't all hit the server at once:
+        int delay = retryDelay * (1 << (it->attempts - 1));
+        delay = delay / 2 + int(QRandomGenerator::global()->bounded(quint32(delay)));
+        QPointer<RequestCoordinator> self (this);
+        QTimer::singleShot(delay, this, [self, key] () {
+            // The entry may have been cancelled in the meantime, and maybe even requested again:
+            if (!self || !self->entries.contains(key)) return;
+            if (self->entries[key].reply != nullptr || self->queue.contains(key)) return;
+            self->queue.append(key);
+            self->startQueued();
+        });
+    } else {
+        // Normally readyRead has handed out everything by now, but make sure nothing's left behind:
+        deliverData(key, reply->readAll());
+        it = entries.find(key);
+        if (it != entries.end()) { // unless the last waiter cancelled from its data callback
+            RequestResult result;
+            result.url = it->url;
+            result.error = reply->error();
+            result.errorString = reply->errorString();
+            result.body = it->received;
+            result.fromCache = reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+            result.attempts = it->attempts;
+            result.queuedAt = it->timing.queuedAt;
+            result.startedAt = it->timing.startedAt;
+            result.encryptedAt = it->timing.encryptedAt;
+            result.headersAt = it->timing.headersAt;
+            result.finishedAt = it->timing.finishedAt;
+            finish(key, result);
+        }
+    }
+    startQueued();
+}
+
+void RequestCoordinator::finish(const QString& key, const RequestResult& result) {
+    // Callbacks may start new requests (even for the same URL), so take the waiters out first:
+    QList<Waiter> waiters = entries.take(key).waiters;
+    for (const Waiter& waiter: waiters) {
+        waiter.callback(result);
+    }
+}
+
+void RequestCoordinator::cancelWaiter(const QString& key, int waiterId) {
+    auto it = entries.find(key);
+    if (it == entries.end()) return;
+    for (int i = 0; i < it->waiters.size(); i++) {
+        if (it->waiters[i].id == waiterId) {
+            it->waiters.removeAt(i);
+            break;
+        }
+    }
+    if (!it->waiters.isEmpty()) return;
+
+    // Nobody's waiting for this anymore:
+    queue.removeAll(key);
+    if (it->reply != nullptr) {
+        QNetworkReply* reply = it->reply;
+        activePerHost[it->host]--;
+        entries.erase(it);
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+        startQueued();
+    } else {
+        entries.erase(it);
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <functional>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+
+// Lets whoever started a request call it off. Copies share the same state, so a token can be handed to any number
+// of requests and cancelled once for all of them.
+class CancellationToken {
+    public:
+        CancellationToken();
+        void cancel();
+        bool isCancelled() const;
+        // Runs callback when the token is cancelled (right away if it already is).
+        void onCancel(std::function<void()> callback) const;
+    private:
+        struct State {
+            bool cancelled = false;
+            QList<std::function<void()>> callbacks;
+        };
+        QSharedPointer<State> state;
+};
+
+struct RequestResult {
+    QUrl url;
+    QNetworkReply::NetworkError error = QNetworkReply::NoError;
+    QString errorString;
+    QByteArray body;
+    bool fromCache = false;
+    int attempts = 0;
+
+    // When the request got where, on the trace clock (see trace.h), for the last attempt. Zero if it never did.
+    qint64 queuedAt = 0;
+    qint64 startedAt = 0;
+    qint64 encryptedAt = 0; // TLS handshake done
+    qint64 headersAt = 0;   // response headers received
+    qint64 finishedAt = 0;
+};
+
+// Runs GET requests through a QNetworkAccessManager on behalf of the rest of the application:
+// - requests for a URL that's already in flight join it instead of starting another one,
+// - at most maxConnectionsPerHost requests run against a host at once, the rest wait in a queue,
+// - transient failures are retried with exponential backoff and random jitter,
+// - a request is aborted only when every caller waiting on it has cancelled.
+class RequestCoordinator : public QObject {
+    Q_OBJECT
+    public:
+        typedef std::function<void(const RequestResult&)> Callback;
+        typedef std::function<void(const QVector<RequestResult>&)> GroupCallback;
+        // Called with each piece of the body as it arrives, before the final callback:
+        typedef std::function<void(const QByteArray&)> DataCallback;
+        typedef std::function<void(int, const QByteArray&)> GroupDataCallback; // index into urls, data
+
+        RequestCoordinator(QNetworkAccessManager* networkAccessManager, QObject* parent = nullptr);
+        void setMaxConnectionsPerHost(int count) { maxConnectionsPerHost = qMax(1, count); }
+        void setMaxRetries(int count) { maxRetries = qMax(0, count); }
+        void setRetryDelay(int msecs) { retryDelay = qMax(1, msecs); }
+
+        // Calls callback once with the result, unless token is cancelled first. If onData is set, it gets the body
+        // piece by piece as it comes in; joining a request that's already receiving calls it right away with
+        // everything received so far. Requests that have delivered data aren't retried.
+        void get(const QUrl& url, const CancellationToken& token, Callback callback, DataCallback onData = nullptr);
+        // Fetches all urls and calls callback once, with the results in the same order as urls.
+        void getAll(const QList<QUrl>& urls, const CancellationToken& token, GroupCallback callback,
+            GroupDataCallback onData = nullptr);
+
+        int inFlight() const { return entries.size(); }
+    private slots:
+        void replyEncrypted();
+        void replyMetaDataChanged();
+        void replyReadyRead();
+        void replyFinished();
+    private:
+        struct Waiter {
+            int id;
+            Callback callback;
+            DataCallback onData;
+        };
+        struct Entry {
+            QUrl url;
+            QString host;
+            QNetworkReply* reply = nullptr; // null while queued or waiting for a retry
+            int attempts = 0;
+            QByteArray received; // body read so far
+            RequestResult timing; // only the *At fields are used
+            QList<Waiter> waiters;
+        };
+
+        Entry* entryFor(QNetworkReply* reply);
+        void start(const QString& key);
+        void startQueued();
+        void deliverData(const QString& key, const QByteArray& data);
+        void finish(const QString& key, const RequestResult& result);
+        void cancelWaiter(const QString& key, int waiterId);
+        bool shouldRetry(QNetworkReply* reply, const Entry& entry) const;
+
+        QNetworkAccessManager* networkAccessManager;
+        int maxConnectionsPerHost = 4;
+        int maxRetries = 2;
+        int retryDelay = 500; // msecs, doubled on every attempt
+
+        QHash<QString, Entry> entries;      // by URL
+        QList<QString> queue;               // entries waiting for a free connection
+        QHash<QString, int> activePerHost;
+        int nextWaiterId = 0;
+};
@@ -0,0 +1,187 @@
+#include "scheduler.h"
+#include "dataserver.h"
+#include "trace.h"
+#include <QtCore/QDateTime>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QSet>
+#include <iostream>
+#include <limits>
+using namespace std;
+
+RefreshScheduler::RefreshScheduler (RequestCoordinator* requestCoordinator, WeatherDecoder* weatherDecoder,
+    QObject* parent)
+    : QObject(parent), requestCoordinator(requestCoordinator), weatherDecoder(weatherDecoder),
+      timer(new QTimer(this))
+{
+    timer->setSingleShot(true);
+    connect(timer, &QTimer::timeout, this, &RefreshScheduler::refresh);
+}
+
+void RefreshScheduler::setStations (Group group, const QStringList& list) {
+    groups[group] = list;
+    updateStations();
+}
+
+void RefreshScheduler::setPaused (bool pause) {
+    if (pause == paused) return;
+    paused = pause;
+    schedule();
+}
+
+qint64 RefreshScheduler::nextMetarDue (qint64 lastObservation, qint64 now) const {
+    if (lastObservation == 0) {
+        // Nothing's known about the station. Most observe shortly before the hour:
+        return (now / 3600 + 1) * 3600;
+    }
+    qint64 expected = lastObservation + 3600 + publishDelay;
+    if (expected > now) return qMin(expected, now + speciInterval);
+    if (now < expected + lateWindow) return now + lateRecheck;
+    return now + speciInterval;
+}
+
+qint64 RefreshScheduler::nextTafDue (qint64 lastValidFrom, qint64 now) {
+    // The next period is the one after the period the last TAF is valid for. Amended TAFs become valid partway
+    // through a period, so that's rounded down:
+    const qint64 cycle = 6 * 3600;
+    qint64 from = lastValidFrom != 0 ? lastValidFrom : now + tafLead;
+    qint64 nextPeriod = (from / cycle + 1) * cycle;
+    qint64 due = nextPeriod - tafLead + publishDelay;
+    return due > now ? due : now + tafRecheck;
+}
+
+void RefreshScheduler::noteMetars (const MetarColumns& metars) {
+    qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (int row = 0; row < metars.count(); row++) {
+        auto it = stations.find(metars.stations[metars.station[row]]);
+        if (it == stations.end() || metars.observationTime[row] <= it->lastObservation) continue;
+        it->lastObservation = metars.observationTime[row];
+        it->metarDue = nextMetarDue(it->lastObservation, now);
+    }
+    schedule();
+}
+
+void RefreshScheduler::noteTafs (const TafRecords& tafs) {
+    qint64 now = QDateTime::currentSecsSinceEpoch();
+    // A TAF can be issued up to an hour before its period starts, so its period is found from when it becomes
+    // valid, the start of its first forecast:
+    QVector<qint64> validFrom (tafs.reports.size(), 0);
+    for (const TafForecast& forecast: tafs.forecasts) {
+        qint64& from = validFrom[forecast.report];
+        qint64 start = forecast.from.toSecsSinceEpoch();
+        if (forecast.from.isValid() && (from == 0 || start < from)) from = start;
+    }
+    const qint64 cycle = 6 * 3600;
+    for (int i = 0; i < tafs.reports.size(); i++) {
+        const TafReport& report = tafs.reports[i];
+        auto it = stations.find(report.stationId);
+        qint64 issued = report.issueTime.toSecsSinceEpoch();
+        if (it == stations.end() || issued <= it->lastIssue) continue;
+        it->lastIssue = issued;
+        // Without forecasts, the period boundary closest to the issue time is the best guess:
+        it->lastValidFrom = validFrom[i] != 0 ? validFrom[i] : (issued + cycle / 2) / cycle * cycle;
+        it->tafDue = nextTafDue(it->lastValidFrom, now);
+    }
+    schedule();
+}
+
+void RefreshScheduler::updateStations () {
+    QSet<QString> wanted;
+    for (const QStringList& group: groups) {
+        for (const QString& station: group) {
+            wanted.insert(station);
+        }
+    }
+    for (auto it = stations.begin(); it != stations.end();) {
+        it = wanted.contains(it.key()) ? it + 1 : stations.erase(it);
+    }
+    qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (const QString& station: wanted) {
+        if (stations.contains(station)) continue;
+        // New stations are fetched by whoever added them, which reports back through noteMetars and noteTafs:
+        Station& state = stations[station];
+        state.metarDue = nextMetarDue(0, now);
+        state.tafDue = nextTafDue(0, now);
+    }
+    schedule();
+}
+
+void RefreshScheduler::schedule () {
+    if (paused || refreshing || stations.isEmpty()) {
+        timer->stop();
+        return;
+    }
+    qint64 next = std::numeric_limits<qint64>::max();
+    for (const Station& station: stations) {
+        next = qMin(next, qMin(station.metarDue, station.tafDue));
+    }
+    next = qMax(next, backoffUntil);
+    qint64 delay = qMax(qint64(0), next - QDateTime::currentSecsSinceEpoch()) * 1000;
+    if (jitter > 0) delay += QRandomGenerator::global()->bounded(quint32(jitter * 1000));
+    timer->start(int(delay));
+}
+
+void RefreshScheduler::refresh () {
+    TRACE_SPAN("weather", "scheduled refresh");
+    // Take along whatever would come due shortly anyway, to save a wake-up and a request:
+    qint64 cutoff = QDateTime::currentSecsSinceEpoch() + batchWindow;
+    QStringList metarStations, tafStations;
+    for (auto it = stations.constBegin(); it != stations.constEnd(); ++it) {
+        if (it->metarDue <= cutoff) metarStations.append(it.key());
+        if (it->tafDue <= cutoff) tafStations.append(it.key());
+    }
+    if (metarStations.isEmpty() && tafStations.isEmpty()) {
+        schedule();
+        return;
+    }
+
+    QList<QUrl> urls;
+    for (int i = 0; i < metarStations.size(); i += batchSize) {
+        urls.append(DataserverUrl("metars", metarStations.mid(i, batchSize),
+            { { "hoursBeforeNow", "3" }, { "mostRecentForEachStation", "constraint" } }));
+    }
+    for (int i = 0; i < tafStations.size(); i += batchSize) {
+        urls.append(DataserverUrl("tafs", tafStations.mid(i, batchSize),
+            { { "hoursBeforeNow", "24" }, { "mostRecentForEachStation", "constraint" } }));
+    }
+    refreshToken = CancellationToken();
+    refreshing = true;
+    requestCoordinator->getAll(urls, refreshToken,
+        [this, metarStations, tafStations] (const QVector<RequestResult>& results) {
+            requestsFinished(results, metarStations, tafStations);
+        });
+}
+
+void RefreshScheduler::requestsFinished (const QVector<RequestResult>& results, const QStringList& metarStations,
+    const QStringList& tafStations)
+{
+    qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (const RequestResult& result: results) {
+        if (result.error == QNetworkReply::NoError) continue;
+        refreshing = false;
+        cerr << "RefreshScheduler: " << result.url.toString().toStdString() << " failed with code "
+             << result.error << endl;
+        failures++;
+        backoffUntil = now + qMin(qint64(maxBackoff), qint64(minBackoff) << qMin(failures - 1, 16));
+        emit refreshFailed();
+        schedule();
+        return;
+    }
+    failures = 0;
+    backoffUntil = 0;
+
+    // The stations that have nothing new are checked again later, the others once their next report is due:
+    for (const QString& station: metarStations) {
+        auto it = stations.find(station);
+        if (it != stations.end()) it->metarDue = nextMetarDue(it->lastObservation, now);
+    }
+    for (const QString& station: tafStations) {
+        auto it = stations.find(station);
+        if (it != stations.end()) it->tafDue = nextTafDue(it->lastValidFrom, now);
+    }
+    weatherDecoder->decodeAll(results, refreshToken, [this] (const MetarColumns& metars, const TafRecords& tafs) {
+        refreshing = false;
+        noteMetars(metars);
+        noteTafs(tafs);
+        emit refreshed(metars, tafs);
+    });
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include "data.h"
+#include "decoder.h"
+#include "requests.h"
+
+// Refreshes the stations on screen (the searched airport, the watchlist and the nearby stations) when new reports
+// are due, instead of on a fixed interval:
+// - Routine METARs come out once an hour, at about the same minute past the hour for a given station, so a
+//   station's next METAR is due an hour after its last observation, plus a few minutes for it to be published.
+//   If it's late, the station is checked again every few minutes for a while, and then every speciInterval, which
+//   also picks up specials (SPECIs) in between. Those checks only ask for METARs.
+// - TAFs are issued four times a day, for 00, 06, 12 and 18Z, and go out about 40 minutes before the start of their
+//   period, so a station's next TAF is due then.
+// When the timer goes off, every station that's due within the next batchWindow seconds is fetched, in one METAR
+// and one TAF request per batchSize stations (like WatchlistModel). A random delay of up to jitter seconds is added
+// to every wake-up, so clients started together don't all ask at the same moment. Failed refreshes are retried
+// with exponential backoff, and nothing is fetched while the scheduler is paused (the window is hidden); whatever
+// came due in the meantime is fetched once it's resumed.
+// Reports fetched by other means should be passed to noteMetars/noteTafs, so stations that were just refreshed
+// aren't fetched again.
+class RefreshScheduler : public QObject {
+    Q_OBJECT
+    public:
+        enum Group { Displayed, Watchlist, Nearby, GroupCount };
+
+        static const int publishDelay = 5 * 60;   // seconds between an observation and its METAR being published
+        static const int lateRecheck = 5 * 60;    // how often a late METAR is checked for
+        static const int lateWindow = 30 * 60;    // how long it's checked for that often
+        static const int tafLead = 40 * 60;       // seconds before the start of their period TAFs are issued
+        static const int tafRecheck = 30 * 60;    // how often a late TAF is checked for
+        static const int batchWindow = 2 * 60;
+        static const int minBackoff = 60;
+        static const int maxBackoff = 30 * 60;
+
+        RefreshScheduler (RequestCoordinator* requestCoordinator, WeatherDecoder* weatherDecoder,
+            QObject* parent = nullptr);
+        void setStations (Group group, const QStringList& stations);
+        void setBatchSize (int size) { batchSize = qMax(1, size); }
+        void setJitter (int seconds) { jitter = qMax(0, seconds); }
+        void setSpeciInterval (int seconds) { speciInterval = qMax(int(lateRecheck), seconds); }
+        void setPaused (bool paused);
+        bool isPaused () const { return paused; }
+        void noteMetars (const MetarColumns& metars);
+        void noteTafs (const TafRecords& tafs);
+
+        // When the next METAR or TAF of a station is due, in seconds since the Unix epoch, given when its last one
+        // was observed or became valid (0 if there's none) and the current time:
+        qint64 nextMetarDue (qint64 lastObservation, qint64 now) const;
+        static qint64 nextTafDue (qint64 lastValidFrom, qint64 now);
+    signals:
+        // The reports of the stations that were due. They can be older than what was already there.
+        void refreshed (const MetarColumns& metars, const TafRecords& tafs);
+        void refreshFailed ();
+    private:
+        struct Station {
+            qint64 lastObservation = 0;
+            qint64 lastIssue = 0;
+            qint64 lastValidFrom = 0;
+            qint64 metarDue = 0;
+            qint64 tafDue = 0;
+        };
+
+        void updateStations ();
+        void schedule ();
+        void refresh ();
+        void requestsFinished (const QVector<RequestResult>& results, const QStringList& metarStations,
+            const QStringList& tafStations);
+
+        RequestCoordinator* requestCoordinator;
+        WeatherDecoder* weatherDecoder;
+        QStringList groups[GroupCount];
+        QHash<QString, Station> stations;
+        int batchSize = 25;
+        int jitter = 60;
+        int speciInterval = 15 * 60;
+        bool paused = false;
+
+        QTimer* timer;
+        CancellationToken refreshToken;
+        bool refreshing = false;
+        int failures = 0;          // refreshes that failed in a row
+        qint64 backoffUntil = 0;
+};
@@ -0,0 +1,321 @@
+#include "search.h"
+#include "data.h"
+#include "trace.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVarLengthArray>
+#include <algorithm>
+#include <iterator>
+
+static inline quint64 trigramKey (const QChar* c) {
+    return (quint64(c[0].unicode()) << 32) | (quint64(c[1].unicode()) << 16) | quint64(c[2].unicode());
+}
+
+// How well an entry matches, best first. Matches in the same class are ordered by matchPrior, then by row.
+enum MatchClass {
+    ExactCode,  // the ICAO code, or the full text picked from the completion popup
+    ExactIata,
+    CodePrefix,
+    WholeWord,  // a whole word of the name, city or country
+    WordPrefix,
+    Substring,
+    Fuzzy,      // Fuzzy + edit distance - 1
+};
+
+// Returns the MatchClass of an entry with the given ICAO code and display text for query, or -1 if the text doesn't
+// contain query at all.
+static int matchClass (const QStringRef& icao, const QString& text, const QString& query) {
+    if (icao.compare(query, Qt::CaseInsensitive) == 0) return ExactCode;
+    if (text.compare(query, Qt::CaseInsensitive) == 0) return ExactCode;
+    int colon = text.indexOf(QLatin1Char(':'));
+    int slash = text.leftRef(qMax(colon, 0)).indexOf(QLatin1Char('/'));
+    if (slash >= 0 && text.midRef(slash + 1, colon - slash - 1).compare(query, Qt::CaseInsensitive) == 0) {
+        return ExactIata;
+    }
+
+    int best = -1;
+    for (int position = text.indexOf(query, 0, Qt::CaseInsensitive); position >= 0;
+         position = text.indexOf(query, position + 1, Qt::CaseInsensitive))
+    {
+        if (position == 0 || position == slash + 1) return CodePrefix;
+        int end = position + query.size();
+        if (position > colon && !text.at(position - 1).isLetterOrNumber()) {
+            bool wholeWord = end == text.size() || !text.at(end).isLetterOrNumber();
+            best = qMin(best < 0 ? Substring : best, wholeWord ? int(WholeWord) : int(WordPrefix));
+        } else if (best < 0) {
+            best = Substring;
+        }
+    }
+    return best;
+}
+
+// Among equally good matches, airports with an IATA code (which nearly every airport with scheduled flights has)
+// go first, and international ones before the rest. Lower is better.
+static int matchPrior (const QString& text) {
+    int colon = text.indexOf(QLatin1Char(':'));
+    if (text.leftRef(qMax(colon, 0)).indexOf(QLatin1Char('/')) < 0) return 2;
+    return text.indexOf(QLatin1String("International"), qMax(colon, 0)) >= 0 ? 0 : 1;
+}
+
+// Typos allowed in a query of the given length. Short queries would match almost anything with a typo or two.
+static int maxTypos (int length) {
+    if (length < 4) return 0;
+    return length < 8 ? 1 : 2;
+}
+
+// The smallest edit distance (insertions, deletions, substitutions) between foldedQuery and the start of any word
+// of the text after the ICAO/IATA codes, or maxDistance + 1 if it's more than maxDistance.
+static int fuzzyDistance (const QString& text, const QString& foldedQuery, int maxDistance) {
+    const int m = foldedQuery.size();
+    const QChar* q = foldedQuery.constData();
+    QVarLengthArray<int, 64> columns (2 * (m + 1));
+    int* previous = columns.data();
+    int* current = previous + m + 1;
+    int best = maxDistance + 1;
+
+    for (int start = qMax(text.indexOf(QLatin1Char(':')), 0); start < text.size(); start++) {
+        if (!text.at(start).isLetterOrNumber() || (start > 0 && text.at(start - 1).isLetterOrNumber())) continue;
+        // previous[i] is the distance between the first i query characters and the text read so far:
+        for (int i = 0; i <= m; i++) previous[i] = i;
+        for (int j = start; j < text.size() && j < start + m + maxDistance; j++) {
+            QChar t = text.at(j).toCaseFolded();
+            current[0] = j - start + 1;
+            int rowBest = current[0];
+            for (int i = 1; i <= m; i++) {
+                int substitute = previous[i - 1] + (q[i - 1] == t ? 0 : 1);
+                current[i] = qMin(substitute, qMin(previous[i], current[i - 1]) + 1);
+                rowBest = qMin(rowBest, current[i]);
+            }
+            best = qMin(best, current[m]);
+            if (rowBest >= best) break; // reading more text can't get this word any closer
+            std::swap(previous, current);
+        }
+        if (best == 0) break;
+    }
+    return best;
+}
+
+// Keeps the `limit` best (lowest) keys offered so far in a max-heap, so the worst one is always at the front.
+class TopMatches {
+    public:
+        TopMatches (int limit) : limit(limit) { heap.reserve(limit); }
+        bool isFull () const { return heap.size() >= limit; }
+        void offer (int matchClass, const QString& text, int row) {
+            quint64 key = (quint64(matchClass) << 40) | (quint64(matchPrior(text)) << 32) | quint32(row);
+            if (heap.size() < limit) {
+                heap.append(key);
+                std::push_heap(heap.begin(), heap.end());
+            } else if (key < heap.first()) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.last() = key;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+        // The class of the worst match in the list, or one past the worst possible class while there's room:
+        int worstClass () const { return isFull() ? int(heap.first() >> 40) : Fuzzy + 2; }
+        QVector<int> rows () {
+            std::sort_heap(heap.begin(), heap.end());
+            QVector<int> result;
+            result.reserve(heap.size());
+            for (quint64 key: heap) result.append(int(quint32(key)));
+            return result;
+        }
+    private:
+        int limit;
+        QVector<quint64> heap;
+};
+
+
+
+// AirportSearchIndex
+
+void AirportSearchIndex::clear () {
+    keyBytes.clear();
+    offsetBytes.clear();
+    rowBytes.clear();
+}
+
+void AirportSearchIndex::setData (const QByteArray& keys, const QByteArray& offsets, const QByteArray& rows) {
+    keyBytes = keys;
+    offsetBytes = offsets;
+    rowBytes = rows;
+}
+
+void AirportSearchIndex::build (const AirportEntries& entries) {
+    TRACE_SPAN("airports", "build search index");
+    QHash<quint64, QVector<qint32>> postings;
+    QString display;
+    for (int row = 0; row < entries.size(); row++) {
+        entries.displayText(row, display);
+        QString text = display.toCaseFolded();
+        for (int i = 0; i + 3 <= text.size(); i++) {
+            QVector<qint32>& rows = postings[trigramKey(text.constData() + i)];
+            // Rows are added in ascending order, so a trigram repeated within a row can only be at the back:
+            if (rows.isEmpty() || rows.last() != row) rows.append(row);
+        }
+    }
+
+    // Flatten into sorted keys plus one shared row array:
+    QVector<quint64> sortedKeys = postings.keys().toVector();
+    std::sort(sortedKeys.begin(), sortedKeys.end());
+    QVector<quint32> rowOffsets;
+    rowOffsets.reserve(sortedKeys.size() + 1);
+    QVector<qint32> allRows;
+    for (quint64 key: sortedKeys) {
+        rowOffsets.append(quint32(allRows.size()));
+        allRows += postings[key];
+    }
+    rowOffsets.append(quint32(allRows.size()));
+
+    keyBytes = QByteArray(reinterpret_cast<const char*>(sortedKeys.constData()),
+        sortedKeys.size() * int(sizeof(quint64)));
+    offsetBytes = QByteArray(reinterpret_cast<const char*>(rowOffsets.constData()),
+        rowOffsets.size() * int(sizeof(quint32)));
+    rowBytes = QByteArray(reinterpret_cast<const char*>(allRows.constData()),
+        allRows.size() * int(sizeof(qint32)));
+}
+
+QVector<int> AirportSearchIndex::candidates (const QString& foldedQuery) const {
+    struct Range { const qint32* begin; const qint32* end; };
+    QVector<Range> lists;
+    const quint64* keysBegin = keys();
+    const quint64* keysEnd = keysBegin + keyCount();
+    for (int i = 0; i + 3 <= foldedQuery.size(); i++) {
+        quint64 key = trigramKey(foldedQuery.constData() + i);
+        const quint64* it = std::lower_bound(keysBegin, keysEnd, key);
+        if (it == keysEnd || *it != key) return QVector<int>();
+        int k = int(it - keysBegin);
+        lists.append(Range { rows() + offsets()[k], rows() + offsets()[k + 1] });
+    }
+
+    // Intersect starting from the shortest list, so the intermediate results stay small:
+    std::sort(lists.begin(), lists.end(), [] (const Range& a, const Range& b) {
+        return (a.end - a.begin) < (b.end - b.begin);
+    });
+    QVector<int> result;
+    std::copy(lists.first().begin, lists.first().end, std::back_inserter(result));
+    for (int i = 1; i < lists.size() && !result.isEmpty(); i++) {
+        QVector<int> next;
+        std::set_intersection(result.constBegin(), result.constEnd(), lists[i].begin, lists[i].end,
+            std::back_inserter(next));
+        result.swap(next);
+    }
+    return result;
+}
+
+// Rows sharing all but at most maxMissing of the query's distinct trigrams, and at least one, the ones sharing the
+// most first. An occurrence of the query with k typos still has all but at most 3k of its trigrams, so a row below
+// that can't be a fuzzy match.
+QVector<int> AirportSearchIndex::similarRows (const QString& foldedQuery, int rowCount, int maxMissing) const {
+    QVector<quint64> queryKeys;
+    for (int i = 0; i + 3 <= foldedQuery.size(); i++) queryKeys.append(trigramKey(foldedQuery.constData() + i));
+    std::sort(queryKeys.begin(), queryKeys.end());
+    queryKeys.erase(std::unique(queryKeys.begin(), queryKeys.end()), queryKeys.end());
+
+    // Counted against the distinct trigrams, as a repeated one only appears once in a row's lists:
+    const int minShared = qMax(1, queryKeys.size() - maxMissing);
+
+    QVector<quint16> shared (rowCount);
+    const quint64* keysBegin = keys();
+    const quint64* keysEnd = keysBegin + keyCount();
+    for (quint64 key: queryKeys) {
+        const quint64* it = std::lower_bound(keysBegin, keysEnd, key);
+        if (it == keysEnd || *it != key) continue;
+        int k = int(it - keysBegin);
+        for (const qint32* row = rows() + offsets()[k]; row != rows() + offsets()[k + 1]; row++) {
+            if (*row < rowCount && shared[*row] < 0xffff) shared[*row]++;
+        }
+    }
+
+    QVector<QVector<int>> buckets (queryKeys.size() + 1);
+    for (int row = 0; row < rowCount; row++) {
+        if (shared[row] >= minShared) buckets[shared[row]].append(row);
+    }
+    QVector<int> result;
+    for (int count = buckets.size() - 1; count >= minShared; count--) result += buckets[count];
+    return result;
+}
+
+QVector<int> AirportSearchIndex::search (const AirportEntries& entries, const QString& query,
+    int limit, int budgetMsecs) const
+{
+    QString trimmed = query.trimmed();
+    if (trimmed.isEmpty() || limit <= 0) return QVector<int>();
+
+    // Every pass checks the clock now and then and stops when the budget is used up, keeping what it found.
+    // A single result is what gets picked when the search is submitted, which mustn't depend on how busy the
+    // machine is, so that isn't limited.
+    QElapsedTimer timer;
+    timer.start();
+    const bool budgeted = limit > 1;
+    qint64 budget = qint64(budgetMsecs) * 1000000;
+    int checked = 0;
+    auto outOfTime = [&] () { return budgeted && (++checked & 63) == 0 && timer.nsecsElapsed() > budget; };
+
+    TopMatches matches (limit);
+    QString folded = trimmed.toCaseFolded();
+    QString text; // display text of the row being checked
+    if (trimmed.size() >= 3) {
+        // Having all of the query's trigrams doesn't guarantee that the query itself is in the text, so the
+        // candidates still need to be checked.
+        for (int row: candidates(folded)) {
+            entries.displayText(row, text);
+            int match = matchClass(entries.icao(row), text, trimmed);
+            if (match >= 0) matches.offer(match, text, row);
+            if (outOfTime()) break;
+        }
+    } else {
+        // Too short for trigrams. One or two characters match most rows, though, so we can stop scanning as soon
+        // as we have enough prefix matches, which usually takes a few hundred rows at most.
+        int prefixMatches = 0;
+        for (int row = 0; row < entries.size() && prefixMatches < limit && !outOfTime(); row++) {
+            entries.displayText(row, text);
+            int match = matchClass(entries.icao(row), text, trimmed);
+            if (match < 0) continue;
+            matches.offer(match, text, row);
+            if (match <= CodePrefix) prefixMatches++;
+        }
+    }
+
+    // Not enough matches: try again allowing for typos, most promising rows first.
+    int typos = maxTypos(folded.size());
+    if (!matches.isFull() && typos > 0) {
+        for (int row: similarRows(folded, entries.size(), 3 * typos)) {
+            if (outOfTime()) break;
+            entries.displayText(row, text);
+            if (matchClass(entries.icao(row), text, trimmed) >= 0) continue; // found above already
+            // Once the list is full, only rows with fewer typos than its worst match can get in:
+            int allowed = qMin(typos, matches.worstClass() - Fuzzy);
+            if (allowed <= 0) break;
+            int distance = fuzzyDistance(text, folded, allowed);
+            if (distance <= allowed) matches.offer(Fuzzy + distance - 1, text, row);
+        }
+    }
+    return matches.rows();
+}
+
+
+
+// AirportCompletionModel
+
+void AirportCompletionModel::setSource (const AirportNameModel* model) {
+    beginResetModel();
+    source = model;
+    rows.clear();
+    endResetModel();
+}
+
+void AirportCompletionModel::setQuery (const QString& query) {
+    beginResetModel();
+    rows = source ? source->search(query, maxResults) : QVector<int>();
+    endResetModel();
+}
+
+int AirportCompletionModel::rowCount (const QModelIndex& parent) const {
+    if (parent.isValid()) return 0;
+    return rows.size();
+}
+
+QVariant AirportCompletionModel::data (const QModelIndex& index, int role) const {
+    if (source == nullptr || index.row() < 0 || index.row() >= rows.size()) return QVariant();
+    return source->data(source->index(rows[index.row()], 0), role);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class AirportEntries;
+
+// Case-insensitive substring index over the display text of airport entries, built once when the airports load.
+// The display texts aren't stored (see AirportEntries), so they're put together again for every row checked.
+// Each trigram of the case-folded text maps to the ascending list of rows containing it; a query intersects the
+// lists for its own trigrams and only verifies the rows that survive.
+// Results are ranked: exact ICAO and IATA codes first, then code prefixes, whole words and word prefixes of the
+// name, city or country, then other substrings. If that doesn't fill the list, rows that are a typo or two away
+// (edit distance, against word starts) are added, found through the trigrams they share with the query.
+// The lists are stored flat (sorted keys, offsets into one array of rows) in byte arrays, so the index can be
+// written to an airport snapshot as-is and used straight out of the mapped file.
+class AirportSearchIndex {
+    public:
+        void build (const AirportEntries& entries);
+        void clear ();
+        // Returns up to limit rows matching query, best match first. The search gives up after about budgetMsecs,
+        // returning the best rows found by then, so typing stays responsive however large the list is. With a limit
+        // of 1 it always runs to the end.
+        QVector<int> search (const AirportEntries& entries, const QString& query, int limit,
+            int budgetMsecs = defaultBudgetMsecs) const;
+        static const int defaultBudgetMsecs = 8;
+
+        // keys: quint64[n], offsets: quint32[n+1], rows: qint32[offsets[n]]
+        const QByteArray& keyData () const    { return keyBytes; }
+        const QByteArray& offsetData () const { return offsetBytes; }
+        const QByteArray& rowData () const    { return rowBytes; }
+        void setData (const QByteArray& keys, const QByteArray& offsets, const QByteArray& rows);
+    private:
+        int keyCount () const { return keyBytes.size() / int(sizeof(quint64)); }
+        const quint64* keys () const    { return reinterpret_cast<const quint64*>(keyBytes.constData()); }
+        const quint32* offsets () const { return reinterpret_cast<const quint32*>(offsetBytes.constData()); }
+        const qint32* rows () const     { return reinterpret_cast<const qint32*>(rowBytes.constData()); }
+        QVector<int> candidates (const QString& foldedQuery) const;
+        QVector<int> similarRows (const QString& foldedQuery, int rowCount, int maxMissing) const;
+
+        QByteArray keyBytes;
+        QByteArray offsetBytes;
+        QByteArray rowBytes;
+};
+
+class AirportNameModel;
+
+// Completion model for the search box: holds the top-ranked rows of an AirportNameModel for the current query,
+// so QCompleter (in UnfilteredPopupCompletion mode) never has to scan the full airport list itself.
+class AirportCompletionModel : public QAbstractListModel {
+    public:
+        static const int maxResults = 50;
+        void setSource (const AirportNameModel* model);
+        void setQuery (const QString& query);
+        int rowCount (const QModelIndex& parent = QModelIndex()) const;
+        QVariant data (const QModelIndex& index, int role = Qt::DisplayRole) const;
+    private:
+        const AirportNameModel* source = nullptr;
+        QVector<int> rows;
+};
@@ -0,0 +1,170 @@
+// Binary snapshot of AirportData: the parsed entries, their strings and the prebuilt indexes, written
+// once after the CSV file is parsed and mapped straight into memory on later launches.
+//
+// Layout (native byte order, every section aligned to 8 bytes):
+//   SnapshotHeader
+//   AirportEntries::Record[entryCount]
+//   ushort[stringLength]        UTF-16 string pool of AirportEntries, each string preceded by its length
+//   quint64[keyCount]           search index trigrams, sorted
+//   quint32[keyCount + 1]       offsets of each trigram's rows
+//   qint32[rowCount]            search index rows
+//   float[3 * pointCount]       spatial index points, in tree order
+//   qint32[pointCount]          spatial index rows
+#include "data.h"
+#include "trace.h"
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+static const char snapshotMagic[8] = { 'W', 'T', 'A', 'I', 'R', 'P', 'R', 'T' };
+// 2: compact AirportEntries records instead of ICAO and display text
+// 3: coordinates in the records, spatial index
+static const quint32 snapshotVersion = 3;
+static const quint32 snapshotByteOrder = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;    // snapshotByteOrder as written by the machine that created the file
+    quint32 entryCount;
+    quint32 stringLength; // in UTF-16 code units
+    quint32 keyCount;
+    quint32 rowCount;
+    quint32 pointCount;
+    quint32 unused;       // keeps the header free of padding
+    quint64 payloadSize;  // everything after the header
+    quint64 checksum;     // FNV-1a of the payload
+};
+static_assert(sizeof(SnapshotHeader) == 56, "SnapshotHeader must not contain padding");
+static_assert(sizeof(AirportEntries::Record) == 28, "AirportEntries::Record must not contain padding");
+
+static qint64 align8 (qint64 size) {
+    return (size + 7) & ~qint64(7);
+}
+
+static quint64 checksum (const char* data, qint64 size) {
+    quint64 hash = 14695981039346656037ULL;
+    for (qint64 i = 0; i < size; i++) {
+        hash ^= quint8(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void appendSection (QByteArray& payload, const void* data, qint64 size) {
+    payload.append(static_cast<const char*>(data), int(size));
+    payload.append(int(align8(size) - size), '\0');
+}
+
+bool AirportData::writeSnapshot (const QString& path) const {
+    TRACE_SPAN("airports", "write snapshot");
+    const QByteArray& records = entries.recordData();
+    const QString& pool = entries.stringPool();
+    const QByteArray& keys = searchIndex.keyData();
+    const QByteArray& offsets = searchIndex.offsetData();
+    const QByteArray& rows = searchIndex.rowData();
+    const QByteArray& points = spatialIndex.pointData();
+    const QByteArray& pointRows = spatialIndex.rowData();
+
+    QByteArray payload;
+    appendSection(payload, records.constData(), records.size());
+    appendSection(payload, pool.constData(), pool.size() * qint64(sizeof(QChar)));
+    appendSection(payload, keys.constData(), keys.size());
+    appendSection(payload, offsets.constData(), offsets.size());
+    appendSection(payload, rows.constData(), rows.size());
+    appendSection(payload, points.constData(), points.size());
+    appendSection(payload, pointRows.constData(), pointRows.size());
+
+    SnapshotHeader header;
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version = snapshotVersion;
+    header.byteOrder = snapshotByteOrder;
+    header.entryCount = quint32(entries.size());
+    header.stringLength = quint32(pool.size());
+    header.keyCount = quint32(keys.size() / int(sizeof(quint64)));
+    header.rowCount = quint32(rows.size() / int(sizeof(qint32)));
+    header.pointCount = quint32(spatialIndex.size());
+    header.unused = 0;
+    header.payloadSize = quint64(payload.size());
+    header.checksum = checksum(payload.constData(), payload.size());
+
+    // QSaveFile writes to a temporary file and renames it over the old one on commit, so a crash can't leave a
+    // half-written snapshot behind:
+    QSaveFile file (path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(payload);
+    return file.commit();
+}
+
+bool AirportData::readSnapshot (const QString& path) {
+    TRACE_SPAN("airports", "read snapshot");
+    QSharedPointer<QFile> file (new QFile(path));
+    if (!file->open(QIODevice::ReadOnly)) return false;
+    qint64 size = file->size();
+    if (size < qint64(sizeof(SnapshotHeader))) return false;
+    const uchar* data = file->map(0, size);
+    if (data == nullptr) return false;
+
+    // Validate everything before touching the current data:
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data);
+    if (memcmp(header->magic, snapshotMagic, sizeof(header->magic)) != 0 || header->version != snapshotVersion
+        || header->byteOrder != snapshotByteOrder) {
+        return false;
+    }
+    qint64 entriesSize = align8(header->entryCount * qint64(sizeof(AirportEntries::Record)));
+    qint64 stringsSize = align8(header->stringLength * qint64(sizeof(QChar)));
+    qint64 keysSize    = align8(header->keyCount * qint64(sizeof(quint64)));
+    qint64 offsetsSize = align8((header->keyCount + qint64(1)) * qint64(sizeof(quint32)));
+    qint64 rowsSize    = align8(header->rowCount * qint64(sizeof(qint32)));
+    qint64 pointsSize  = align8(header->pointCount * qint64(3 * sizeof(float)));
+    qint64 pointRowsSize = align8(header->pointCount * qint64(sizeof(qint32)));
+    qint64 payloadSize = entriesSize + stringsSize + keysSize + offsetsSize + rowsSize + pointsSize + pointRowsSize;
+    if (qint64(header->payloadSize) != payloadSize || size != qint64(sizeof(SnapshotHeader)) + payloadSize) {
+        return false;
+    }
+    const char* payload = reinterpret_cast<const char*>(data) + sizeof(SnapshotHeader);
+    if (checksum(payload, payloadSize) != header->checksum) {
+        cerr << "AirportData::readSnapshot: checksum mismatch in " << path.toStdString() << endl;
+        return false;
+    }
+
+    QByteArray records = QByteArray::fromRawData(payload,
+        int(header->entryCount * sizeof(AirportEntries::Record)));
+    QString pool = QString::fromRawData(reinterpret_cast<const QChar*>(payload + entriesSize),
+        int(header->stringLength));
+    const char* keys = payload + entriesSize + stringsSize;
+    const char* offsets = keys + keysSize;
+    const char* rows = offsets + offsetsSize;
+    const char* points = rows + rowsSize;
+    const char* pointRows = points + pointsSize;
+    if (!AirportEntries::validate(records, pool)) return false;
+    const quint32* offsetValues = reinterpret_cast<const quint32*>(offsets);
+    const qint32* rowValues = reinterpret_cast<const qint32*>(rows);
+    for (quint32 k = 0; k < header->keyCount; k++) {
+        if (offsetValues[k] > offsetValues[k + 1]) return false;
+    }
+    if (offsetValues[header->keyCount] != header->rowCount) return false;
+    for (quint32 i = 0; i < header->rowCount; i++) {
+        if (rowValues[i] < 0 || quint32(rowValues[i]) >= header->entryCount) return false;
+    }
+    const qint32* pointRowValues = reinterpret_cast<const qint32*>(pointRows);
+    for (quint32 i = 0; i < header->pointCount; i++) {
+        if (pointRowValues[i] < 0 || quint32(pointRowValues[i]) >= header->entryCount) return false;
+    }
+
+    // The strings and index point into the mapped file instead of being copied out of it, so the file has to stay
+    // open for as long as they're in use:
+    entries.setData(records, pool);
+    searchIndex.setData(
+        QByteArray::fromRawData(keys, int(header->keyCount * sizeof(quint64))),
+        QByteArray::fromRawData(offsets, int((header->keyCount + 1) * sizeof(quint32))),
+        QByteArray::fromRawData(rows, int(header->rowCount * sizeof(qint32))));
+    spatialIndex.setData(
+        QByteArray::fromRawData(points, int(header->pointCount * 3 * sizeof(float))),
+        QByteArray::fromRawData(pointRows, int(header->pointCount * sizeof(qint32))));
+    snapshotFile = file;
+    return true;
+}
@@ -0,0 +1,175 @@
+#include "spatial.h"
+#include "data.h"
+#include "trace.h"
+#include <QtCore/QtMath>
+#include <QtCore/QtNumeric>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+static const double earthRadiusNm = 3440.065;
+
+struct UnitVector {
+    float v[3];
+};
+
+static UnitVector unitVector (double latitude, double longitude) {
+    double lat = qDegreesToRadians(latitude);
+    double lon = qDegreesToRadians(longitude);
+    return { { float(qCos(lat) * qCos(lon)), float(qCos(lat) * qSin(lon)), float(qSin(lat)) } };
+}
+
+// The squared chord length between two points on the unit sphere that are distanceNm apart. Anything more than
+// half way around the world is as far as it gets.
+static float chordSquared (double distanceNm) {
+    double angle = qMin(distanceNm / earthRadiusNm, M_PI);
+    double chord = 2 * qSin(angle / 2);
+    return float(chord * chord);
+}
+
+// Arranges [begin, end) into the implicit k-d tree, see spatial.h.
+static void arrange (int* begin, int* end, int axis, const QVector<UnitVector>& vectors) {
+    if (end - begin <= 1) return;
+    int* middle = begin + (end - begin) / 2;
+    std::nth_element(begin, middle, end, [&] (int a, int b) { return vectors[a].v[axis] < vectors[b].v[axis]; });
+    arrange(begin, middle, (axis + 1) % 3, vectors);
+    arrange(middle + 1, end, (axis + 1) % 3, vectors);
+}
+
+// A query in progress: the best `limit` tree positions found so far, kept as a max-heap on the squared distance.
+struct SpatialQuery {
+    const float* points;
+    float target[3];
+    int limit;
+    float maxBound;                          // squared distance of the search radius
+    float bound;                             // maxBound, or the worst match once `limit` are found if that's closer
+    std::vector<std::pair<float, int>> found;
+};
+
+static void offer (SpatialQuery& query, float distance, int position) {
+    auto& found = query.found;
+    if (int(found.size()) < query.limit) {
+        found.emplace_back(distance, position);
+        std::push_heap(found.begin(), found.end());
+    } else if (distance < found.front().first) {
+        std::pop_heap(found.begin(), found.end());
+        found.back() = { distance, position };
+        std::push_heap(found.begin(), found.end());
+    } else {
+        return;
+    }
+    if (int(found.size()) == query.limit) query.bound = qMin(query.maxBound, found.front().first);
+}
+
+static void searchTree (SpatialQuery& query, int begin, int end, int axis) {
+    while (begin < end) {
+        int middle = begin + (end - begin) / 2;
+        const float* p = query.points + 3 * middle;
+        float dx = p[0] - query.target[0];
+        float dy = p[1] - query.target[1];
+        float dz = p[2] - query.target[2];
+        float distance = dx * dx + dy * dy + dz * dz;
+        if (distance <= query.bound) offer(query, distance, middle);
+
+        // Search the target's side of the split first, then the other side, unless the split is already further
+        // away than anything that would still count:
+        float split = query.target[axis] - p[axis];
+        int next = (axis + 1) % 3;
+        if (split < 0) {
+            searchTree(query, begin, middle, next);
+            if (split * split > query.bound) return;
+            begin = middle + 1;
+        } else {
+            searchTree(query, middle + 1, end, next);
+            if (split * split > query.bound) return;
+            end = middle;
+        }
+        axis = next;
+    }
+}
+
+
+
+// AirportSpatialIndex
+
+void AirportSpatialIndex::clear () {
+    pointBytes.clear();
+    rowBytes.clear();
+}
+
+void AirportSpatialIndex::setData (const QByteArray& points, const QByteArray& rows) {
+    pointBytes = points;
+    rowBytes = rows;
+}
+
+void AirportSpatialIndex::build (const AirportEntries& entries) {
+    TRACE_SPAN("airports", "build spatial index");
+    QVector<qint32> indexed;
+    QVector<UnitVector> vectors;
+    indexed.reserve(entries.size());
+    vectors.reserve(entries.size());
+    for (int row = 0; row < entries.size(); row++) {
+        float latitude = entries.latitude(row);
+        float longitude = entries.longitude(row);
+        if (entries.icao(row).isEmpty() || qIsNaN(latitude) || qIsNaN(longitude)) continue;
+        indexed.append(row);
+        vectors.append(unitVector(latitude, longitude));
+    }
+
+    QVector<int> order (indexed.size());
+    std::iota(order.begin(), order.end(), 0);
+    arrange(order.data(), order.data() + order.size(), 0, vectors);
+
+    QVector<float> treePoints;
+    QVector<qint32> treeRows;
+    treePoints.reserve(order.size() * 3);
+    treeRows.reserve(order.size());
+    for (int i: order) {
+        treePoints << vectors[i].v[0] << vectors[i].v[1] << vectors[i].v[2];
+        treeRows << indexed[i];
+    }
+    pointBytes = QByteArray(reinterpret_cast<const char*>(treePoints.constData()),
+        treePoints.size() * int(sizeof(float)));
+    rowBytes = QByteArray(reinterpret_cast<const char*>(treeRows.constData()),
+        treeRows.size() * int(sizeof(qint32)));
+}
+
+QVector<int> AirportSpatialIndex::nearest (double latitude, double longitude, int count,
+    double maxDistanceNm) const
+{
+    QVector<int> results;
+    if (count <= 0 || size() == 0 || qIsNaN(latitude) || qIsNaN(longitude)) return results;
+
+    SpatialQuery query;
+    query.points = points();
+    UnitVector target = unitVector(latitude, longitude);
+    std::copy(target.v, target.v + 3, query.target);
+    query.limit = qMin(count, size());
+    query.maxBound = maxDistanceNm >= 0 ? chordSquared(maxDistanceNm) : std::numeric_limits<float>::infinity();
+    query.bound = query.maxBound;
+    searchTree(query, 0, size(), 0);
+
+    std::sort_heap(query.found.begin(), query.found.end());
+    results.reserve(int(query.found.size()));
+    for (const auto& match: query.found) {
+        results.append(rows()[match.second]);
+    }
+    return results;
+}
+
+QVector<int> AirportSpatialIndex::within (double latitude, double longitude, double radiusNm) const {
+    if (radiusNm < 0) return QVector<int>();
+    return nearest(latitude, longitude, size(), radiusNm);
+}
+
+double AirportSpatialIndex::distanceNm (double latitude1, double longitude1, double latitude2, double longitude2) {
+    // Haversine formula:
+    double lat1 = qDegreesToRadians(latitude1);
+    double lat2 = qDegreesToRadians(latitude2);
+    double sinLat = qSin((lat2 - lat1) / 2);
+    double sinLon = qSin(qDegreesToRadians(longitude2 - longitude1) / 2);
+    double a = sinLat * sinLat + qCos(lat1) * qCos(lat2) * sinLon * sinLon;
+    return 2 * earthRadiusNm * qAsin(qMin(1.0, qSqrt(a)));
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+class AirportEntries;
+
+// Nearest-airport and radius queries over the airport coordinates, for fetching the weather around a point.
+// Positions are stored as unit vectors, so distances work the same across the date line and near the poles: the
+// straight-line (chord) distance between two vectors grows with the great-circle distance, and the nearest vectors
+// are the nearest airports. The vectors form a balanced k-d tree laid out implicitly in one array: the node for a
+// range of the array is its middle element, split on x, y and z in turn, with the smaller values to its left.
+// Only airports with an ICAO code and coordinates are indexed, since the point is to find stations to ask the
+// dataserver about.
+// Like AirportSearchIndex, the tree is stored flat in byte arrays, so it can be written to the airport snapshot.
+class AirportSpatialIndex {
+    public:
+        void build (const AirportEntries& entries);
+        void clear ();
+        int size () const { return rowBytes.size() / int(sizeof(qint32)); }
+        // Up to count rows nearest to the given position, nearest first; if maxDistanceNm is >= 0, only rows that
+        // are at most that far away.
+        QVector<int> nearest (double latitude, double longitude, int count, double maxDistanceNm = -1) const;
+        // Every row at most radiusNm away, nearest first.
+        QVector<int> within (double latitude, double longitude, double radiusNm) const;
+
+        // Great-circle distance in nautical miles.
+        static double distanceNm (double latitude1, double longitude1, double latitude2, double longitude2);
+
+        // points: float[3 * n] (x, y, z in tree order), rows: qint32[n]
+        const QByteArray& pointData () const { return pointBytes; }
+        const QByteArray& rowData () const   { return rowBytes; }
+        void setData (const QByteArray& points, const QByteArray& rows);
+    private:
+        const float* points () const { return reinterpret_cast<const float*>(pointBytes.constData()); }
+        const qint32* rows () const  { return reinterpret_cast<const qint32*>(rowBytes.constData()); }
+
+        QByteArray pointBytes;
+        QByteArray rowBytes;
+};
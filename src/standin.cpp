@@ -0,0 +1,398 @@
+#include "standin.h"
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QRegExp>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+#include <QtCore/QXmlStreamWriter>
+#include <iostream>
+using namespace std;
+
+
+
+// Report generation
+
+// Pseudo-random bits for a station and a time. Qt's qHash is seeded differently in every process, so this uses its
+// own hash to keep responses the same from run to run.
+static quint32 reportBits (const QString& station, qint64 time) {
+    quint32 hash = 2166136261u; // FNV-1a
+    for (QChar c: station) {
+        hash ^= c.unicode();
+        hash *= 16777619u;
+    }
+    quint64 x = (quint64(hash) << 32) ^ quint64(time);
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull; // splitmix64 finalizer
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return quint32(x);
+}
+
+struct StandInWeather {
+    int windDir;   // 0 when calm
+    int windSpeed;
+    int visibility; // meters, 9999 for 10 km or more
+    QString wx;
+    QString cover;
+    int base;       // ft
+    QString cloudType;
+    int temp;
+    int dewpoint;
+    int qnh;
+};
+
+static StandInWeather weatherAt (const QString& station, qint64 time) {
+    quint32 bits = reportBits(station, time);
+    quint32 climate = reportBits(station, 0);
+    static const char* covers[] = { "FEW", "SCT", "BKN", "OVC" };
+
+    StandInWeather w;
+    w.windSpeed = int(bits % 25);
+    w.windDir = w.windSpeed == 0 ? 0 : 10 + int((bits >> 5) % 36) * 10;
+    switch ((bits >> 9) % 8) {
+        case 0:  w.visibility = 1500; w.wx = "BR";  break;
+        case 1:  w.visibility = 4000; w.wx = "-RA"; break;
+        default: w.visibility = 9999;
+    }
+    w.cover = covers[(bits >> 12) % 4];
+    w.base = 500 + int((bits >> 14) % 40) * 100;
+    w.temp = int(climate % 30) - 5 + int((bits >> 20) % 9) - 4;
+    w.dewpoint = w.temp - int((bits >> 24) % 12);
+    w.qnh = 995 + int((bits >> 18) % 35);
+    return w;
+}
+
+// Which groups of a forecast period are given:
+enum StandInGroups { Wind = 1, Visibility = 2, Sky = 4, AllGroups = 7 };
+
+static QString weatherGroups (const StandInWeather& w, int groups) {
+    QStringList parts;
+    if (groups & Wind) {
+        parts << QString("%1%2KT").arg(w.windDir, 3, 10, QChar('0')).arg(w.windSpeed, 2, 10, QChar('0'));
+    }
+    if (groups & Visibility) {
+        parts << QString("%1").arg(w.visibility, 4, 10, QChar('0'));
+        if (!w.wx.isEmpty()) parts << w.wx;
+    }
+    if (groups & Sky) {
+        parts << QString("%1%2%3").arg(w.cover).arg(w.base / 100, 3, 10, QChar('0')).arg(w.cloudType);
+    }
+    return parts.join(' ');
+}
+
+static QString metarTemp (int temp) {
+    return QString("%1%2").arg(temp < 0 ? "M" : "").arg(qAbs(temp), 2, 10, QChar('0'));
+}
+
+static QString visibilityMiles (int meters) {
+    return QString::number(meters / 1609.344, 'f', 2);
+}
+
+static QString flightCategory (const StandInWeather& w) {
+    bool ceiling = w.cover == "BKN" || w.cover == "OVC";
+    double miles = w.visibility / 1609.344;
+    if (miles < 1 || (ceiling && w.base < 500)) return "LIFR";
+    if (miles < 3 || (ceiling && w.base < 1000)) return "IFR";
+    if (miles <= 5 || (ceiling && w.base <= 3000)) return "MVFR";
+    return "VFR";
+}
+
+static QString isoTime (qint64 time) {
+    return QDateTime::fromSecsSinceEpoch(time, Qt::UTC).toString(Qt::ISODate);
+}
+
+static QString dayTime (qint64 time, const char* format) {
+    return QDateTime::fromSecsSinceEpoch(time, Qt::UTC).toString(format);
+}
+
+static void writeLocation (QXmlStreamWriter& xml, const QString& station) {
+    quint32 climate = reportBits(station, 0);
+    xml.writeTextElement("latitude", QString::number(-60.0 + (climate % 13000) / 100.0, 'f', 2));
+    xml.writeTextElement("longitude", QString::number(-180.0 + ((climate >> 13) % 36000) / 100.0, 'f', 2));
+}
+
+static void writeSky (QXmlStreamWriter& xml, const StandInWeather& w) {
+    xml.writeEmptyElement("sky_condition");
+    xml.writeAttribute("sky_cover", w.cover);
+    xml.writeAttribute("cloud_base_ft_agl", QString::number(w.base));
+    if (!w.cloudType.isEmpty()) xml.writeAttribute("cloud_type", w.cloudType);
+}
+
+static void writeMetar (QXmlStreamWriter& xml, const QString& station, qint64 time) {
+    StandInWeather w = weatherAt(station, time);
+    QString raw = QString("%1 %2Z %3 %4/%5 Q%6").arg(station, dayTime(time, "ddhhmm"), weatherGroups(w, AllGroups),
+        metarTemp(w.temp), metarTemp(w.dewpoint)).arg(w.qnh);
+
+    xml.writeStartElement("METAR");
+    xml.writeTextElement("raw_text", raw);
+    xml.writeTextElement("station_id", station);
+    xml.writeTextElement("observation_time", isoTime(time));
+    writeLocation(xml, station);
+    xml.writeTextElement("temp_c", QString::number(w.temp, 'f', 1));
+    xml.writeTextElement("dewpoint_c", QString::number(w.dewpoint, 'f', 1));
+    xml.writeTextElement("wind_dir_degrees", QString::number(w.windDir));
+    xml.writeTextElement("wind_speed_kt", QString::number(w.windSpeed));
+    xml.writeTextElement("visibility_statute_mi", visibilityMiles(w.visibility));
+    xml.writeTextElement("altim_in_hg", QString::number(w.qnh * 0.0295300, 'f', 6));
+    if (!w.wx.isEmpty()) xml.writeTextElement("wx_string", w.wx);
+    writeSky(xml, w);
+    xml.writeTextElement("flight_category", flightCategory(w));
+    xml.writeTextElement("metar_type", "METAR");
+    xml.writeTextElement("elevation_m", QString::number(reportBits(station, 0) % 1500));
+    xml.writeEndElement();
+}
+
+static void writeTaf (QXmlStreamWriter& xml, const QString& station, qint64 issue) {
+    // Valid for 24 hours from the hour after issue, with a few change groups picked by the station and issue time:
+    qint64 from = issue + 3600, to = from + 24 * 3600;
+    quint32 bits = reportBits(station, issue);
+    struct Period {
+        QString indicator; // empty for the base forecast
+        int probability;
+        qint64 from, to;
+        StandInWeather weather;
+        int groups;
+    };
+    QList<Period> periods;
+    periods.append({ QString(), 0, from, to, weatherAt(station, from), AllGroups });
+    if (bits & 1) {
+        StandInWeather w = weatherAt(station, from + 2 * 3600);
+        w.wx = "SHRA";
+        w.cover = "BKN";
+        w.cloudType = "CB";
+        periods.append({ "TEMPO", 0, from + 2 * 3600, from + 6 * 3600, w, Visibility | Sky });
+    }
+    if (bits & 2) {
+        StandInWeather w = weatherAt(station, from + 8 * 3600);
+        w.visibility = 4000;
+        w.wx = "TSRA";
+        periods.append({ "PROB", 30, from + 8 * 3600, from + 12 * 3600, w, Visibility });
+    }
+    periods.append({ "BECMG", 0, from + 12 * 3600, from + 14 * 3600, weatherAt(station, from + 12 * 3600), Wind });
+    if (bits & 4) {
+        periods.append({ "FM", 0, from + 18 * 3600, to, weatherAt(station, from + 18 * 3600), AllGroups });
+    }
+
+    QStringList raw;
+    raw << "TAF" << station << dayTime(issue, "ddhhmm") + "Z";
+    for (const Period& p: periods) {
+        QString validity = dayTime(p.from, "ddhh") + "/" + dayTime(p.to, "ddhh");
+        if (p.indicator.isEmpty()) {
+            raw << validity;
+        } else if (p.indicator == "FM") {
+            raw << "FM" + dayTime(p.from, "ddhhmm");
+        } else if (p.indicator == "PROB") {
+            raw << QString("PROB%1").arg(p.probability) << validity;
+        } else {
+            raw << p.indicator << validity;
+        }
+        raw << weatherGroups(p.weather, p.groups);
+    }
+
+    xml.writeStartElement("TAF");
+    xml.writeTextElement("raw_text", raw.join(' '));
+    xml.writeTextElement("station_id", station);
+    xml.writeTextElement("issue_time", isoTime(issue));
+    xml.writeTextElement("bulletin_time", isoTime(issue));
+    xml.writeTextElement("valid_time_from", isoTime(from));
+    xml.writeTextElement("valid_time_to", isoTime(to));
+    writeLocation(xml, station);
+    xml.writeTextElement("elevation_m", QString::number(reportBits(station, 0) % 1500));
+    for (const Period& p: periods) {
+        xml.writeStartElement("forecast");
+        xml.writeTextElement("fcst_time_from", isoTime(p.from));
+        xml.writeTextElement("fcst_time_to", isoTime(p.to));
+        if (!p.indicator.isEmpty()) xml.writeTextElement("change_indicator", p.indicator);
+        if (p.probability > 0) xml.writeTextElement("probability", QString::number(p.probability));
+        if (p.groups & Wind) {
+            xml.writeTextElement("wind_dir_degrees", QString::number(p.weather.windDir));
+            xml.writeTextElement("wind_speed_kt", QString::number(p.weather.windSpeed));
+        }
+        if (p.groups & Visibility) {
+            xml.writeTextElement("visibility_statute_mi", visibilityMiles(p.weather.visibility));
+            if (!p.weather.wx.isEmpty()) xml.writeTextElement("wx_string", p.weather.wx);
+        }
+        if (p.groups & Sky) writeSky(xml, p.weather);
+        xml.writeEndElement();
+    }
+    xml.writeEndElement();
+}
+
+QByteArray StandInResponse (const QUrlQuery& query, const QDateTime& now, QString* error) {
+    auto fail = [error] (const QString& message) {
+        if (error != nullptr) *error = message;
+        return QByteArray();
+    };
+    QString dataSource = query.queryItemValue("dataSource");
+    if (dataSource != "metars" && dataSource != "tafs") return fail("Unsupported dataSource: " + dataSource);
+    if (query.hasQueryItem("format") && query.queryItemValue("format") != "xml") {
+        return fail("Only format=xml is supported");
+    }
+    bool ok;
+    double hours = query.queryItemValue("hoursBeforeNow").toDouble(&ok);
+    if (!ok || hours < 0) return fail("hoursBeforeNow is required");
+    QStringList stations = query.queryItemValue("stationString").toUpper()
+        .split(QRegExp("[\\s,]+"), QString::SkipEmptyParts);
+    stations.removeDuplicates();
+    bool mostRecent = query.queryItemValue("mostRecent") == "true";
+    bool mostRecentForEachStation = query.hasQueryItem("mostRecentForEachStation")
+        && query.queryItemValue("mostRecentForEachStation") != "false";
+
+    // Report times, newest first. METARs are on the hour and half hour, TAFs are issued at 05, 11, 17 and 23Z:
+    bool tafs = dataSource == "tafs";
+    qint64 period = tafs ? 6 * 3600 : 1800;
+    qint64 offset = tafs ? -3600 : 0;
+    qint64 end = now.toSecsSinceEpoch();
+    qint64 start = end - qint64(hours * 3600);
+    QList<QPair<qint64, QString>> reports;
+    for (qint64 time = (end - offset) / period * period + offset; time >= start; time -= period) {
+        for (const QString& station: stations) reports.append({ time, station });
+        if (mostRecent || mostRecentForEachStation) break;
+    }
+    if (mostRecent) reports = reports.mid(0, 1);
+
+    QByteArray body;
+    QXmlStreamWriter xml (&body);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeStartElement("response");
+    xml.writeAttribute("version", "1.2");
+    xml.writeTextElement("request_index", "0");
+    xml.writeEmptyElement("data_source");
+    xml.writeAttribute("name", dataSource);
+    xml.writeEmptyElement("request");
+    xml.writeAttribute("type", "retrieve");
+    xml.writeEmptyElement("errors");
+    xml.writeEmptyElement("warnings");
+    xml.writeTextElement("time_taken_ms", "0");
+    xml.writeStartElement("data");
+    xml.writeAttribute("num_results", QString::number(reports.size()));
+    for (const auto& report: reports) {
+        if (tafs) {
+            writeTaf(xml, report.second, report.first);
+        } else {
+            writeMetar(xml, report.second, report.first);
+        }
+    }
+    xml.writeEndElement(); // data
+    xml.writeEndElement(); // response
+    xml.writeEndDocument();
+    return body;
+}
+
+
+
+// DataserverStandIn
+
+DataserverStandIn::DataserverStandIn (QObject* parent) : QTcpServer(parent) {
+    connect(this, &QTcpServer::newConnection, this, &DataserverStandIn::connectionAvailable);
+}
+
+void DataserverStandIn::connectionAvailable () {
+    while (QTcpSocket* socket = nextPendingConnection()) {
+        pending.insert(socket, QByteArray());
+        connect(socket, &QTcpSocket::readyRead, this, &DataserverStandIn::socketReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket] () {
+            pending.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void DataserverStandIn::socketReadyRead () {
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    QByteArray& received = pending[socket];
+    received += socket->readAll();
+
+    // GET requests have no body, so each one ends at the first empty line. Answer every complete one, in order:
+    int end;
+    while ((end = received.indexOf("\r\n\r\n")) >= 0) {
+        QByteArray head = received.left(end);
+        received.remove(0, end + 4);
+        QList<QByteArray> requestLine = head.left(head.indexOf("\r\n")).split(' ');
+        bool close = head.toLower().contains("\r\nconnection: close");
+
+        QByteArray headers, body;
+        if (requestLine.size() != 3 || requestLine[0] != "GET") {
+            headers = "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n";
+        } else {
+            headers = respond(requestLine[1], body);
+        }
+        if (close) headers += "Connection: close\r\n";
+        socket->write(headers + "\r\n" + body);
+        if (close) {
+            socket->disconnectFromHost();
+            return;
+        }
+    }
+}
+
+// Returns the status line and headers, without the empty line that ends them.
+QByteArray DataserverStandIn::respond (const QByteArray& target, QByteArray& body) {
+    QUrl url = QUrl::fromEncoded(target);
+    QUrlQuery query (url);
+    QByteArray status = "200 OK", type = "text/xml";
+    if (url.path().endsWith("/airports.dat") && !airportData.isEmpty()) {
+        type = "text/plain";
+        body = airportData;
+    } else if (query.hasQueryItem("dataSource")) {
+        QString error;
+        body = StandInResponse(query, now.isValid() ? now : QDateTime::currentDateTimeUtc(), &error);
+        if (body.isEmpty()) {
+            status = "400 Bad Request";
+            type = "text/plain";
+            body = error.toUtf8() + '\n';
+        }
+    } else {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Not found\n";
+    }
+    return "HTTP/1.1 " + status + "\r\nContent-Type: " + type + "\r\nContent-Length: "
+        + QByteArray::number(body.size()) + "\r\n";
+}
+
+
+
+// RunStandIn
+
+int RunStandIn (int argc, char* argv[]) {
+    QCoreApplication app (argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serves generated dataserver responses, for offline load tests.");
+    parser.addHelpOption();
+    parser.addOption({ "serve-dataserver", "Run the local dataserver stand-in." });
+    parser.addOption({ "port", "Port to listen on (default 8080).", "port", "8080" });
+    parser.addOption({ "airports", "airports.dat file to serve as well.", "file" });
+    parser.addOption({ "now", "Generate reports as of this time (ISO 8601) instead of the current time.", "time" });
+    parser.process(app);
+
+    DataserverStandIn server;
+    if (parser.isSet("airports")) {
+        QFile file (parser.value("airports"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            cerr << "standin: can't open " << parser.value("airports").toStdString() << endl;
+            return 1;
+        }
+        server.setAirportData(file.readAll());
+    }
+    if (parser.isSet("now")) {
+        QDateTime now = QDateTime::fromString(parser.value("now"), Qt::ISODate);
+        if (!now.isValid()) {
+            cerr << "standin: invalid --now " << parser.value("now").toStdString() << endl;
+            return 1;
+        }
+        server.setNow(now.toUTC());
+    }
+    quint16 port = quint16(parser.value("port").toUInt());
+    if (!server.listen(QHostAddress::LocalHost, port)) {
+        cerr << "standin: " << server.errorString().toStdString() << endl;
+        return 1;
+    }
+    cerr << "standin: dataserver at http://127.0.0.1:" << server.serverPort()
+         << "/adds/dataserver_current/httpparam" << endl;
+    return app.exec();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QUrlQuery>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+// A local stand-in for the dataserver, for load tests that shouldn't depend on (or hammer) the real one.
+//
+// It answers the queries the application makes: dataSource metars or tafs, stationString, hoursBeforeNow,
+// mostRecent and mostRecentForEachStation. Every station ID gets generated reports, a METAR every 30 minutes and a
+// TAF every 6 hours, with the weather derived from the station ID and the report time, so the same query gets the
+// same response as long as "now" is the same. If it's given an airports.dat file, it serves that too, at any path
+// ending in /airports.dat.
+
+// The response body for a dataserver query. Returns an empty array and sets error for queries it can't answer.
+QByteArray StandInResponse (const QUrlQuery& query, const QDateTime& now, QString* error = nullptr);
+
+// Minimal HTTP/1.1 server for StandInResponse: GET only, keep-alive, no chunked encoding.
+class DataserverStandIn : public QTcpServer {
+    Q_OBJECT
+    public:
+        DataserverStandIn (QObject* parent = nullptr);
+        void setAirportData (const QByteArray& csv) { airportData = csv; }
+        // Fixes the time reports are generated for, instead of the time of each request.
+        void setNow (const QDateTime& time) { now = time; }
+    private slots:
+        void connectionAvailable ();
+        void socketReadyRead ();
+    private:
+        QByteArray respond (const QByteArray& target, QByteArray& body);
+        QByteArray airportData;
+        QDateTime now;
+        QHash<QTcpSocket*, QByteArray> pending; // received request bytes that haven't been handled yet
+};
+
+// Stand-in mode (--serve-dataserver): runs DataserverStandIn without any widgets until the process is killed.
+// Returns the process exit code.
+int RunStandIn (int argc, char* argv[]);
@@ -0,0 +1,164 @@
+#include "trace.h"
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSaveFile>
+#include <QtCore/QThread>
+#include <atomic>
+#include <iostream>
+using namespace std;
+
+static const int traceCapacity = 1 << 15; // spans kept
+
+// One span in the ring buffer. Slots are written and read like a seqlock: the writer clears sequence, fills in the
+// fields and then publishes the span's number in sequence. A reader that sees the same non-zero sequence before and
+// after copying the fields got a consistent span. The fields are atomics (with relaxed ordering, so they're plain
+// loads and stores) only to keep concurrent reads and writes well-defined.
+struct TraceSlot {
+    QAtomicInteger<quint64> sequence;
+    QAtomicPointer<const char> category;
+    QAtomicPointer<const char> name;
+    QAtomicInteger<qint64> start;
+    QAtomicInteger<qint64> duration; // -1 for instant events
+    QAtomicInteger<quint64> thread;
+};
+
+static QAtomicPointer<TraceSlot> traceSlots;
+static QAtomicInteger<quint64> traceNext; // number of spans ever recorded
+static QAtomicInt traceEnabled;
+static QAtomicInteger<quint64> guiThread;
+static QString tracePath;
+
+static const QElapsedTimer& traceClock () {
+    static QElapsedTimer clock = [] () { QElapsedTimer timer; timer.start(); return timer; }();
+    return clock;
+}
+
+static quint64 currentThread () {
+    return quint64(quintptr(QThread::currentThreadId()));
+}
+
+void InitTrace () {
+    traceClock();
+    QByteArray setting = qgetenv("WEATHERTOOL_TRACE");
+    if (setting.isEmpty() || setting == "0") return;
+    if (setting != "1") tracePath = QString::fromLocal8Bit(setting);
+    SetTraceEnabled(true);
+}
+
+void FinishTrace () {
+    if (tracePath.isEmpty()) return;
+    if (SaveTrace(tracePath)) {
+        cerr << "FinishTrace: wrote " << tracePath.toStdString() << endl;
+    } else {
+        cerr << "FinishTrace: couldn't write " << tracePath.toStdString() << endl;
+    }
+}
+
+bool TraceEnabled () {
+    return traceEnabled.loadAcquire() != 0;
+}
+
+void SetTraceEnabled (bool enabled) {
+    // Only called from the GUI thread. The buffer is allocated the first time tracing is switched on and kept
+    // until exit, so writers that saw tracing enabled never see it go away.
+    if (enabled && traceSlots.loadAcquire() == nullptr) {
+        traceSlots.storeRelease(new TraceSlot[traceCapacity]);
+        guiThread.store(currentThread());
+    }
+    traceEnabled.storeRelease(enabled ? 1 : 0);
+}
+
+qint64 TraceNow () {
+    return traceClock().nsecsElapsed();
+}
+
+static void traceWrite (const char* category, const char* name, qint64 start, qint64 duration) {
+    if (!TraceEnabled()) return;
+    TraceSlot* slots = traceSlots.loadAcquire();
+    quint64 number = traceNext.fetchAndAddRelaxed(1);
+    TraceSlot& slot = slots[number % traceCapacity];
+    slot.sequence.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.category.store(category);
+    slot.name.store(name);
+    slot.start.store(start);
+    slot.duration.store(duration);
+    slot.thread.store(currentThread());
+    slot.sequence.storeRelease(number + 1);
+}
+
+void TraceRecord (const char* category, const char* name, qint64 start, qint64 end) {
+    traceWrite(category, name, start, qMax(end - start, qint64(0)));
+}
+
+void TraceInstant (const char* category, const char* name) {
+    traceWrite(category, name, TraceNow(), -1);
+}
+
+QByteArray TraceChromeJson () {
+    QJsonArray events;
+    TraceSlot* slots = traceSlots.loadAcquire();
+    quint64 end = traceNext.loadAcquire();
+    quint64 begin = end > quint64(traceCapacity) ? end - traceCapacity : 0;
+
+    // Chrome wants small thread IDs, so number the threads in order of appearance:
+    QHash<quint64, int> threads;
+    threads.insert(guiThread.load(), 1);
+
+    for (quint64 number = begin; slots != nullptr && number < end; number++) {
+        const TraceSlot& slot = slots[number % traceCapacity];
+        quint64 sequence = slot.sequence.loadAcquire();
+        const char* category = slot.category.load();
+        const char* name = slot.name.load();
+        qint64 start = slot.start.load();
+        qint64 duration = slot.duration.load();
+        quint64 thread = slot.thread.load();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence != number + 1 || slot.sequence.load() != sequence) continue; // overwritten or being written
+
+        if (!threads.contains(thread)) threads.insert(thread, threads.size() + 1);
+        QJsonObject event;
+        event.insert("cat", QString::fromLatin1(category));
+        event.insert("name", QString::fromLatin1(name));
+        event.insert("pid", 1);
+        event.insert("tid", threads.value(thread));
+        event.insert("ts", double(start) / 1000.0); // microseconds
+        if (duration < 0) {
+            event.insert("ph", "i");
+            event.insert("s", "t");
+        } else {
+            event.insert("ph", "X");
+            event.insert("dur", double(duration) / 1000.0);
+        }
+        events.append(event);
+    }
+
+    for (auto it = threads.constBegin(); it != threads.constEnd(); ++it) {
+        QJsonObject metadata;
+        metadata.insert("name", "thread_name");
+        metadata.insert("ph", "M");
+        metadata.insert("pid", 1);
+        metadata.insert("tid", it.value());
+        QJsonObject args;
+        args.insert("name", it.value() == 1 ? QString("GUI thread") : QString("Thread %1").arg(it.value()));
+        metadata.insert("args", args);
+        events.append(metadata);
+    }
+
+    QJsonObject trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+bool SaveTrace (const QString& path) {
+    QSaveFile file (path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(TraceChromeJson());
+    return file.commit();
+}
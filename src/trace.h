@@ -0,0 +1,41 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+// Performance tracing. Spans (a name, a start and an end time) go into a fixed-size ring buffer that any thread can
+// write to without taking a lock; once it's full, the oldest spans are overwritten. The buffer can be saved as
+// Chrome trace_event JSON and opened in chrome://tracing or https://ui.perfetto.dev.
+//
+// Tracing is off unless the WEATHERTOOL_TRACE environment variable is set or it's switched on from the Debug menu.
+// If WEATHERTOOL_TRACE names a file (anything other than "1"), the trace is saved there on exit.
+//
+// Categories and names are stored as pointers, so they have to be string literals.
+
+void InitTrace ();   // reads WEATHERTOOL_TRACE
+void FinishTrace (); // saves the trace to the file WEATHERTOOL_TRACE names, if any
+bool TraceEnabled ();
+void SetTraceEnabled (bool enabled);
+
+// Nanoseconds on the trace clock, which starts in InitTrace.
+qint64 TraceNow ();
+void TraceRecord (const char* category, const char* name, qint64 start, qint64 end);
+void TraceInstant (const char* category, const char* name);
+
+QByteArray TraceChromeJson ();
+bool SaveTrace (const QString& path);
+
+// Records a span covering its own lifetime.
+class TraceSpan {
+    public:
+        TraceSpan (const char* category, const char* name)
+            : category(category), name(name), start(TraceEnabled() ? TraceNow() : -1) {}
+        ~TraceSpan () { if (start >= 0) TraceRecord(category, name, start, TraceNow()); }
+    private:
+        const char* category;
+        const char* name;
+        qint64 start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(category, name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__) (category, name)
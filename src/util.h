@@ -1,5 +1,9 @@
 #pragma once
+#include <QtCore/QVector>
+#include <QtGui/QFontMetrics>
+#include <QtWidgets/QHeaderView>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QTableView>
 
 static QMessageBox* _OpenMessageBox_messageBox = nullptr;
 
@@ -14,4 +18,33 @@ static void OpenMessageBox (QWidget* parent, QMessageBox::Icon icon, const QStri
     _OpenMessageBox_messageBox->setIcon(icon);
     _OpenMessageBox_messageBox->setWindowModality(Qt::WindowModal);
     _OpenMessageBox_messageBox->show();
-}
\ No newline at end of file
+}
+// Sizes the columns of table to fit their header and a sample of the rows: the first ones and some spread over the
+// rest. This replaces QHeaderView::ResizeToContents, which measures every cell again on every layout change.
+// Columns only get wider, so they don't jump around as rows come in, unless shrink is set.
+static void FitColumns (QTableView* table, bool shrink = false) {
+    QAbstractItemModel* model = table->model();
+    if (model == nullptr) return;
+    const int firstRows = 32, spreadRows = 32;
+    const int padding = 16; // cell margins and the grid line
+    int rowCount = model->rowCount();
+    QVector<int> sample;
+    for (int row = 0; row < qMin(rowCount, firstRows); row++) {
+        sample.append(row);
+    }
+    for (int i = 1; rowCount > firstRows && i <= spreadRows; i++) {
+        sample.append(firstRows + (rowCount - firstRows - 1) * i / spreadRows);
+    }
+
+    QHeaderView* header = table->horizontalHeader();
+    QFontMetrics headerMetrics (header->font());
+    QFontMetrics cellMetrics (table->font());
+    for (int column = 0; column < model->columnCount(); column++) {
+        int width = headerMetrics.horizontalAdvance(model->headerData(column, Qt::Horizontal).toString());
+        for (int row: sample) {
+            width = qMax(width, cellMetrics.horizontalAdvance(model->index(row, column).data().toString()));
+        }
+        width = qMax(width + padding, header->minimumSectionSize());
+        if (shrink || width > header->sectionSize(column)) header->resizeSection(column, width);
+    }
+}
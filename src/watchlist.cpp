@@ -0,0 +1,261 @@
+#include "watchlist.h"
+#include "dataserver.h"
+#include <iostream>
+using namespace std;
+
+WatchlistModel::WatchlistModel(RequestCoordinator* requestCoordinator, WeatherDecoder* weatherDecoder,
+    QObject* parent)
+    : QAbstractTableModel(parent), requestCoordinator(requestCoordinator), weatherDecoder(weatherDecoder) {}
+
+void WatchlistModel::setStations(const QStringList& stations) {
+    beginResetModel();
+    watched.clear();
+    for (const QString& station: stations) {
+        QString code = station.trimmed().toUpper();
+        if (!code.isEmpty() && !watched.contains(code)) watched.append(code);
+    }
+    endResetModel();
+    emit stationsChanged(watched);
+}
+
+void WatchlistModel::addStation(const QString& station) {
+    QString code = station.trimmed().toUpper();
+    if (code.isEmpty() || watched.contains(code)) return;
+    beginInsertRows(QModelIndex(), watched.size(), watched.size());
+    watched.append(code);
+    endInsertRows();
+    emit stationsChanged(watched);
+}
+
+void WatchlistModel::removeStation(const QString& station) {
+    int row = watched.indexOf(station);
+    if (row < 0) return;
+    beginRemoveRows(QModelIndex(), row, row);
+    watched.removeAt(row);
+    endRemoveRows();
+    emit stationsChanged(watched);
+}
+
+void WatchlistModel::setBatchSize(int size) {
+    batchSize = qMax(1, size);
+}
+
+void WatchlistModel::refresh() {
+    // A refresh supersedes whatever the previous one was still waiting for:
+    refreshToken.cancel();
+    refreshToken = CancellationToken();
+    if (watched.isEmpty()) {
+        refreshing = false;
+        emit refreshFinished(true);
+        return;
+    }
+
+    // Only the latest report of each station is shown, so ask for just that:
+    QList<QUrl> urls;
+    for (int i = 0; i < watched.size(); i += batchSize) {
+        QStringList batch = watched.mid(i, batchSize);
+        urls.append(DataserverUrl("tafs", batch,
+            { { "hoursBeforeNow", "24" }, { "mostRecentForEachStation", "constraint" } }));
+        urls.append(DataserverUrl("metars", batch,
+            { { "hoursBeforeNow", "3" }, { "mostRecentForEachStation", "constraint" } }));
+    }
+    refreshing = true;
+    requestCoordinator->getAll(urls, refreshToken, [this] (const QVector<RequestResult>& results) {
+        requestsFinished(results);
+    });
+}
+
+void WatchlistModel::requestsFinished(const QVector<RequestResult>& results) {
+    bool requestsFailed = false;
+    for (const RequestResult& result: results) {
+        if (result.error != QNetworkReply::NoError) {
+            requestsFailed = true;
+            cerr << "WatchlistModel::requestsFinished: failed with code " << result.error << endl;
+        }
+    }
+    if (requestsFailed) {
+        refreshing = false;
+        emit refreshFinished(false);
+        return;
+    }
+
+    // Everything's in, parse all batches into one store, off the GUI thread:
+    weatherDecoder->decodeAll(results, refreshToken,
+        [this] (const MetarColumns& newMetars, const TafRecords& newTafs) {
+            refreshing = false;
+            QVector<QString> before = reportTexts();
+            metars = newMetars;
+            tafs = newTafs;
+            generation++;
+            groupByStation();
+            signalChanged(before);
+            emit refreshFinished(true);
+        });
+}
+
+void WatchlistModel::mergeReports(const MetarColumns& newMetars, const TafRecords& newTafs) {
+    QVector<QString> before = reportTexts();
+    metars.append(newMetars);
+    metars.derive();
+    tafs.append(newTafs);
+    groupByStation();
+    keepLatest();
+    generation++;
+    signalChanged(before);
+}
+
+void WatchlistModel::keepLatest() {
+    // Only the latest reports are shown, so don't let merged ones pile up:
+    MetarColumns latestMetars;
+    TafRecords latestTafs;
+    for (const QString& station: watched) {
+        auto metar = latestMetar.find(station);
+        if (metar != latestMetar.end()) metar.value() = latestMetars.appendRow(metars, metar.value());
+        auto taf = latestTaf.find(station);
+        if (taf != latestTaf.end()) taf.value() = latestTafs.appendReport(tafs, taf.value());
+    }
+    latestMetars.derive();
+    metars = latestMetars;
+    tafs = latestTafs;
+    // Stations that aren't watched (any more) have nothing left to point at:
+    for (auto it = latestMetar.begin(); it != latestMetar.end();) {
+        it = watched.contains(it.key()) ? it + 1 : latestMetar.erase(it);
+    }
+    for (auto it = latestTaf.begin(); it != latestTaf.end();) {
+        it = watched.contains(it.key()) ? it + 1 : latestTaf.erase(it);
+    }
+}
+
+QVector<QString> WatchlistModel::reportTexts() const {
+    QVector<QString> texts;
+    texts.reserve(watched.size());
+    for (const QString& station: watched) {
+        texts.append(reportText(station));
+    }
+    return texts;
+}
+
+void WatchlistModel::signalChanged(const QVector<QString>& before) {
+    // The rows are the watched stations and don't change, so only signal the ones whose reports did:
+    for (int row = 0; row < watched.size(); row++) {
+        if (reportText(watched[row]) == before[row]) continue;
+        emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+    }
+}
+
+QString WatchlistModel::reportText(const QString& station) const {
+    // The raw texts cover everything the other columns show:
+    QString text;
+    auto metar = latestMetar.constFind(station);
+    if (metar != latestMetar.constEnd()) text += metars.raw(metar.value());
+    text += '\n';
+    auto taf = latestTaf.constFind(station);
+    if (taf != latestTaf.constEnd()) text += tafs.reports[taf.value()].rawText;
+    return text;
+}
+
+void WatchlistModel::groupByStation() {
+    latestMetar.clear();
+    latestTaf.clear();
+    for (int row = 0; row < metars.count(); row++) {
+        const QString& station = metars.stations[metars.station[row]];
+        auto it = latestMetar.find(station);
+        if (it == latestMetar.end()) {
+            latestMetar.insert(station, row);
+        } else if (metars.observationTime[row] > metars.observationTime[it.value()]) {
+            it.value() = row;
+        }
+    }
+    for (int report = 0; report < tafs.reports.size(); report++) {
+        const TafReport& taf = tafs.reports[report];
+        auto it = latestTaf.find(taf.stationId);
+        if (it == latestTaf.end()) {
+            latestTaf.insert(taf.stationId, report);
+        } else if (taf.issueTime > tafs.reports[it.value()].issueTime) {
+            it.value() = report;
+        }
+    }
+}
+
+int WatchlistModel::rowCount(const QModelIndex& parent) const {
+    if (parent.isValid()) return 0;
+    return watched.size();
+}
+
+int WatchlistModel::columnCount(const QModelIndex& parent) const {
+    if (parent.isValid()) return 0;
+    return ColumnCount;
+}
+
+const MetarColumns* WatchlistModel::metarAt(int row, int& metarRow) const {
+    if (row < 0 || row >= watched.size()) return nullptr;
+    auto it = latestMetar.constFind(watched[row]);
+    if (it == latestMetar.constEnd()) return nullptr;
+    metarRow = it.value();
+    return &metars;
+}
+
+int WatchlistModel::metarColumn(int column) const {
+    switch (column) {
+        case Category:      return MetarFlightCategory;
+        case Time:          return MetarTime;
+        case Temperature:   return MetarTemperature;
+        case WindDirection: return MetarWindDirection;
+        case WindSpeed:     return MetarWindSpeed;
+        case Visibility:    return MetarVisibility;
+        case Sky:           return MetarSky;
+    }
+    return -1;
+}
+
+QVariant WatchlistModel::data(const QModelIndex& index, int role) const {
+    if (role != Qt::DisplayRole && role != Qt::BackgroundRole) return QVariant();
+    if (index.row() < 0 || index.row() >= watched.size()) return QVariant();
+    const QString& station = watched[index.row()];
+
+    // Colour-code the flight category, like MetarModel:
+    if (role == Qt::BackgroundRole) {
+        auto it = latestMetar.constFind(station);
+        if (index.column() != Category || it == latestMetar.constEnd()) return QVariant();
+        return metars.background(it.value(), MetarFlightCategory);
+    }
+
+    if (index.column() == Station) return QVariant(station);
+    if (index.column() == RawTaf) {
+        auto it = latestTaf.constFind(station);
+        if (it == latestTaf.constEnd()) return QVariant();
+        return QVariant(tafs.reports[it.value()].rawText);
+    }
+
+    auto it = latestMetar.constFind(station);
+    if (it == latestMetar.constEnd()) return QVariant();
+    switch (index.column()) {
+        case Category:      return metars.display(it.value(), MetarFlightCategory);
+        case Time:          return metars.display(it.value(), MetarTime);
+        case Temperature:   return metars.display(it.value(), MetarTemperature);
+        case WindDirection: return metars.display(it.value(), MetarWindDirection);
+        case WindSpeed:     return metars.display(it.value(), MetarWindSpeed);
+        case Visibility:    return metars.display(it.value(), MetarVisibility);
+        case Sky:           return metars.display(it.value(), MetarSky);
+        case RawMetar:      return metars.display(it.value(), MetarRawText);
+    }
+    return QVariant();
+}
+
+QVariant WatchlistModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (role != Qt::DisplayRole) return QVariant();
+    if (orientation != Qt::Orientation::Horizontal) return QVariant();
+    switch (section) {
+        case Station:       return QVariant(tr("Station"));
+        case Category:      return QVariant(tr("Category"));
+        case Time:          return QVariant(tr("Time"));
+        case Temperature:   return QVariant(tr("Temperature"));
+        case WindDirection: return QVariant(tr("Wind"));
+        case WindSpeed:     return QVariant(tr("Wind speed"));
+        case Visibility:    return QVariant(tr("Visibility"));
+        case Sky:           return QVariant(tr("Sky condition"));
+        case RawMetar:      return QVariant(tr("Raw METAR text"));
+        case RawTaf:        return QVariant(tr("Raw TAF text"));
+    }
+    return QVariant();
+}
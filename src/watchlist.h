@@ -0,0 +1,69 @@
+#pragma once
+#include <QtCore/QAbstractTableModel>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include "data.h"
+#include "decoder.h"
+#include "requests.h"
+
+// Latest METAR and TAF for each watched station, one row per station.
+// A refresh fetches every station with one TAF and one METAR request per batch of batchSize stations (the
+// dataserver takes a comma-separated stationString), instead of two requests per station. The parsed records of all
+// stations share one MetarColumns/TafRecords store and are grouped by station afterwards. The responses are parsed
+// on the thread pool, see WeatherDecoder::decodeAll.
+class WatchlistModel : public QAbstractTableModel, public MetarRowSource {
+    Q_OBJECT
+    public:
+        enum Column { Station, Category, Time, Temperature, WindDirection, WindSpeed, Visibility, Sky, RawMetar, RawTaf,
+            ColumnCount };
+
+        WatchlistModel(RequestCoordinator* requestCoordinator, WeatherDecoder* weatherDecoder,
+            QObject* parent = nullptr);
+        const QStringList& stations() const { return watched; }
+        void setStations(const QStringList& stations);
+        void addStation(const QString& station);
+        void removeStation(const QString& station);
+        void setBatchSize(int size);
+        void refresh();
+        bool isRefreshing() const { return refreshing; }
+        // Takes in reports fetched elsewhere (see scheduler.h), for whichever watched stations they cover.
+        void mergeReports(const MetarColumns& newMetars, const TafRecords& newTafs);
+        // Everything the last refresh brought in:
+        const MetarColumns& metarData() const { return metars; }
+        const TafRecords& tafData() const { return tafs; }
+
+        const MetarColumns* metarAt(int row, int& metarRow) const;
+        const MetarColumns* metarStore() const { return &metars; }
+        int metarColumn(int column) const;
+        quint32 metarGeneration() const { return generation; }
+
+        int rowCount(const QModelIndex& parent = QModelIndex()) const;
+        int columnCount(const QModelIndex& parent = QModelIndex()) const;
+        QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+        QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    signals:
+        void stationsChanged(const QStringList& stations);
+        void refreshFinished(bool ok);
+    private:
+        void requestsFinished(const QVector<RequestResult>& results);
+        void groupByStation();
+        void keepLatest();
+        QString reportText(const QString& station) const;
+        QVector<QString> reportTexts() const;
+        void signalChanged(const QVector<QString>& before);
+
+        RequestCoordinator* requestCoordinator;
+        WeatherDecoder* weatherDecoder;
+        QStringList watched;
+        int batchSize = 25;
+
+        CancellationToken refreshToken;
+        bool refreshing = false;
+
+        MetarColumns metars;
+        TafRecords tafs;
+        QHash<QString, int> latestMetar; // station -> row in metars
+        QHash<QString, int> latestTaf;   // station -> report in tafs
+        quint32 generation = 0;          // see MetarRowSource
+};